@@ -275,11 +275,11 @@ packet_handler(struct rte_mbuf *pkt, struct onvm_pkt_meta *meta,
 static int
 packet_bulk_handler(struct rte_mbuf **pkts, uint16_t nb_pkts,
                __attribute__((unused)) struct onvm_nf_local_ctx *nf_local_ctx) {
-        // TODO: To be hand optimized
         static uint32_t counter = 0;
-        int ret;
-        int i = 0;
+        struct onvm_pkt_burst_tuples tuples;
         struct onvm_pkt_meta *meta;
+        int ret;
+        int i;
 
         counter += nb_pkts;
         if (counter >= print_delay) {
@@ -289,16 +289,22 @@ packet_bulk_handler(struct rte_mbuf **pkts, uint16_t nb_pkts,
 
         stats.pkt_total += nb_pkts;
 
-        for (int i = 0; i < nb_pkts; i++) {
-                ret = firewall_check(pkts[i]);
-                // ret = (rules[i] & RTE_LPM_LOOKUP_SUCCESS) ? 0 : -ENOENT;
+        /* Parse the whole burst at once, then check the rules field by field */
+        onvm_pkt_parse_burst(pkts, nb_pkts, &tuples);
+        for (i = 0; i < nb_pkts; i++) {
                 meta = onvm_get_pkt_meta((struct rte_mbuf *)pkts[i]);
-                if (ret < 0) {
+                if (!(tuples.ipv4[i / 64] & (1ULL << (i % 64)))) {
+                        stats.pkt_not_ipv4++;
                         meta->action = ONVM_NF_ACTION_DROP;
-                        stats.pkt_drop++;
-                        return 0;
+                        continue;
                 }
 
+                if (tuples.proto[i] == IPPROTO_TCP || tuples.proto[i] == IPPROTO_UDP)
+                        ret = firewall_5tuple_handler(tuples.src_addr[i], tuples.dst_addr[i], tuples.proto[i],
+                                                      tuples.src_port[i], tuples.dst_port[i]);
+                else
+                        ret = 0;  // protocol unknown, as in firewall_check
+
                 switch (ret) {
                 case 0:
                         meta->action = ONVM_NF_ACTION_TONF;
@@ -113,7 +113,7 @@ cleanup(void) {
         rte_ring_free(ring_to_sdn);
         rte_ring_free(ring_from_sdn);
         printf("Freeing memory for hash table.\n");
-        rte_hash_free(sdn_ft->hash);
+        rte_hash_free(onvm_flow_dir_table()->hash);
 }
 
 static int
@@ -151,7 +151,7 @@ do_stats_display(struct rte_mbuf *pkt, int32_t tbl_index) {
         /* Fix unused variable warnings: */
         (void)pkt;
 
-        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)onvm_ft_get_data(sdn_ft, tbl_index);
+        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)onvm_ft_get_data(onvm_flow_dir_table(), tbl_index);
         total_pkts += print_delay;
 
         /* Clear screen and move to top left */
@@ -209,29 +209,22 @@ datapath_handle_read(struct datapath *dp) {
                                 struct ofp_flow_mod *fm;
                                 fm = (struct ofp_flow_mod *)ofph;
                                 int ret;
-                                struct onvm_ft_ipv4_5tuple *fk;
-                                struct onvm_service_chain *sc;
+                                struct onvm_ft_ipv4_5tuple fk;
+                                struct onvm_service_chain sc;
                                 struct onvm_flow_entry *flow_entry = NULL;
                                 uint32_t buffer_id = ntohl(fm->buffer_id);
                                 if (buffer_id == UINT32_MAX) {
                                         break;
                                 }
                                 struct sdn_pkt_list *sdn_list;
-                                fk = flow_key_extract(&fm->match);
+                                flow_key_extract(&fm->match, &fk);
                                 size_t actions_len = ntohs(fm->header.length) - sizeof(*fm);
-                                sc = flow_action_extract(&fm->actions[0], actions_len);
-                                ret = onvm_flow_dir_get_key(fk, &flow_entry);
-                                if (ret == -ENOENT) {
-                                        ret = onvm_flow_dir_add_key(fk, &flow_entry);
-                                } else if (ret >= 0) {
-                                        rte_free(flow_entry->key);
-                                        rte_free(flow_entry->sc);
-                                } else {
-                                        rte_exit(EXIT_FAILURE, "onvm_flow_dir_get parameters are invalid");
+                                flow_action_extract(&fm->actions[0], actions_len, &sc);
+                                /* Also points a flow already in the table to the new chain */
+                                ret = onvm_flow_dir_add_key(&fk, &sc, &flow_entry);
+                                if (ret < 0) {
+                                        rte_exit(EXIT_FAILURE, "Cannot add flow or intern its service chain\n");
                                 }
-                                memset(flow_entry, 0, sizeof(struct onvm_flow_entry));
-                                flow_entry->key = fk;
-                                flow_entry->sc = sc;
                                 flow_entry->idle_timeout = OFP_FLOW_PERMANENT;
                                 flow_entry->hard_timeout = OFP_FLOW_PERMANENT;
                                 sdn_list = (struct sdn_pkt_list *)onvm_ft_get_data(pkt_buf_ft, buffer_id);
@@ -441,33 +434,21 @@ make_packet_in(int xid, uint32_t buffer_id, char *buf, struct rte_mbuf *pkt) {
         return len;
 }
 
-struct onvm_ft_ipv4_5tuple *
-flow_key_extract(struct ofp_match *match) {
-        struct onvm_ft_ipv4_5tuple *fk;
-        fk = rte_calloc("flow_key", 1, sizeof(struct onvm_ft_ipv4_5tuple), 0);
-        if (fk == NULL) {
-                rte_exit(EXIT_FAILURE, "Cannot allocate memory for flow key\n");
-        }
-
+void
+flow_key_extract(struct ofp_match *match, struct onvm_ft_ipv4_5tuple *fk) {
+        memset(fk, 0, sizeof(struct onvm_ft_ipv4_5tuple));
         fk->src_addr = match->nw_src;
         fk->dst_addr = match->nw_dst;
         fk->proto = match->nw_proto;
         fk->src_port = match->tp_src;
         fk->dst_port = match->tp_dst;
-
-        return fk;
 }
 
-struct onvm_service_chain *
-flow_action_extract(struct ofp_action_header *oah, size_t actions_len) {
+void
+flow_action_extract(struct ofp_action_header *oah, size_t actions_len, struct onvm_service_chain *chain) {
         uint8_t *p = (uint8_t *)oah;
-        struct onvm_service_chain *chain;
-
-        chain = rte_calloc("service chain", 1, sizeof(struct onvm_service_chain), 0);
-        if (chain == NULL) {
-                rte_exit(EXIT_FAILURE, "Cannot allocate memory for service chain\n");
-        }
 
+        memset(chain, 0, sizeof(struct onvm_service_chain));
         if (actions_len == 0) {
                 onvm_sc_append_entry(chain, ONVM_NF_ACTION_DROP, 0);
         } else {
@@ -485,8 +466,6 @@ flow_action_extract(struct ofp_action_header *oah, size_t actions_len) {
                         actions_len -= len;
                 }
         }
-
-        return chain;
 }
 
 int
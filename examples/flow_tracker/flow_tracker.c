@@ -219,7 +219,7 @@ do_stats_display(struct state_info *state_info) {
  * if so, it calls clear_entries() to free up space.
  */
 static int
-table_add_entry(struct onvm_ft_ipv4_5tuple *key, struct state_info *state_info) {
+table_add_entry(struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, struct state_info *state_info) {
         struct flow_stats *data = NULL;
 
         if (unlikely(key == NULL || state_info == NULL)) {
@@ -233,7 +233,7 @@ table_add_entry(struct onvm_ft_ipv4_5tuple *key, struct state_info *state_info)
                 }
         }
 
-        int tbl_index = onvm_ft_add_key(state_info->ft, key, (char **)&data);
+        int tbl_index = onvm_ft_add_key_with_hash(state_info->ft, key, sig, (char **)&data);
         if (tbl_index < 0) {
                 return -1;
         }
@@ -263,9 +263,10 @@ table_lookup_entry(struct rte_mbuf *pkt, struct state_info *state_info) {
         if (ret < 0)
                 return -1;
 
-        int tbl_index = onvm_ft_lookup_key(state_info->ft, &key, (char **)&data);
+        hash_sig_t sig = onvm_ft_hash(state_info->ft, pkt, &key);
+        int tbl_index = onvm_ft_lookup_key_with_hash(state_info->ft, &key, sig, (char **)&data);
         if (tbl_index == -ENOENT) {
-                return table_add_entry(&key, state_info);
+                return table_add_entry(&key, sig, state_info);
         } else if (tbl_index < 0) {
                 printf("Some other error occurred with the packet hashing\n");
                 return -1;
@@ -348,7 +349,7 @@ main(int argc, char *argv[]) {
                 rte_exit(EXIT_FAILURE, "Invalid command-line arguments");
         }
 
-        state_info->ft = onvm_ft_create(TBL_SIZE, sizeof(struct flow_stats));
+        state_info->ft = onvm_ft_create_with_flags(TBL_SIZE, sizeof(struct flow_stats), ONVM_FT_FLAG_RSS_HASH);
         if (state_info->ft == NULL) {
                 onvm_nflib_stop(nf_local_ctx);
                 rte_exit(EXIT_FAILURE, "Unable to create flow table");
@@ -413,7 +413,7 @@ clear_entries(void) {
  * if so, it calls clear_entries() to free up space.
  */
 static int
-table_add_entry(struct onvm_ft_ipv4_5tuple *key, struct flow_info **flow) {
+table_add_entry(struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, struct flow_info **flow) {
         struct flow_info *data = NULL;
 
         if (unlikely(key == NULL || lb == NULL)) {
@@ -427,7 +427,7 @@ table_add_entry(struct onvm_ft_ipv4_5tuple *key, struct flow_info **flow) {
                 }
         }
 
-        int tbl_index = onvm_ft_add_key(lb->ft, key, (char **)&data);
+        int tbl_index = onvm_ft_add_key_with_hash(lb->ft, key, sig, (char **)&data);
         if (tbl_index < 0) {
                 return -1;
         }
@@ -460,9 +460,10 @@ table_lookup_entry(struct rte_mbuf *pkt, struct flow_info **flow) {
         if (ret < 0)
                 return -1;
 
-        int tbl_index = onvm_ft_lookup_key(lb->ft, &key, (char **)&data);
+        hash_sig_t sig = onvm_ft_hash(lb->ft, pkt, &key);
+        int tbl_index = onvm_ft_lookup_key_with_hash(lb->ft, &key, sig, (char **)&data);
         if (tbl_index == -ENOENT) {
-                return table_add_entry(&key, flow);
+                return table_add_entry(&key, sig, flow);
         } else if (tbl_index < 0) {
                 printf("Some other error occurred with the packet hashing\n");
                 return -1;
@@ -598,7 +599,7 @@ main(int argc, char *argv[]) {
         if (parse_app_args(argc, argv, progname) < 0)
                 rte_exit(EXIT_FAILURE, "Invalid command-line arguments\n");
 
-        lb->ft = onvm_ft_create(TABLE_SIZE, sizeof(struct flow_info));
+        lb->ft = onvm_ft_create_with_flags(TABLE_SIZE, sizeof(struct flow_info), ONVM_FT_FLAG_RSS_HASH);
         if (lb->ft == NULL) {
                 onvm_nflib_stop(nf_local_ctx);
                 rte_exit(EXIT_FAILURE, "Unable to create flow table");
@@ -156,6 +156,7 @@ packet_handler(struct rte_mbuf *pkt, struct onvm_pkt_meta *meta,
                __attribute__((unused)) struct onvm_nf_local_ctx *nf_local_ctx) {
         static uint32_t counter = 0;
         struct onvm_flow_entry *flow_entry = NULL;
+        struct onvm_service_chain chain;
         int ret;
 
         if (++counter == print_delay) {
@@ -167,15 +168,14 @@ packet_handler(struct rte_mbuf *pkt, struct onvm_pkt_meta *meta,
         if (ret >= 0) {
                 meta->action = ONVM_NF_ACTION_NEXT;
         } else {
-                ret = onvm_flow_dir_add_pkt(pkt, &flow_entry);
+                memset(&chain, 0, sizeof(struct onvm_service_chain));
+                onvm_sc_append_entry(&chain, ONVM_NF_ACTION_TONF, destination);
+                ret = onvm_flow_dir_add_pkt(pkt, &chain, &flow_entry);
                 if (ret < 0) {
                         meta->action = ONVM_NF_ACTION_DROP;
                         meta->destination = 0;
                         return 0;
                 }
-                memset(flow_entry, 0, sizeof(struct onvm_flow_entry));
-                flow_entry->sc = onvm_sc_create();
-                onvm_sc_append_entry(flow_entry->sc, ONVM_NF_ACTION_TONF, destination);
                 // onvm_sc_print(flow_entry->sc);
         }
         return 0;
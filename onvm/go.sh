@@ -14,6 +14,32 @@ function usage {
         echo -e "\tRuns ONVM the same way as above, but prints statistics to stdout"
         echo -e "$0 0,1,2,3 3 0xF0 -s stdout -c"
         echo -e "\tRuns ONVM the same way as above, but enables shared cpu support"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -b"
+        echo -e "\tRuns ONVM the same way as above, but sends new flows to the less loaded instance of a service"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -i 100"
+        echo -e "\tRuns ONVM the same way as above, but RX/TX threads sleep after 100us without packets"
+        echo -e "$0 0,1,2,3,4 3 0xF0 -s stdout -q 2 -e 5"
+        echo -e "\tRuns ONVM the same way as above, but with 2 RX threads and RSS tables rebalanced every 5 seconds"
+        echo -e "$0 0,1,2,3,4 3 0xF0 -s stdout -q 2 -m \"(0,0,0),(0,1,1),(1,0,1)\""
+        echo -e "\tRuns ONVM with port 0 queue 0 on RX thread 0, and port 0 queue 1 and port 1 queue 0 on RX thread 1"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -w acl_rules.txt"
+        echo -e "\tRuns ONVM the same way as above, but steers traffic with the wildcard rules in acl_rules.txt"
+        echo -e "$0 0,1,2,3,4 3 0xF0 -s stdout -j 5"
+        echo -e "\tRuns ONVM the same way as above, but only evens out NF load over the TX threads every 5 seconds"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -x 8"
+        echo -e "\tRuns ONVM the same way as above, but lets up to 8 NFs started with -x send on their own NIC TX queue"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -g 50"
+        echo -e "\tRuns ONVM the same way as above, but no packet waits more than 50us in a partly filled buffer"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -u 128"
+        echo -e "\tRuns ONVM the same way as above, but RX/TX threads move packets in bursts of up to 128"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -o 1048576"
+        echo -e "\tRuns ONVM the same way as above, but the flow director starts with room for 1M flows"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -y 1000"
+        echo -e "\tRuns ONVM the same way as above, but traces the latency of 1 in 1000 packets along their chain"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -c -h 2"
+        echo -e "\tRuns ONVM the same way as above, but shares cores between NFs and moves NFs off overloaded cores every 2 seconds"
+        echo -e "$0 0,1,2,3 3 0xF0 -s stdout -A 80,10,30"
+        echo -e "\tRuns ONVM the same way as above, but NFs started with -c get children above 80% load and lose them below 10%, at most every 30 seconds"
         echo -e "$0 0,1,2,3 3 0xF0 -s stdout -t 42"
         echo -e "\tRuns ONVM the same way as above, but shuts down after 42 seconds"
         echo -e "$0 0,1,2,3 3 0xF0 -s stdout -l 64"
@@ -44,7 +70,7 @@ then
     usage
 fi
 
-while getopts "a:r:d:s:t:l:p:z:cv" opt; do
+while getopts "a:r:d:s:t:l:p:z:i:k:q:m:e:f:w:j:x:g:u:o:y:h:A:cbv" opt; do
     case $opt in
         a) virt_addr="--base-virtaddr=$OPTARG";;
         r) num_srvc="-r $OPTARG";;
@@ -55,6 +81,22 @@ while getopts "a:r:d:s:t:l:p:z:cv" opt; do
         p) web_port="$OPTARG";;
         z) stats_sleep_time="-z $OPTARG";;
         c) shared_cpu_flag="-c";;
+        b) load_aware_flag="-b";;
+        i) adaptive_idle="-i $OPTARG";;
+        k) adaptive_spin="-k $OPTARG";;
+        q) rx_threads="-q $OPTARG";;
+        m) rx_map="-m $OPTARG";;
+        e) reta_rebalance="-e $OPTARG";;
+        f) rx_prefetch="-f $OPTARG";;
+        w) acl_rules="-w $OPTARG";;
+        j) tx_rebalance="-j $OPTARG";;
+        x) nf_tx_queues="-x $OPTARG";;
+        g) flush_deadline="-g $OPTARG";;
+        u) burst_size="-u $OPTARG";;
+        o) flow_entries="-o $OPTARG";;
+        y) trace_sample="-y $OPTARG";;
+        h) core_rebalance="-h $OPTARG";;
+        A) autoscale="-A $OPTARG";;
         v) verbosity=$(($verbosity+1));;
         \?) echo "Unknown option -$OPTARG" && usage
             ;;
@@ -77,7 +119,7 @@ then
 fi
 
 sudo rm -rf /mnt/huge/rtemap_*
-sudo $SCRIPTPATH/onvm_mgr/$RTE_TARGET/onvm_mgr -l $cpu -n 4 --proc-type=primary ${virt_addr} -- -p ${ports} -n ${nf_cores} ${num_srvc} ${def_srvc} ${stats} ${stats_sleep_time} ${verbosity_level} ${ttl} ${packet_limit} ${shared_cpu_flag}
+sudo $SCRIPTPATH/onvm_mgr/$RTE_TARGET/onvm_mgr -l $cpu -n 4 --proc-type=primary ${virt_addr} -- -p ${ports} -n ${nf_cores} ${num_srvc} ${def_srvc} ${stats} ${stats_sleep_time} ${verbosity_level} ${ttl} ${packet_limit} ${shared_cpu_flag} ${load_aware_flag} ${adaptive_idle} ${adaptive_spin} ${rx_threads} ${rx_map} ${reta_rebalance} ${rx_prefetch} ${acl_rules} ${tx_rebalance} ${nf_tx_queues} ${flush_deadline} ${burst_size} ${flow_entries} ${trace_sample} ${core_rebalance} ${autoscale}
 
 if [ "${stats}" = "-s web" ]
 then
@@ -52,7 +52,11 @@
 #include "onvm_mgr.h"
 #include "onvm_nf.h"
 #include "onvm_pkt.h"
+#include "onvm_rss.h"
 #include "onvm_stats.h"
+#include "onvm_tx_balance.h"
+#include "onvm_core_balance.h"
+#include "onvm_autoscale.h"
 
 /****************************Internal Declarations****************************/
 
@@ -68,6 +72,23 @@ static uint8_t worker_keep_running = 1;
 static void
 handle_signal(int sig);
 
+/*
+ * Fold the per RX thread packet counters into the shared port stats.
+ */
+static void
+collect_rx_stats(void) {
+        uint16_t i, j, port_id;
+        uint64_t rx;
+
+        for (i = 0; i < ports->num_ports; i++) {
+                port_id = ports->id[i];
+                rx = 0;
+                for (j = 0; j < num_rx_threads; j++)
+                        rx += rx_threads[j].rx_pkts[port_id];
+                ports->rx_stats.rx[port_id] = rx;
+        }
+}
+
 /*******************************Worker threads********************************/
 
 /*
@@ -103,6 +124,19 @@ master_thread_main(void) {
         /* Loop forever: sleep always returns 0 or <= param */
         while (main_keep_running && sleep(sleeptime) <= sleeptime) {
                 onvm_nf_check_status();
+                collect_rx_stats();
+                if (global_reta_rebalance_period)
+                        onvm_rss_rebalance();
+                if (global_tx_rebalance_period)
+                        onvm_tx_balance_rebalance();
+                /* Always measures NF load, moves NFs only when enabled */
+                onvm_core_balance_rebalance();
+                /* Only acts on services with an NF started with -c, after the loads above are measured */
+                onvm_autoscale_update();
+                /* Retries dispatch table updates that had to wait for readers */
+                onvm_sc_dispatch_maintain();
+                /* Grows the flow director when asked to and frees tables replaced by growing it */
+                onvm_flow_dir_maintain();
                 if (stats_destination != ONVM_STATS_NONE)
                         onvm_stats_display_all(sleeptime, verbosity_level);
 
@@ -174,36 +208,158 @@ master_thread_main(void) {
         RTE_LOG(INFO, APP, "Core %d: Master thread done\n", rte_lcore_id());
 }
 
+/*
+ * Adaptive polling: a manager thread keeps busy polling while it sees packets.
+ * Once it has seen adaptive_poll_spin_budget empty polls in a row it starts
+ * timing, and after adaptive_poll_idle_us without packets it goes to sleep
+ * until an RX interrupt or NF doorbell, or ADAPTIVE_POLL_MAX_SLEEP_MS passes.
+ */
+struct adaptive_poll_state {
+        uint32_t empty_polls;
+        uint64_t idle_start;
+};
+
+static inline int
+adaptive_poll_should_sleep(struct adaptive_poll_state *state, uint16_t pkt_count) {
+        uint64_t now;
+
+        if (likely(pkt_count > 0)) {
+                state->empty_polls = 0;
+                state->idle_start = 0;
+                return 0;
+        }
+        if (state->empty_polls < onvm_config->adaptive_poll_spin_budget) {
+                state->empty_polls++;
+                return 0;
+        }
+
+        now = rte_get_tsc_cycles();
+        if (state->idle_start == 0) {
+                state->idle_start = now;
+                return 0;
+        }
+        if ((now - state->idle_start) * US_PER_S < (uint64_t)onvm_config->adaptive_poll_idle_us * rte_get_timer_hz())
+                return 0;
+
+        state->empty_polls = 0;
+        state->idle_start = 0;
+        return 1;
+}
+
+/*
+ * Read one burst from every (port, queue) this RX thread owns and hand it on.
+ * Returns the number of packets read.
+ */
+static inline uint16_t
+rx_thread_poll_ports(struct queue_mgr *rx_mgr, struct rte_mbuf **pkts) {
+        struct rx_thread_info *rx_info = &rx_threads[rx_mgr->id];
+        struct rx_queue_info *rxq;
+        uint16_t i, rx_count, total = 0;
+
+        for (i = 0; i < rx_info->num_queues; i++) {
+                rxq = &rx_info->queues[i];
+                rx_count = rte_eth_rx_burst(rxq->port_id, rxq->queue_id, pkts, rx_mgr->burst_size);
+                rx_info->rx_pkts[rxq->port_id] += rx_count;
+
+                /* Now process the NIC packets read */
+                if (likely(rx_count > 0)) {
+                        onvm_rss_count_pkts(rx_info, rxq->port_id, pkts, rx_count);
+                        // If there is no running NF, we drop all the packets of the batch.
+                        if (!num_nfs) {
+                                onvm_pkt_drop_batch(pkts, rx_count);
+                        } else {
+                                onvm_pkt_process_rx_batch(rx_mgr, pkts, rx_count, rxq->queue_id);
+                        }
+                        total += rx_count;
+                }
+        }
+
+        /* Send what is due, even on empty polls so the flush deadline holds */
+        onvm_pkt_flush_all_nfs(rx_mgr, NULL);
+
+        return total;
+}
+
+/*
+ * Register this RX thread's queues with the thread's epoll instance.
+ * Returns 0 if all of them support RX interrupts.
+ */
+static int
+rx_thread_intr_init(struct queue_mgr *rx_mgr) {
+        struct rx_thread_info *rx_info = &rx_threads[rx_mgr->id];
+        uint16_t i;
+        int ret;
+
+        for (i = 0; i < rx_info->num_queues; i++) {
+                ret = rte_eth_dev_rx_intr_ctl_q(rx_info->queues[i].port_id, rx_info->queues[i].queue_id,
+                                                RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+                if (ret != 0) {
+                        RTE_LOG(INFO, APP, "Core %d: Port %u has no RX interrupts (%d), RX thread will not sleep\n",
+                                rte_lcore_id(), rx_info->queues[i].port_id, ret);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+static void
+rx_thread_sleep(struct queue_mgr *rx_mgr, struct rte_mbuf **pkts) {
+        struct rte_epoll_event events[ONVM_MAX_RX_QUEUES_PER_THREAD];
+        struct rx_thread_info *rx_info = &rx_threads[rx_mgr->id];
+        struct adaptive_poll_stats *stats = &rx_poll_stats[rx_mgr->id];
+        uint64_t start;
+        uint16_t i;
+        int n;
+
+        for (i = 0; i < rx_info->num_queues; i++)
+                rte_eth_dev_rx_intr_enable(rx_info->queues[i].port_id, rx_info->queues[i].queue_id);
+
+        /* Packets that arrived before the interrupts were armed raise none */
+        if (rx_thread_poll_ports(rx_mgr, pkts) == 0) {
+                /* Nothing may wait in our buffers while we sleep */
+                onvm_pkt_flush_all_idle(rx_mgr, NULL);
+                start = rte_get_tsc_cycles();
+                n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, rx_info->num_queues, ADAPTIVE_POLL_MAX_SLEEP_MS);
+                stats->sleep_cycles += rte_get_tsc_cycles() - start;
+                stats->sleeps++;
+                if (n > 0)
+                        stats->wakeups++;
+        }
+
+        for (i = 0; i < rx_info->num_queues; i++)
+                rte_eth_dev_rx_intr_disable(rx_info->queues[i].port_id, rx_info->queues[i].queue_id);
+}
+
 /*
  * Function to receive packets from the NIC
  * and distribute them to the default service
  */
 static int
 rx_thread_main(void *arg) {
-        uint16_t i, rx_count, cur_lcore;
-        struct rte_mbuf *pkts[PACKET_READ_SIZE];
+        uint16_t rx_count, cur_lcore;
+        struct rte_mbuf *pkts[ONVM_MAX_BURST_SIZE];
         struct queue_mgr *rx_mgr = (struct queue_mgr *)arg;
+        struct adaptive_poll_state poll_state = {0, 0};
+        uint8_t adaptive_poll;
         cur_lcore = rte_lcore_id();
 
         onvm_stats_gen_event_info("Rx Start", ONVM_EVENT_WITH_CORE, &cur_lcore);
-        RTE_LOG(INFO, APP, "Core %d: Running RX thread for RX queue %d\n", cur_lcore, rx_mgr->id);
+        RTE_LOG(INFO, APP, "Core %d: Running RX thread %d for %d RX queues\n", cur_lcore, rx_mgr->id,
+                rx_threads[rx_mgr->id].num_queues);
 
+        adaptive_poll = onvm_config->flags.ONVM_ADAPTIVE_POLL && rx_threads[rx_mgr->id].num_queues > 0 &&
+                        rx_thread_intr_init(rx_mgr) == 0;
+
+        onvm_quiesce_mgr_register();
         for (; worker_keep_running;) {
+                /* No dispatch tables or flow entries are held between bursts */
+                onvm_quiesce_mgr();
+
                 /* Read ports */
-                for (i = 0; i < ports->num_ports; i++) {
-                        rx_count = rte_eth_rx_burst(ports->id[i], rx_mgr->id, pkts, PACKET_READ_SIZE);
-                        ports->rx_stats.rx[ports->id[i]] += rx_count;
-
-                        /* Now process the NIC packets read */
-                        if (likely(rx_count > 0)) {
-                                // If there is no running NF, we drop all the packets of the batch.
-                                if (!num_nfs) {
-                                        onvm_pkt_drop_batch(pkts, rx_count);
-                                } else {
-                                        onvm_pkt_process_rx_batch(rx_mgr, pkts, rx_count, rx_mgr->id);
-                                }
-                        }
-                }
+                rx_count = rx_thread_poll_ports(rx_mgr, pkts);
+
+                if (adaptive_poll && unlikely(adaptive_poll_should_sleep(&poll_state, rx_count)))
+                        rx_thread_sleep(rx_mgr, pkts);
         }
 
         RTE_LOG(INFO, APP, "Core %d: RX thread done\n", rte_lcore_id());
@@ -213,36 +369,111 @@ rx_thread_main(void *arg) {
         return 0;
 }
 
+static void
+tx_thread_sleep(struct queue_mgr *tx_mgr, sem_t *doorbell) {
+        struct adaptive_poll_stats *stats = &tx_poll_stats[tx_mgr->id];
+        rte_atomic16_t *sleeping = &tx_doorbells->sleeping[tx_mgr->id];
+        struct tx_thread_info *info = tx_mgr->tx_thread_info;
+        struct timespec timeout;
+        struct onvm_nf *nf;
+        uint64_t start, end, ring_tsc;
+        unsigned i;
+        int ret;
+
+        /* Nothing may wait in our buffers while we sleep */
+        onvm_pkt_flush_all_idle(tx_mgr, NULL);
+
+        rte_atomic16_set(sleeping, 1);
+        /* Packets enqueued before the flag was visible ring no doorbell */
+        rte_smp_mb();
+        for (i = 0; i < info->num_nfs; i++) {
+                nf = &nfs[info->nfs[i]];
+                if (onvm_nf_is_valid(nf) && rte_ring_count(nf->tx_q) > 0)
+                        break;
+        }
+        /* Also stay up if NFs were moved to or from this thread */
+        if (i < info->num_nfs || onvm_tx_balance_changed(info)) {
+                if (rte_atomic16_cmpset((volatile uint16_t *)&sleeping->cnt, 1, 0))
+                        return;
+                /* An NF already claimed the doorbell, take its post below */
+        }
+
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += ADAPTIVE_POLL_MAX_SLEEP_MS * 1000000L;
+        if (timeout.tv_nsec >= 1000000000L) {
+                timeout.tv_sec++;
+                timeout.tv_nsec -= 1000000000L;
+        }
+
+        start = rte_get_tsc_cycles();
+        ret = sem_timedwait(doorbell, &timeout);
+        end = rte_get_tsc_cycles();
+        stats->sleep_cycles += end - start;
+        stats->sleeps++;
+
+        /* Timed out with nobody ringing */
+        if (rte_atomic16_cmpset((volatile uint16_t *)&sleeping->cnt, 1, 0))
+                return;
+
+        /* An NF rang the doorbell. A post racing our timeout is taken by the next sleep */
+        ring_tsc = tx_doorbells->ring_tsc[tx_mgr->id];
+        if (ret == 0) {
+                stats->wakeups++;
+                if (end > ring_tsc)
+                        stats->wakeup_latency_cycles += end - ring_tsc;
+        }
+}
+
 static int
 tx_thread_main(void *arg) {
         struct onvm_nf *nf;
         unsigned i, tx_count, cur_lcore;
-        struct rte_mbuf *pkts[PACKET_READ_SIZE];
+        uint16_t nf_id, total_tx;
+        struct rte_mbuf *pkts[ONVM_MAX_BURST_SIZE];
         struct queue_mgr *tx_mgr = (struct queue_mgr *)arg;
+        struct tx_thread_info *info = tx_mgr->tx_thread_info;
+        struct adaptive_poll_state poll_state = {0, 0};
+        sem_t *doorbell = NULL;
         cur_lcore = rte_lcore_id();
 
         onvm_stats_gen_event_info("Tx Start", ONVM_EVENT_WITH_CORE, &cur_lcore);
-        if (tx_mgr->tx_thread_info->first_nf == tx_mgr->tx_thread_info->last_nf - 1) {
-                RTE_LOG(INFO, APP, "Core %d: Running TX thread for NF %d\n", cur_lcore,
-                        tx_mgr->tx_thread_info->first_nf);
-        } else if (tx_mgr->tx_thread_info->first_nf < tx_mgr->tx_thread_info->last_nf) {
-                RTE_LOG(INFO, APP, "Core %d: Running TX thread for NFs %d to %d\n", cur_lcore,
-                        tx_mgr->tx_thread_info->first_nf, tx_mgr->tx_thread_info->last_nf - 1);
+        onvm_tx_balance_update_thread(tx_mgr);
+        RTE_LOG(INFO, APP, "Core %d: Running TX thread %d, NFs are assigned to it as they start\n", cur_lcore,
+                tx_mgr->id);
+
+        if (onvm_config->flags.ONVM_ADAPTIVE_POLL) {
+                doorbell = sem_open(get_tx_thread_sem_name(tx_mgr->id), O_CREAT, 0666, 0);
+                if (doorbell == SEM_FAILED) {
+                        RTE_LOG(INFO, APP, "Core %d: Cannot create TX doorbell, TX thread will not sleep\n",
+                                cur_lcore);
+                        doorbell = NULL;
+                }
         }
 
+        onvm_quiesce_mgr_register();
         for (; worker_keep_running;) {
+                onvm_quiesce_mgr();
+
+                /* Hand over or pick up NFs between bursts, never while holding their packets */
+                if (unlikely(onvm_tx_balance_changed(info)))
+                        onvm_tx_balance_update_thread(tx_mgr);
+
+                total_tx = 0;
                 /* Read packets from the NF's tx queue and process them as needed */
-                for (i = tx_mgr->tx_thread_info->first_nf; i < tx_mgr->tx_thread_info->last_nf; i++) {
-                        nf = &nfs[i];
+                for (i = 0; i < info->num_nfs; i++) {
+                        nf_id = info->nfs[i];
+                        nf = &nfs[nf_id];
                         if (!onvm_nf_is_valid(nf))
                                 continue;
 
                         /* Dequeue all packets in ring up to max possible. */
-                        tx_count = rte_ring_dequeue_burst(nf->tx_q, (void **)pkts, PACKET_READ_SIZE, NULL);
+                        tx_count = rte_ring_dequeue_burst(nf->tx_q, (void **)pkts, tx_mgr->burst_size, NULL);
 
                         /* Now process the Client packets read */
                         if (likely(tx_count > 0)) {
                                 onvm_pkt_process_tx_batch(tx_mgr, pkts, tx_count, nf);
+                                tx_nf_loads[nf_id].pkts += tx_count;
+                                total_tx += tx_count;
                         }
                 }
 
@@ -251,10 +482,17 @@ tx_thread_main(void *arg) {
 
                 /* Send a burst to every NF */
                 onvm_pkt_flush_all_nfs(tx_mgr, NULL);
+
+                if (doorbell != NULL && unlikely(adaptive_poll_should_sleep(&poll_state, total_tx)))
+                        tx_thread_sleep(tx_mgr, doorbell);
         }
 
         RTE_LOG(INFO, APP, "Core %d: TX thread done\n", rte_lcore_id());
 
+        if (doorbell != NULL) {
+                sem_close(doorbell);
+                sem_unlink(get_tx_thread_sem_name(tx_mgr->id));
+        }
         free(tx_mgr->tx_thread_info->port_tx_bufs);
         free(tx_mgr->tx_thread_info);
         free(tx_mgr->nf_rx_bufs);
@@ -315,7 +553,8 @@ wakeup_thread_main(void *arg) {
 int
 main(int argc, char *argv[]) {
         unsigned cur_lcore, rx_lcores, tx_lcores, wakeup_lcores;
-        unsigned nfs_per_tx, nfs_per_wakeup_thread;
+        unsigned nfs_per_wakeup_thread;
+        uint64_t flush_deadline_cycles;
         unsigned i;
 
         /* initialise the system */
@@ -327,10 +566,10 @@ main(int argc, char *argv[]) {
         /* clear statistics */
         onvm_stats_clear_all_nfs();
 
-        /* Reserve n cores for: ONVM_NUM_MGR_AUX_THREADS for auxiliary(f.e. stats), ONVM_NUM_RX_THREADS for Rx, and all
+        /* Reserve n cores for: ONVM_NUM_MGR_AUX_THREADS for auxiliary(f.e. stats), num_rx_threads for Rx, and all
          * remaining for Tx (subtract wakeup cores if shared core mode is enabled) */
         cur_lcore = rte_lcore_id();
-        rx_lcores = ONVM_NUM_RX_THREADS;
+        rx_lcores = num_rx_threads;
         tx_lcores = rte_lcore_count() - rx_lcores - ONVM_NUM_MGR_AUX_THREADS;
 
         /* If shared core mode enabled adjust core numbers */
@@ -355,16 +594,14 @@ main(int argc, char *argv[]) {
                 RTE_LOG(INFO, APP, "%d cores available for handling wakeup\n", wakeup_lcores);
         RTE_LOG(INFO, APP, "%d cores available for handling stats\n", 1);
 
-        /* Evenly assign NFs to TX threads */
-
         /*
-         * If num NFs is zero, then we are running in dynamic NF mode.
-         * We do not have a way to tell the total number of NFs running so
-         * we have to calculate nfs_per_tx using MAX_NFS then.
-         * We want to distribute the number of running NFs across available
-         * TX threads
+         * NFs are spread over the TX threads as they start, and moved
+         * between them by the master thread as their load changes
          */
-        nfs_per_tx = ceil((float)MAX_NFS / tx_lcores);
+        num_tx_threads = tx_lcores;
+        onvm_tx_balance_init();
+
+        flush_deadline_cycles = (uint64_t)onvm_config->flush_deadline_us * rte_get_timer_hz() / US_PER_S;
 
         // We start the system with 0 NFs active
         num_nfs = 0;
@@ -380,26 +617,30 @@ main(int argc, char *argv[]) {
                 tx_mgr->tx_thread_info = calloc(1, sizeof(struct tx_thread_info));
                 tx_mgr->tx_thread_info->port_tx_bufs = calloc(RTE_MAX_ETHPORTS, sizeof(struct packet_buf));
                 tx_mgr->nf_rx_bufs = calloc(MAX_NFS, sizeof(struct packet_buf));
-                tx_mgr->tx_thread_info->first_nf = RTE_MIN(i * nfs_per_tx + 1, (unsigned)MAX_NFS);
-                tx_mgr->tx_thread_info->last_nf = RTE_MIN((i + 1) * nfs_per_tx + 1, (unsigned)MAX_NFS);
+                tx_mgr->flush_deadline_cycles = flush_deadline_cycles;
+                tx_mgr->burst_size = onvm_config->burst_size;
+                tx_mgr->flush_stats = &tx_flush_stats[i];
                 cur_lcore = rte_get_next_lcore(cur_lcore, 1, 1);
                 if (rte_eal_remote_launch(tx_thread_main, (void *)tx_mgr, cur_lcore) == -EBUSY) {
-                        RTE_LOG(ERR, APP, "Core %d is already busy, can't use for nf %d TX\n", cur_lcore,
-                                tx_mgr->tx_thread_info->first_nf);
+                        RTE_LOG(ERR, APP, "Core %d is already busy, can't use for TX thread %d\n", cur_lcore,
+                                tx_mgr->id);
                         return -1;
                 }
         }
 
-        /* Launch RX thread main function for each RX queue on cores */
+        /* Launch RX thread main function on cores, each polls the queues in rx_threads[] */
         for (i = 0; i < rx_lcores; i++) {
                 struct queue_mgr *rx_mgr = calloc(1, sizeof(struct queue_mgr));
                 rx_mgr->mgr_type_t = MGR;
                 rx_mgr->id = i;
                 rx_mgr->tx_thread_info = NULL;
                 rx_mgr->nf_rx_bufs = calloc(MAX_NFS, sizeof(struct packet_buf));
+                rx_mgr->flush_deadline_cycles = flush_deadline_cycles;
+                rx_mgr->burst_size = onvm_config->burst_size;
+                rx_mgr->flush_stats = &rx_flush_stats[i];
                 cur_lcore = rte_get_next_lcore(cur_lcore, 1, 1);
                 if (rte_eal_remote_launch(rx_thread_main, (void *)rx_mgr, cur_lcore) == -EBUSY) {
-                        RTE_LOG(ERR, APP, "Core %d is already busy, can't use for RX queue id %d\n", cur_lcore,
+                        RTE_LOG(ERR, APP, "Core %d is already busy, can't use for RX thread %d\n", cur_lcore,
                                 rx_mgr->id);
                         return -1;
                 }
@@ -79,9 +79,49 @@ uint8_t global_verbosity_level = 1;
 /* global flag for enabling shared core logic - extern in init.h */
 uint8_t ONVM_NF_SHARE_CORES = 0;
 
+/* global var for the number of manager RX threads - extern in init.h */
+uint16_t num_rx_threads = ONVM_NUM_RX_THREADS;
+
+/* global var for the (port, queue) pairs each RX thread polls - extern in init.h */
+struct rx_thread_info rx_threads[ONVM_MAX_RX_THREADS];
+
+/* global var for the number of RX queues set up on each port - extern in init.h */
+uint16_t num_rx_queues[RTE_MAX_ETHPORTS];
+
+/* global var for how many seconds between RSS table rebalances, 0 is off - extern in init.h */
+uint16_t global_reta_rebalance_period = 0;
+
+/* global var for how many packets ahead RX threads prefetch, 0 is off - extern in init.h */
+uint16_t global_rx_prefetch_distance = RX_PREFETCH_DISTANCE_DEFAULT;
+
+/* global var for how many seconds between NF to TX thread rebalances, 0 is off - extern in init.h */
+uint16_t global_tx_rebalance_period = TX_REBALANCE_PERIOD_DEFAULT;
+
+/* global var for how many NIC TX queues per port NFs can ask for - extern in init.h */
+uint16_t global_num_nf_tx_queues = NF_TX_QUEUES_DEFAULT;
+
+/* global var for how many seconds between moves of NFs off overloaded cores, 0 is off - extern in init.h */
+uint16_t global_core_rebalance_period = CORE_REBALANCE_PERIOD_DEFAULT;
+
+/* global vars for when services scale out and in, and how long they wait between changes - extern in init.h */
+uint16_t global_autoscale_out_pct = AUTOSCALE_OUT_PCT_DEFAULT;
+uint16_t global_autoscale_in_pct = AUTOSCALE_IN_PCT_DEFAULT;
+uint16_t global_autoscale_cooldown = AUTOSCALE_COOLDOWN_DEFAULT;
+
+/* global var for the wildcard flow classifier rules file, NULL if none - extern in init.h */
+const char *global_acl_rules_file = NULL;
+
 /* global var for program name */
 static const char *progname;
 
+/* (port, queue, thread) triples given with -m, applied once all args are parsed */
+static struct {
+        uint16_t port_id;
+        uint16_t queue_id;
+        uint16_t thread_id;
+} rx_map[ONVM_MAX_RX_THREADS * ONVM_MAX_RX_QUEUES_PER_THREAD];
+static uint16_t rx_map_size = 0;
+
 /***********************Internal Functions prototypes*************************/
 
 static void
@@ -114,6 +154,51 @@ parse_stats_sleep_time(const char *sleeptime);
 static int
 parse_verbosity_level(const char *verbosity_level);
 
+static int
+parse_adaptive_poll_idle(const char *idle_us);
+
+static int
+parse_adaptive_poll_spin(const char *spin_budget);
+
+static int
+parse_num_rx_threads(const char *rx_threads);
+
+static int
+parse_rx_map(const char *rx_map_str);
+
+static int
+parse_reta_rebalance_period(const char *period);
+
+static int
+parse_rx_prefetch_distance(const char *distance);
+
+static int
+parse_tx_rebalance_period(const char *period);
+
+static int
+parse_num_nf_tx_queues(const char *nf_tx_queues);
+
+static int
+parse_flush_deadline(const char *deadline_us);
+
+static int
+parse_burst_size(const char *burst_size);
+
+static int
+parse_flow_dir_entries(const char *entries);
+
+static int
+parse_trace_sample(const char *sample);
+
+static int
+parse_core_rebalance_period(const char *period);
+
+static int
+parse_autoscale(const char *spec);
+
+static int
+init_rx_threads(void);
+
 /*********************************Interfaces**********************************/
 
 int
@@ -126,11 +211,20 @@ parse_app_args(uint8_t max_ports, int argc, char *argv[]) {
             {"nf-cores", required_argument, NULL, 'n'},  {"default-service", required_argument, NULL, 'd'},
             {"stats-out", no_argument, NULL, 's'},       {"stats-sleep-time", no_argument, NULL, 'z'},
             {"time_to_live", no_argument, NULL, 't'},    {"packet_limit", no_argument, NULL, 'l'},
-            {"verbocity-level", no_argument, NULL, 'v'}, {"enable_shared_cpu", no_argument, NULL, 'c'}};
+            {"verbocity-level", no_argument, NULL, 'v'}, {"enable_shared_cpu", no_argument, NULL, 'c'},
+            {"enable_load_aware_dispatch", no_argument, NULL, 'b'},
+            {"adaptive_poll_idle", required_argument, NULL, 'i'}, {"adaptive_poll_spin", required_argument, NULL, 'k'},
+            {"rx-threads", required_argument, NULL, 'q'},         {"rx-map", required_argument, NULL, 'm'},
+            {"reta-rebalance", required_argument, NULL, 'e'},     {"rx-prefetch", required_argument, NULL, 'f'},
+            {"acl-rules", required_argument, NULL, 'w'},          {"tx-rebalance", required_argument, NULL, 'j'},
+            {"nf-tx-queues", required_argument, NULL, 'x'},       {"flush-deadline", required_argument, NULL, 'g'},
+            {"burst-size", required_argument, NULL, 'u'},         {"flow-entries", required_argument, NULL, 'o'},
+            {"trace-sample", required_argument, NULL, 'y'},      {"core-rebalance", required_argument, NULL, 'h'},
+            {"autoscale", required_argument, NULL, 'A'}};
 
         progname = argv[0];
 
-        while ((opt = getopt_long(argc, argvopt, "p:r:n:d:s:t:l:z:v:c", lgopts, &option_index)) != EOF) {
+        while ((opt = getopt_long(argc, argvopt, "p:r:n:d:s:t:l:z:v:cbi:k:q:m:e:f:w:j:x:g:u:o:y:h:A:", lgopts, &option_index)) != EOF) {
                 switch (opt) {
                         case 'p':
                                 if (parse_portmask(max_ports, optarg) != 0) {
@@ -192,6 +286,97 @@ parse_app_args(uint8_t max_ports, int argc, char *argv[]) {
                                 onvm_config->flags.ONVM_NF_SHARE_CORES = 1;
                                 ONVM_NF_SHARE_CORES = 1;
                                 break;
+                        case 'b':
+                                onvm_config->flags.ONVM_LOAD_AWARE_DISPATCH = 1;
+                                break;
+                        case 'i':
+                                if (parse_adaptive_poll_idle(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                onvm_config->flags.ONVM_ADAPTIVE_POLL = 1;
+                                break;
+                        case 'k':
+                                if (parse_adaptive_poll_spin(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'q':
+                                if (parse_num_rx_threads(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'm':
+                                if (parse_rx_map(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'e':
+                                if (parse_reta_rebalance_period(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'f':
+                                if (parse_rx_prefetch_distance(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'w':
+                                global_acl_rules_file = optarg;
+                                break;
+                        case 'j':
+                                if (parse_tx_rebalance_period(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'x':
+                                if (parse_num_nf_tx_queues(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'g':
+                                if (parse_flush_deadline(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'u':
+                                if (parse_burst_size(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'o':
+                                if (parse_flow_dir_entries(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'y':
+                                if (parse_trace_sample(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'h':
+                                if (parse_core_rebalance_period(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
+                        case 'A':
+                                if (parse_autoscale(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
                         default:
                                 printf("ERROR: Unknown option '%c'\n", opt);
                                 usage();
@@ -199,6 +384,11 @@ parse_app_args(uint8_t max_ports, int argc, char *argv[]) {
                 }
         }
 
+        if (init_rx_threads() != 0) {
+                usage();
+                return -1;
+        }
+
         return 0;
 }
 
@@ -216,7 +406,38 @@ usage(void) {
             "\t-t TTL: time to live, how many seconds to wait until exiting (optional)\n"
             "\t-l PACKET_LIMIT: how many millions of packets to recieve before exiting (optional)\n"
             "\t-v VERBOCITY_LEVEL: verbocity level of the stats output (optional)\n"
-            "\t-c ENABLE_SHARED_CORE: allow the NFs to share a core based on mutex sleep/wakeups (optional)\n",
+            "\t-c ENABLE_SHARED_CORE: allow the NFs to share a core based on mutex sleep/wakeups (optional)\n"
+            "\t-b ENABLE_LOAD_AWARE_DISPATCH: send new flows to the less loaded of two instances of a service (optional)\n"
+            "\t-i IDLE_US: enable adaptive polling, RX/TX threads sleep after IDLE_US microseconds without packets "
+            "(optional)\n"
+            "\t-k SPIN_BUDGET: empty polls before adaptive polling starts timing an idle period. defaults to 1024 "
+            "(optional)\n"
+            "\t-q NUM_RX_THREADS: number of manager RX threads. defaults to 1 (optional)\n"
+            "\t-m RX_MAP: (port,queue,thread),... which RX thread polls each port queue. defaults to thread N "
+            "polling queue N of every port (optional)\n"
+            "\t-e RETA_REBALANCE_SECS: every RETA_REBALANCE_SECS seconds rewrite the RSS redirection tables to "
+            "even out RX queue load (optional)\n"
+            "\t-f PREFETCH_DIST: how many packets ahead RX threads prefetch headers, 0 disables it. defaults to 4 "
+            "(optional)\n"
+            "\t-w ACL_RULES_FILE: wildcard rules sending traffic classes to service chains, see onvm_flow_acl.h "
+            "(optional)\n"
+            "\t-j TX_REBALANCE_SECS: every TX_REBALANCE_SECS seconds move busy NFs off overloaded TX threads, 0 "
+            "disables it. defaults to 1 (optional)\n"
+            "\t-x NF_TX_QUEUES: NIC TX queues per port for NFs started with -x to send on directly. defaults to 4 "
+            "(optional)\n"
+            "\t-g FLUSH_DEADLINE_US: flush a partly filled packet buffer once its oldest packet waited "
+            "FLUSH_DEADLINE_US microseconds, 0 flushes every loop. defaults to 0 (optional)\n"
+            "\t-u BURST_SIZE: packets RX/TX threads read and send per burst, at most 256. defaults to 32 "
+            "(optional)\n"
+            "\t-o FLOW_ENTRIES: initial size of the flow director, which grows up to 16M flows. defaults to 1024 "
+            "(optional)\n"
+            "\t-y TRACE_SAMPLE: timestamp 1 in TRACE_SAMPLE packets at every hop and show latency percentiles per "
+            "chain stage (optional)\n"
+            "\t-h CORE_REBALANCE_SECS: every CORE_REBALANCE_SECS seconds move busy NFs off overloaded shared cores, "
+            "0 disables it. defaults to 0 (optional)\n"
+            "\t-A OUT_PCT,IN_PCT,COOLDOWN_SECS: services of NFs started with -c scale out when their instances are "
+            "OUT_PCT busy or their rx_qs OUT_PCT full, and in below IN_PCT, at most once every COOLDOWN_SECS. "
+            "defaults to 70,20,10 (optional)\n",
             progname);
 }
 
@@ -404,5 +625,299 @@ parse_verbosity_level(const char *verbosity_level) {
                 return -1;
 
         global_verbosity_level = (uint16_t)temp;
+        /* Only verbosity level 2 shows the time packets wait in NF rings */
+        onvm_config->flags.ONVM_RX_DELAY_STATS = global_verbosity_level == 2;
+        return 0;
+}
+
+static int
+parse_adaptive_poll_idle(const char *idle_us) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(idle_us, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > UINT32_MAX)
+                return -1;
+
+        onvm_config->adaptive_poll_idle_us = (uint32_t)temp;
+        return 0;
+}
+
+static int
+parse_adaptive_poll_spin(const char *spin_budget) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(spin_budget, &end, 10);
+        if (end == NULL || *end != '\0' || temp > UINT32_MAX)
+                return -1;
+
+        onvm_config->adaptive_poll_spin_budget = (uint32_t)temp;
+        return 0;
+}
+
+static int
+parse_num_rx_threads(const char *rx_threads_str) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(rx_threads_str, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > ONVM_MAX_RX_THREADS)
+                return -1;
+
+        num_rx_threads = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_rx_map(const char *rx_map_str) {
+        const char *p = rx_map_str;
+        char *end = NULL;
+        unsigned long vals[3];
+        int i;
+
+        while (*p != '\0') {
+                if (*p != '(')
+                        return -1;
+                p++;
+                for (i = 0; i < 3; i++) {
+                        vals[i] = strtoul(p, &end, 10);
+                        if (end == p || *end != (i < 2 ? ',' : ')'))
+                                return -1;
+                        p = end + 1;
+                }
+                if (vals[0] >= RTE_MAX_ETHPORTS || vals[1] >= RTE_MAX_QUEUES_PER_PORT ||
+                    vals[2] >= ONVM_MAX_RX_THREADS || rx_map_size == RTE_DIM(rx_map))
+                        return -1;
+
+                rx_map[rx_map_size].port_id = (uint16_t)vals[0];
+                rx_map[rx_map_size].queue_id = (uint16_t)vals[1];
+                rx_map[rx_map_size].thread_id = (uint16_t)vals[2];
+                rx_map_size++;
+
+                if (*p == ',' && *(++p) == '\0')
+                        return -1;
+        }
+
+        return rx_map_size > 0 ? 0 : -1;
+}
+
+static int
+parse_reta_rebalance_period(const char *period) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(period, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > UINT16_MAX)
+                return -1;
+
+        global_reta_rebalance_period = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_rx_prefetch_distance(const char *distance) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(distance, &end, 10);
+        if (end == NULL || *end != '\0' || temp >= PACKET_READ_SIZE)
+                return -1;
+
+        global_rx_prefetch_distance = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_tx_rebalance_period(const char *period) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(period, &end, 10);
+        if (end == NULL || *end != '\0' || temp > UINT16_MAX)
+                return -1;
+
+        global_tx_rebalance_period = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_num_nf_tx_queues(const char *nf_tx_queues) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(nf_tx_queues, &end, 10);
+        if (end == NULL || *end != '\0' || temp > ONVM_MAX_NF_TX_QUEUES)
+                return -1;
+
+        global_num_nf_tx_queues = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_flush_deadline(const char *deadline_us) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(deadline_us, &end, 10);
+        if (end == NULL || *end != '\0' || temp > UINT32_MAX)
+                return -1;
+
+        onvm_config->flush_deadline_us = (uint32_t)temp;
+        return 0;
+}
+
+static int
+parse_burst_size(const char *burst_size) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(burst_size, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > ONVM_MAX_BURST_SIZE)
+                return -1;
+
+        onvm_config->burst_size = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_flow_dir_entries(const char *entries) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(entries, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > ONVM_FLOW_DIR_MAX_ENTRIES)
+                return -1;
+
+        onvm_config->flow_dir_entries = (uint32_t)temp;
+        return 0;
+}
+
+static int
+parse_trace_sample(const char *sample) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(sample, &end, 10);
+        if (end == NULL || *end != '\0' || temp == 0 || temp > UINT32_MAX)
+                return -1;
+
+        onvm_config->trace_sample = (uint32_t)temp;
+        return 0;
+}
+
+static int
+parse_core_rebalance_period(const char *period) {
+        char *end = NULL;
+        unsigned long temp;
+
+        temp = strtoul(period, &end, 10);
+        if (end == NULL || *end != '\0' || temp > UINT16_MAX)
+                return -1;
+
+        global_core_rebalance_period = (uint16_t)temp;
+        return 0;
+}
+
+static int
+parse_autoscale(const char *spec) {
+        char *end = NULL;
+        unsigned long out_pct, in_pct, cooldown;
+
+        out_pct = strtoul(spec, &end, 10);
+        if (end == NULL || *end != ',')
+                return -1;
+        in_pct = strtoul(end + 1, &end, 10);
+        if (end == NULL || *end != ',')
+                return -1;
+        cooldown = strtoul(end + 1, &end, 10);
+        if (end == NULL || *end != '\0' || out_pct > 100 || in_pct >= out_pct || cooldown > UINT16_MAX)
+                return -1;
+
+        global_autoscale_out_pct = (uint16_t)out_pct;
+        global_autoscale_in_pct = (uint16_t)in_pct;
+        global_autoscale_cooldown = (uint16_t)cooldown;
+        return 0;
+}
+
+static int
+rx_thread_add_queue(uint16_t thread_id, uint16_t port_id, uint16_t queue_id) {
+        struct rx_thread_info *info = &rx_threads[thread_id];
+
+        if (info->num_queues == ONVM_MAX_RX_QUEUES_PER_THREAD) {
+                printf("ERROR: RX thread %u polls more than %u queues\n", thread_id, ONVM_MAX_RX_QUEUES_PER_THREAD);
+                return -1;
+        }
+        info->queues[info->num_queues].port_id = port_id;
+        info->queues[info->num_queues].queue_id = queue_id;
+        info->num_queues++;
+        return 0;
+}
+
+/*
+ * Build the per RX thread queue lists from -q and -m. Without a map RX thread
+ * N polls queue N of every port, with one every queue of every used port must
+ * go to exactly one thread.
+ */
+static int
+init_rx_threads(void) {
+        uint16_t i, j, k, port_id, mapped;
+
+        if (num_rx_threads + ONVM_NUM_MGR_AUX_THREADS >= rte_lcore_count()) {
+                printf("ERROR: %u RX threads leave no core for TX threads\n", num_rx_threads);
+                return -1;
+        }
+
+        if (rx_map_size == 0) {
+                for (i = 0; i < ports->num_ports; i++) {
+                        num_rx_queues[ports->id[i]] = num_rx_threads;
+                        for (j = 0; j < num_rx_threads; j++)
+                                if (rx_thread_add_queue(j, ports->id[i], j) != 0)
+                                        return -1;
+                }
+                return 0;
+        }
+
+        for (k = 0; k < rx_map_size; k++) {
+                for (i = 0; i < ports->num_ports && ports->id[i] != rx_map[k].port_id; i++)
+                        ;
+                if (i == ports->num_ports) {
+                        printf("ERROR: RX map uses port %u which is not in the port mask\n", rx_map[k].port_id);
+                        return -1;
+                }
+                if (rx_map[k].thread_id >= num_rx_threads) {
+                        printf("ERROR: RX map uses thread %u but only %u RX threads run\n", rx_map[k].thread_id,
+                               num_rx_threads);
+                        return -1;
+                }
+                num_rx_queues[rx_map[k].port_id] =
+                    RTE_MAX(num_rx_queues[rx_map[k].port_id], (uint16_t)(rx_map[k].queue_id + 1));
+                if (rx_thread_add_queue(rx_map[k].thread_id, rx_map[k].port_id, rx_map[k].queue_id) != 0)
+                        return -1;
+        }
+
+        /* RSS spreads packets over every configured queue, so none can go unpolled */
+        for (i = 0; i < ports->num_ports; i++) {
+                port_id = ports->id[i];
+                if (num_rx_queues[port_id] == 0) {
+                        printf("ERROR: RX map has no queue for port %u\n", port_id);
+                        return -1;
+                }
+                for (j = 0; j < num_rx_queues[port_id]; j++) {
+                        mapped = 0;
+                        for (k = 0; k < rx_map_size; k++)
+                                if (rx_map[k].port_id == port_id && rx_map[k].queue_id == j)
+                                        mapped++;
+                        if (mapped != 1) {
+                                printf("ERROR: RX map assigns port %u queue %u to %u threads\n", port_id, j, mapped);
+                                return -1;
+                        }
+                }
+        }
+
+        for (j = 0; j < num_rx_threads; j++)
+                if (rx_threads[j].num_queues == 0)
+                        printf("WARNING: RX thread %u has no queues to poll\n", j);
+
         return 0;
 }
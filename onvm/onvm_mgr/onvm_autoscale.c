@@ -0,0 +1,223 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+/******************************************************************************
+
+                              onvm_autoscale.c
+
+       This file contains the autoscaling of services. An NF started with
+       -c becomes the parent of its service: while the instances of the
+       service stay under pressure (rx_q occupancy, busy share or rx_q
+       drops) the manager sends the parent a MSG_SCALE, and it starts a
+       child copying itself. Once the instances stay idle, the least busy
+       child leaves the service, drains its rx_q and is stopped.
+
+******************************************************************************/
+
+#include "onvm_mgr.h"
+#include "onvm_autoscale.h"
+#include "onvm_nf.h"
+
+/******************************Global variables*******************************/
+
+/* Per NF, the rx_q drops at the previous measurement */
+static uint64_t autoscale_nf_last_drops[MAX_NFS];
+
+/* Per NF, when it started draining and whether it was told to stop since */
+static uint64_t autoscale_drain_start[MAX_NFS];
+static uint8_t autoscale_stop_sent[MAX_NFS];
+
+/* Per NF, when its rings were first seen empty while draining, 0 if not */
+static uint64_t autoscale_empty_since[MAX_NFS];
+
+/* Per service, consecutive measurements under pressure and idle */
+static uint16_t autoscale_pressure[MAX_SERVICES];
+static uint16_t autoscale_idle[MAX_SERVICES];
+
+/* Per service, when it was last scaled out or in */
+static uint64_t autoscale_last_action[MAX_SERVICES];
+
+/************************Internal functions prototypes************************/
+
+/*
+ * Helper function measuring the instances of a parent NF's service and
+ * scaling it out or in once the cooldown has passed
+ */
+static void
+onvm_autoscale_service(struct onvm_nf *parent, uint64_t now);
+
+/*
+ * Helper function stopping draining NFs whose rings stayed empty for a
+ * flush deadline or whose drain timed out
+ */
+static void
+onvm_autoscale_stop_drained(uint64_t now);
+
+/********************************Interfaces***********************************/
+
+void
+onvm_autoscale_update(void) {
+        uint8_t scaled[MAX_SERVICES];
+        const uint64_t now = rte_get_tsc_cycles();
+        struct onvm_nf *nf;
+        uint16_t i;
+
+        onvm_autoscale_stop_drained(now);
+
+        /* The first running parent of a service scales it */
+        memset(scaled, 0, sizeof(scaled));
+        for (i = 0; i < MAX_NFS; i++) {
+                nf = &nfs[i];
+                if (!onvm_nf_is_valid(nf) || nf->flags.autoscale_max == 0 || nf->thread_info.parent != 0 ||
+                    nf->draining || ONVM_CHECK_BIT(nf->flags.init_options, FUSED_NF_BIT) ||
+                    nf->service_id >= MAX_SERVICES || scaled[nf->service_id])
+                        continue;
+                scaled[nf->service_id] = 1;
+                onvm_autoscale_service(nf, now);
+        }
+}
+
+/******************************Internal functions*****************************/
+
+static void
+onvm_autoscale_service(struct onvm_nf *parent, uint64_t now) {
+        const uint16_t service_id = parent->service_id;
+        const uint16_t count = nf_per_service_count[service_id];
+        uint64_t occupancy, busy, drops, nf_drops;
+        struct onvm_nf *nf;
+        uint16_t i, victim;
+
+        if (count == 0)
+                return;
+
+        occupancy = busy = drops = 0;
+        for (i = 0; i < count; i++) {
+                nf = &nfs[services[service_id][i]];
+                occupancy += (rte_ring_count(nf->rx_q) + rte_ring_count(nf->rx_q_hi)) * 100 / NF_QUEUE_RINGSIZE;
+                busy += nf->thread_info.load;
+                nf_drops = nf->stats.rx_drop;
+                /* The NF id was reused and its stats cleared */
+                if (nf_drops < autoscale_nf_last_drops[nf->instance_id])
+                        autoscale_nf_last_drops[nf->instance_id] = 0;
+                drops += nf_drops - autoscale_nf_last_drops[nf->instance_id];
+                autoscale_nf_last_drops[nf->instance_id] = nf_drops;
+        }
+        occupancy /= count;
+        busy /= count;
+
+        if (occupancy >= global_autoscale_out_pct || busy >= global_autoscale_out_pct || drops >= AUTOSCALE_OUT_DROPS) {
+                autoscale_pressure[service_id] = RTE_MIN(autoscale_pressure[service_id] + 1, AUTOSCALE_OUT_ROUNDS);
+                autoscale_idle[service_id] = 0;
+        } else if (occupancy <= global_autoscale_in_pct && busy <= global_autoscale_in_pct && drops == 0) {
+                autoscale_idle[service_id] = RTE_MIN(autoscale_idle[service_id] + 1, AUTOSCALE_IN_ROUNDS);
+                autoscale_pressure[service_id] = 0;
+        } else {
+                autoscale_pressure[service_id] = autoscale_idle[service_id] = 0;
+        }
+
+        /* Give the last change time to show in the measurements */
+        if (autoscale_last_action[service_id] != 0 &&
+            now - autoscale_last_action[service_id] < (uint64_t)global_autoscale_cooldown * rte_get_timer_hz())
+                return;
+
+        if (autoscale_pressure[service_id] >= AUTOSCALE_OUT_ROUNDS) {
+                if (rte_atomic16_read(&parent->thread_info.children_cnt) >= parent->flags.autoscale_max ||
+                    count >= MAX_NFS_PER_SERVICE)
+                        return;
+                /* No scale info, the parent builds it from its own config */
+                if (onvm_nf_send_msg(parent->instance_id, MSG_SCALE, NULL) != 0)
+                        return;
+                RTE_LOG(INFO, APP,
+                        "Service %u: %u instances, %" PRIu64 "%% rx_q, %" PRIu64 "%% busy, %" PRIu64
+                        " drops, asking NF %u for a child\n",
+                        service_id, count, occupancy, busy, drops, parent->instance_id);
+                autoscale_pressure[service_id] = 0;
+                autoscale_last_action[service_id] = now;
+        } else if (autoscale_idle[service_id] >= AUTOSCALE_IN_ROUNDS) {
+                /* The least busy of the parent's children in the service goes */
+                victim = MAX_NFS;
+                for (i = 0; i < count; i++) {
+                        nf = &nfs[services[service_id][i]];
+                        if (nf->thread_info.parent != parent->instance_id)
+                                continue;
+                        if (victim == MAX_NFS || nf->thread_info.load < nfs[victim].thread_info.load)
+                                victim = nf->instance_id;
+                }
+                if (victim == MAX_NFS || onvm_nf_drain(victim) != 0)
+                        return;
+                RTE_LOG(INFO, APP,
+                        "Service %u: %u instances, %" PRIu64 "%% rx_q, %" PRIu64 "%% busy, draining child NF %u\n",
+                        service_id, count, occupancy, busy, victim);
+                autoscale_drain_start[victim] = now;
+                autoscale_stop_sent[victim] = 0;
+                autoscale_empty_since[victim] = 0;
+                autoscale_idle[service_id] = 0;
+                autoscale_last_action[service_id] = now;
+        }
+}
+
+static void
+onvm_autoscale_stop_drained(uint64_t now) {
+        const uint64_t flush_cycles = (uint64_t)onvm_config->flush_deadline_us * rte_get_timer_hz() / US_PER_S;
+        struct onvm_nf *nf;
+        uint16_t i;
+
+        for (i = 0; i < MAX_NFS; i++) {
+                nf = &nfs[i];
+                if (!onvm_nf_is_valid(nf) || !nf->draining || autoscale_stop_sent[i])
+                        continue;
+                if (rte_ring_count(nf->rx_q) > 0 || rte_ring_count(nf->rx_q_hi) > 0) {
+                        autoscale_empty_since[i] = 0;
+                        if (now - autoscale_drain_start[i] < AUTOSCALE_DRAIN_TIMEOUT * rte_get_timer_hz())
+                                continue;
+                } else if (autoscale_empty_since[i] == 0) {
+                        /* Manager threads and NFs may still buffer packets for
+                         * it, which are flushed within a flush deadline or, with
+                         * none, by their next loop. Look again next period. */
+                        autoscale_empty_since[i] = now;
+                        continue;
+                } else if (now - autoscale_empty_since[i] < flush_cycles) {
+                        continue;
+                }
+                /* Sent once, retried next time only if no message could be sent */
+                if (onvm_nf_send_msg(i, MSG_STOP, NULL) == 0)
+                        autoscale_stop_sent[i] = 1;
+        }
+}
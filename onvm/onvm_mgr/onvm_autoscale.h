@@ -0,0 +1,77 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+
+/******************************************************************************
+
+                              onvm_autoscale.h
+
+     This file contains the prototypes for growing and shrinking services
+     with the pressure on their instances.
+
+******************************************************************************/
+
+#ifndef _ONVM_AUTOSCALE_H_
+#define _ONVM_AUTOSCALE_H_
+
+#include "onvm_mgr/onvm_init.h"
+
+/***********************************Macros************************************/
+
+/* Consecutive measurements under pressure before a service scales out */
+#define AUTOSCALE_OUT_ROUNDS 2
+/* Consecutive idle measurements before a service scales in, longer so bursts don't shrink it */
+#define AUTOSCALE_IN_ROUNDS 10
+/* Packets dropped at a service's rx_qs in one measurement that count as pressure */
+#define AUTOSCALE_OUT_DROPS 64
+/* Seconds a draining instance gets to empty its rx_q before it is stopped anyway */
+#define AUTOSCALE_DRAIN_TIMEOUT 5
+
+/********************************Interfaces***********************************/
+
+/*
+ * Interface called by the master thread every loop: measures each service
+ * with an autoscaling parent NF, asks the parent for a child when its
+ * instances stay under pressure and drains and stops a child once they stay idle.
+ */
+void
+onvm_autoscale_update(void);
+
+#endif  // _ONVM_AUTOSCALE_H_
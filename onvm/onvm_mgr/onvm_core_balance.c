@@ -0,0 +1,241 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+/******************************************************************************
+
+                              onvm_core_balance.c
+
+       This file contains the placement of NFs on cores by load. Every
+       NF counts the cycles it is busy (see onvm_nf_cycle_stats), the
+       master thread turns them into a busy share per NF and per core and
+       moves NFs off shared cores that stay overloaded. A core is relieved
+       only after CORE_REBALANCE_ROUNDS overloaded measurements, and only
+       onto cores that stay below CORE_REBALANCE_TARGET_PCT, so NFs do not
+       flap between cores.
+
+******************************************************************************/
+
+#include "onvm_mgr.h"
+#include "onvm_core_balance.h"
+#include "onvm_nf.h"
+
+/******************************Global variables*******************************/
+
+/* Per NF, the busy cycles at the previous measurement */
+static uint64_t core_nf_last_busy[MAX_NFS];
+
+/* Per NF, the rebalance round it was last moved in */
+static uint32_t core_nf_moved_round[MAX_NFS];
+
+/* Per core, consecutive measurements it was overloaded */
+static uint16_t core_overloaded[RTE_MAX_LCORE];
+
+static uint64_t last_measure_cycles;
+static uint64_t last_rebalance_cycles;
+static uint32_t rebalance_round;
+
+/************************Internal functions prototypes************************/
+
+/*
+ * Helper function telling whether the balancer may move an NF: it runs on a
+ * shared core it did not ask for by hand, and has its own thread
+ */
+static int
+onvm_core_balance_is_movable(uint16_t instance_id, const uint8_t *has_fused);
+
+/*
+ * Helper function moving an NF and keeping the per core loads up to date
+ */
+static void
+onvm_core_balance_move_nf(uint16_t instance_id, uint16_t core, uint16_t *core_load, int dedicated);
+
+/********************************Interfaces***********************************/
+
+void
+onvm_core_balance_rebalance(void) {
+        uint16_t core_load[RTE_MAX_LCORE];
+        uint8_t has_fused[RTE_MAX_LCORE];
+        const uint64_t now = rte_get_tsc_cycles();
+        const uint64_t elapsed_cycles = now - last_measure_cycles;
+        uint64_t busy;
+        uint16_t i, c, num_cores, hot, target, best, moves = 0;
+
+        last_measure_cycles = now;
+        if (last_rebalance_cycles == 0) {
+                /* The first call only sets the baseline */
+                last_rebalance_cycles = now;
+                for (i = 0; i < MAX_NFS; i++)
+                        core_nf_last_busy[i] = nfs[i].stats.cycles.handler + nfs[i].stats.cycles.tx;
+                return;
+        }
+
+        /* Busy share of each NF and core since the last measurement */
+        num_cores = RTE_MIN(onvm_threading_get_num_cores(), RTE_MAX_LCORE);
+        memset(core_load, 0, sizeof(uint16_t) * num_cores);
+        memset(has_fused, 0, sizeof(uint8_t) * num_cores);
+        for (i = 0; i < MAX_NFS; i++) {
+                busy = nfs[i].stats.cycles.handler + nfs[i].stats.cycles.tx;
+                /* The NF id was reused and its stats cleared */
+                if (busy < core_nf_last_busy[i])
+                        core_nf_last_busy[i] = 0;
+                nfs[i].thread_info.load = onvm_nf_is_valid(&nfs[i]) && elapsed_cycles > 0
+                                                  ? RTE_MIN((busy - core_nf_last_busy[i]) * 100 / elapsed_cycles, 100)
+                                                  : 0;
+                core_nf_last_busy[i] = busy;
+                if (!onvm_nf_is_valid(&nfs[i]) || nfs[i].thread_info.core >= num_cores)
+                        continue;
+                /* Fused NFs run in their leader's thread, their load is its core's */
+                core_load[nfs[i].thread_info.core] += nfs[i].thread_info.load;
+                if (ONVM_CHECK_BIT(nfs[i].flags.init_options, FUSED_NF_BIT))
+                        has_fused[nfs[i].thread_info.core] = 1;
+        }
+
+        for (c = 0; c < num_cores; c++) {
+                if (cores[c].enabled && !cores[c].is_dedicated_core && core_load[c] > CORE_REBALANCE_HIGH_PCT)
+                        core_overloaded[c] = RTE_MIN(core_overloaded[c] + 1, CORE_REBALANCE_ROUNDS);
+                else
+                        core_overloaded[c] = 0;
+        }
+
+        if (global_core_rebalance_period == 0 ||
+            now - last_rebalance_cycles < (uint64_t)global_core_rebalance_period * rte_get_timer_hz())
+                return;
+        last_rebalance_cycles = now;
+        rebalance_round++;
+
+        while (moves < CORE_REBALANCE_MAX_MOVES) {
+                /* Busiest shared core that stayed overloaded, with an NF that can go */
+                hot = num_cores;
+                for (c = 0; c < num_cores; c++) {
+                        if (core_overloaded[c] < CORE_REBALANCE_ROUNDS || cores[c].nf_count < 2 || has_fused[c])
+                                continue;
+                        if (hot == num_cores || core_load[c] > core_load[hot])
+                                hot = c;
+                }
+                if (hot == num_cores)
+                        break;
+                /* Whatever happens, look at it again after new measurements */
+                core_overloaded[hot] = 0;
+
+                best = MAX_NFS;
+                for (i = 0; i < MAX_NFS; i++) {
+                        if (nfs[i].thread_info.core != hot || !onvm_core_balance_is_movable(i, has_fused))
+                                continue;
+                        if (best == MAX_NFS || nfs[i].thread_info.load > nfs[best].thread_info.load)
+                                best = i;
+                }
+                if (best == MAX_NFS)
+                        continue;
+
+                /* A busy NF gets a free core of its own */
+                target = num_cores;
+                if (nfs[best].thread_info.load >= CORE_REBALANCE_PROMOTE_PCT) {
+                        for (c = 0; c < num_cores; c++) {
+                                if (cores[c].enabled && !cores[c].is_dedicated_core && cores[c].nf_count == 0) {
+                                        target = c;
+                                        break;
+                                }
+                        }
+                }
+                if (target < num_cores) {
+                        onvm_core_balance_move_nf(best, target, core_load, 1);
+                        moves++;
+                        continue;
+                }
+
+                /* Else the busiest NF that fits on the least busy shared core */
+                for (c = 0; c < num_cores; c++) {
+                        if (c == hot || !cores[c].enabled || cores[c].is_dedicated_core)
+                                continue;
+                        if (target == num_cores || core_load[c] < core_load[target])
+                                target = c;
+                }
+                if (target == num_cores)
+                        break;
+                best = MAX_NFS;
+                for (i = 0; i < MAX_NFS; i++) {
+                        if (nfs[i].thread_info.core != hot || !onvm_core_balance_is_movable(i, has_fused) ||
+                            core_load[target] + nfs[i].thread_info.load > CORE_REBALANCE_TARGET_PCT)
+                                continue;
+                        if (best == MAX_NFS || nfs[i].thread_info.load > nfs[best].thread_info.load)
+                                best = i;
+                }
+                if (best == MAX_NFS)
+                        continue;
+                onvm_core_balance_move_nf(best, target, core_load, 0);
+                moves++;
+        }
+}
+
+/******************************Internal functions*****************************/
+
+static int
+onvm_core_balance_is_movable(uint16_t instance_id, const uint8_t *has_fused) {
+        struct onvm_nf *nf = &nfs[instance_id];
+
+        if (!onvm_nf_is_valid(nf) || cores[nf->thread_info.core].is_dedicated_core ||
+            has_fused[nf->thread_info.core])
+                return 0;
+        if (!ONVM_CHECK_BIT(nf->flags.init_options, SHARE_CORE_BIT) ||
+            ONVM_CHECK_BIT(nf->flags.init_options, MANUAL_CORE_ASSIGNMENT_BIT) ||
+            ONVM_CHECK_BIT(nf->flags.init_options, FUSED_NF_BIT))
+                return 0;
+        /* Give its last move time to show in the measurements */
+        return core_nf_moved_round[instance_id] == 0 ||
+               rebalance_round - core_nf_moved_round[instance_id] > CORE_REBALANCE_COOLDOWN;
+}
+
+static void
+onvm_core_balance_move_nf(uint16_t instance_id, uint16_t core, uint16_t *core_load, int dedicated) {
+        struct onvm_nf *nf = &nfs[instance_id];
+        uint16_t old_core = nf->thread_info.core;
+
+        RTE_LOG(INFO, APP, "Moving NF %u (%u%% busy) from core %u (%u%% busy) to %s core %u (%u%% busy)\n",
+                instance_id, nf->thread_info.load, old_core, core_load[old_core], dedicated ? "dedicated" : "shared",
+                core, core_load[core]);
+
+        if (dedicated)
+                cores[core].is_dedicated_core = 1;
+        onvm_nf_relocate_nf(instance_id, core);
+        /* The NF updates thread_info.core itself once it moved */
+        core_load[old_core] -= nf->thread_info.load;
+        core_load[core] += nf->thread_info.load;
+        core_nf_moved_round[instance_id] = rebalance_round;
+}
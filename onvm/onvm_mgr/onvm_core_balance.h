@@ -0,0 +1,84 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+
+/******************************************************************************
+
+                              onvm_core_balance.h
+
+     This file contains the prototypes for moving NFs between cores
+     according to the cycles they measure themselves busy.
+
+******************************************************************************/
+
+#ifndef _ONVM_CORE_BALANCE_H_
+#define _ONVM_CORE_BALANCE_H_
+
+#include "onvm_mgr/onvm_init.h"
+
+/***********************************Macros************************************/
+
+/* A shared core is overloaded while its NFs are busy more than this share of the time */
+#define CORE_REBALANCE_HIGH_PCT 90
+/* NFs are only moved to a core that stays at or below this share, the gap to HIGH avoids flapping */
+#define CORE_REBALANCE_TARGET_PCT 70
+/* An NF this busy on an overloaded core gets a core of its own, if one is free */
+#define CORE_REBALANCE_PROMOTE_PCT 50
+/* Consecutive overloaded measurements before a core is relieved */
+#define CORE_REBALANCE_ROUNDS 3
+/* Rebalance periods a moved NF stays where it was put */
+#define CORE_REBALANCE_COOLDOWN 5
+/* Most NFs moved in one round */
+#define CORE_REBALANCE_MAX_MOVES 2
+
+/********************************Interfaces***********************************/
+
+/*
+ * Interface called by the master thread every stats period. Measures how
+ * busy each NF was, in thread_info.load, and once the rebalance period
+ * has passed moves NFs off shared cores that stayed overloaded: to a free
+ * core of their own if they are busy enough, else to the least busy shared
+ * core that has room for them.
+ *
+ */
+void
+onvm_core_balance_rebalance(void);
+
+#endif  // _ONVM_CORE_BALANCE_H_
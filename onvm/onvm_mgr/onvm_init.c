@@ -48,6 +48,7 @@
 ******************************************************************************/
 
 #include "onvm_mgr/onvm_init.h"
+#include "onvm_mgr/onvm_rss.h"
 
 /********************************Global variables*****************************/
 
@@ -63,6 +64,15 @@ struct rte_mempool *nf_msg_pool;
 struct rte_ring *incoming_msg_queue;
 uint16_t **services;
 uint16_t *nf_per_service_count;
+struct service_dispatch *service_dispatch;
+struct onvm_quiesce_info *quiesce_info;
+struct onvm_service_taps *service_taps;
+struct tx_doorbell_info *tx_doorbells;
+struct adaptive_poll_stats rx_poll_stats[ONVM_MAX_RX_THREADS];
+struct adaptive_poll_stats tx_poll_stats[RTE_MAX_LCORE];
+struct onvm_flush_stats rx_flush_stats[ONVM_MAX_RX_THREADS];
+struct onvm_flush_stats tx_flush_stats[RTE_MAX_LCORE];
+uint16_t num_tx_threads;
 struct onvm_service_chain *default_chain;
 struct onvm_service_chain **default_sc_p;
 // struct pstack_thread_info pstack_info;
@@ -147,6 +157,10 @@ init(int argc, char *argv[]) {
         const struct rte_memzone *mz_scp;
         const struct rte_memzone *mz_services;
         const struct rte_memzone *mz_nf_per_service;
+        const struct rte_memzone *mz_service_dispatch;
+        const struct rte_memzone *mz_quiesce;
+        const struct rte_memzone *mz_service_taps;
+        const struct rte_memzone *mz_tx_doorbell;
         const struct rte_memzone *mz_onvm_config;
         uint8_t i, total_ports, port_id;
 
@@ -201,8 +215,45 @@ init(int argc, char *argv[]) {
         }
         nf_per_service_count = mz_nf_per_service->addr;
 
+        /* set up per service consistent hash tables, all empty */
+        mz_service_dispatch = rte_memzone_reserve(MZ_SERVICE_DISPATCH_INFO,
+                                                  sizeof(struct service_dispatch) * MAX_SERVICES, rte_socket_id(),
+                                                  NO_FLAGS);
+        if (mz_service_dispatch == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for service dispatch information.\n");
+        }
+        memset(mz_service_dispatch->addr, 0, sizeof(struct service_dispatch) * MAX_SERVICES);
+        service_dispatch = mz_service_dispatch->addr;
+
+        /* set up quiescent state tracking, no reader seen yet */
+        mz_quiesce = rte_memzone_reserve(MZ_QUIESCE_INFO, sizeof(struct onvm_quiesce_info), rte_socket_id(), NO_FLAGS);
+        if (mz_quiesce == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for quiescent state information.\n");
+        }
+        memset(mz_quiesce->addr, 0, sizeof(struct onvm_quiesce_info));
+        quiesce_info = mz_quiesce->addr;
+
+        /* set up per service monitoring taps, none attached */
+        mz_service_taps = rte_memzone_reserve(MZ_SERVICE_TAPS_INFO, sizeof(struct onvm_service_taps) * MAX_SERVICES,
+                                              rte_socket_id(), NO_FLAGS);
+        if (mz_service_taps == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for service taps information.\n");
+        }
+        memset(mz_service_taps->addr, 0, sizeof(struct onvm_service_taps) * MAX_SERVICES);
+        service_taps = mz_service_taps->addr;
+
+        /* set up doorbells for waking TX threads in adaptive polling mode */
+        mz_tx_doorbell =
+            rte_memzone_reserve(MZ_TX_DOORBELL_INFO, sizeof(struct tx_doorbell_info), rte_socket_id(), NO_FLAGS);
+        if (mz_tx_doorbell == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for TX doorbell information.\n");
+        }
+        memset(mz_tx_doorbell->addr, 0, sizeof(struct tx_doorbell_info));
+        tx_doorbells = mz_tx_doorbell->addr;
+
         /* set up custom flags */
-        mz_onvm_config = rte_memzone_reserve(MZ_ONVM_CONFIG, sizeof(uint16_t), rte_socket_id(), NO_FLAGS);
+        mz_onvm_config =
+            rte_memzone_reserve(MZ_ONVM_CONFIG, sizeof(struct onvm_configuration), rte_socket_id(), NO_FLAGS);
         if (mz_onvm_config == NULL) {
                 rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for ONVM custom flags.\n");
         }
@@ -231,7 +282,9 @@ init(int argc, char *argv[]) {
                 rte_exit(EXIT_FAILURE, "Cannot create nf message pool: %s\n", rte_strerror(rte_errno));
         }
 
-        /* now initialise the ports we will use */
+        /* now initialise the ports we will use, each may lower the NF TX queue count */
+        ports->nf_tx_queue_base = rte_lcore_count() - num_rx_threads - ONVM_NUM_MGR_AUX_THREADS;
+        ports->num_nf_tx_queues = global_num_nf_tx_queues;
         for (i = 0; i < ports->num_ports; i++) {
                 port_id = ports->id[i];
                 rte_eth_macaddr_get(port_id, &ports->mac[port_id]);
@@ -245,6 +298,10 @@ init(int argc, char *argv[]) {
 
         check_all_ports_link_status(ports->num_ports, (~0x0));
 
+        /* set up per RSS table entry counters for the RX load rebalancer */
+        if (global_reta_rebalance_period && onvm_rss_init() != 0)
+                rte_exit(EXIT_FAILURE, "Cannot allocate RSS rebalancing counters\n");
+
         /* initialise the NF queues/rings for inter-eu comms */
         init_shm_rings();
 
@@ -276,7 +333,14 @@ init(int argc, char *argv[]) {
         *default_sc_p = default_chain;
         onvm_sc_print(default_chain);
 
-        onvm_flow_dir_init();
+        onvm_flow_dir_init(onvm_config->flow_dir_entries);
+
+        /* set up the wildcard classifier, the flow director overrides its rules */
+        if (onvm_flow_acl_init(global_acl_rules_file) != 0)
+                rte_exit(EXIT_FAILURE, "Cannot load flow classifier rules\n");
+
+        if (onvm_trace_init(onvm_config->trace_sample) != 0)
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for latency traces\n");
 
         return 0;
 }
@@ -289,6 +353,15 @@ init(int argc, char *argv[]) {
 static void
 set_default_config(struct onvm_configuration *config) {
         config->flags.ONVM_NF_SHARE_CORES = ONVM_NF_SHARE_CORES_DEFAULT;
+        config->flags.ONVM_LOAD_AWARE_DISPATCH = ONVM_LOAD_AWARE_DISPATCH_DEFAULT;
+        config->flags.ONVM_ADAPTIVE_POLL = ONVM_ADAPTIVE_POLL_DEFAULT;
+        config->flags.ONVM_RX_DELAY_STATS = 0;
+        config->adaptive_poll_idle_us = ADAPTIVE_POLL_IDLE_US_DEFAULT;
+        config->adaptive_poll_spin_budget = ADAPTIVE_POLL_SPIN_BUDGET_DEFAULT;
+        config->flush_deadline_us = FLUSH_DEADLINE_US_DEFAULT;
+        config->burst_size = PACKET_READ_SIZE;
+        config->flow_dir_entries = ONVM_FLOW_DIR_ENTRIES_DEFAULT;
+        config->trace_sample = TRACE_SAMPLE_DEFAULT;
 }
 
 /**
@@ -297,11 +370,18 @@ set_default_config(struct onvm_configuration *config) {
  */
 static int
 init_mbuf_pools(void) {
+        /* mbufs have a private area for the headers parsed at RX, and the hop
+         * timestamps when tracing */
+        struct rte_pktmbuf_pool_private mbp_priv = {
+            .mbuf_data_room_size = RX_MBUF_DATA_SIZE + RTE_PKTMBUF_HEADROOM,
+            .mbuf_priv_size = onvm_config->trace_sample ? ONVM_MBUF_PRIV_TRACE_SIZE : ONVM_MBUF_PRIV_SIZE,
+        };
+
         /* don't pass single-producer/single-consumer flags to mbuf create as it
          * seems faster to use a cache instead */
         printf("Creating mbuf pool '%s' [%u mbufs] ...\n", PKTMBUF_POOL_NAME, NUM_MBUFS);
-        pktmbuf_pool = rte_mempool_create(PKTMBUF_POOL_NAME, NUM_MBUFS, MBUF_SIZE, MBUF_CACHE_SIZE,
-                                          sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init, NULL,
+        pktmbuf_pool = rte_mempool_create(PKTMBUF_POOL_NAME, NUM_MBUFS, MBUF_SIZE(mbp_priv.mbuf_priv_size), MBUF_CACHE_SIZE,
+                                          sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init, &mbp_priv,
                                           rte_pktmbuf_init, NULL, rte_socket_id(), NO_FLAGS);
 
         return (pktmbuf_pool == NULL); /* 0  on success */
@@ -369,10 +449,11 @@ init_pstack_info_pool(void) {
  */
 static int
 init_port(uint8_t port_num) {
-        const uint16_t rx_rings = ONVM_NUM_RX_THREADS;
+        /* One RX ring per queue handed to the RX threads with -q/-m */
+        const uint16_t rx_rings = num_rx_queues[port_num];
         uint16_t rx_ring_size = RTE_MP_RX_DESC_DEFAULT;
-        /* Set the number of tx_rings equal to the tx threads. This mimics the onvm_mgr tx thread calculation. */
-        const uint16_t tx_rings = rte_lcore_count() - rx_rings - ONVM_NUM_MGR_AUX_THREADS;
+        /* One TX ring per TX thread, followed by the ones NFs can ask for */
+        uint16_t tx_rings = ports->nf_tx_queue_base;
         uint16_t tx_ring_size = RTE_MP_TX_DESC_DEFAULT;
 
         struct rte_eth_rxconf rxq_conf;
@@ -386,12 +467,21 @@ init_port(uint8_t port_num) {
         printf("Port %u init ... \n", (unsigned)port_num);
         printf("Port %u socket id %u ... \n", (unsigned)port_num, (unsigned)rte_eth_dev_socket_id(port_num));
         printf("Port %u Rx rings %u ... \n", (unsigned)port_num, (unsigned)rx_rings);
-        printf("Port %u Tx rings %u ... \n", (unsigned)port_num, (unsigned)tx_rings);
-        fflush(stdout);
 
         /* Standard DPDK port initialisation - config port, then set up
          * rx and tx rings */
         rte_eth_dev_info_get(port_num, &dev_info);
+        if (rx_rings > dev_info.max_rx_queues) {
+                printf("Port %u supports at most %u Rx rings\n", port_num, dev_info.max_rx_queues);
+                return -1;
+        }
+        if (tx_rings + ports->num_nf_tx_queues > dev_info.max_tx_queues) {
+                ports->num_nf_tx_queues = dev_info.max_tx_queues > tx_rings ? dev_info.max_tx_queues - tx_rings : 0;
+                printf("Port %u only has room for %u NF Tx rings\n", port_num, ports->num_nf_tx_queues);
+        }
+        tx_rings += ports->num_nf_tx_queues;
+        printf("Port %u Tx rings %u ... \n", (unsigned)port_num, (unsigned)tx_rings);
+        fflush(stdout);
         if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
                 local_port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
         local_port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
@@ -402,7 +492,17 @@ init_port(uint8_t port_num) {
                     port_num, port_conf.rx_adv_conf.rss_conf.rss_hf, local_port_conf.rx_adv_conf.rss_conf.rss_hf);
         }
 
-        if ((retval = rte_eth_dev_configure(port_num, rx_rings, tx_rings, &local_port_conf)) != 0)
+        /* RX queue interrupts let idle RX threads sleep in adaptive polling mode */
+        if (onvm_config->flags.ONVM_ADAPTIVE_POLL)
+                local_port_conf.intr_conf.rxq = 1;
+
+        retval = rte_eth_dev_configure(port_num, rx_rings, tx_rings, &local_port_conf);
+        if (retval != 0 && local_port_conf.intr_conf.rxq) {
+                printf("Port %u does not support RX queue interrupts, RX threads will keep polling it\n", port_num);
+                local_port_conf.intr_conf.rxq = 0;
+                retval = rte_eth_dev_configure(port_num, rx_rings, tx_rings, &local_port_conf);
+        }
+        if (retval != 0)
                 return retval;
 
         /* Adjust rx,tx ring sizes if not allowed by ethernet device
@@ -494,9 +594,11 @@ init_shm_rings(void) {
         unsigned i;
         unsigned socket_id;
         const char *rq_name;
+        const char *rq_hi_name;
         const char *tq_name;
         const char *msg_q_name;
         const unsigned ringsize = NF_QUEUE_RINGSIZE;
+        const unsigned prioringsize = NF_PRIO_QUEUE_RINGSIZE;
         const unsigned msgringsize = NF_MSG_QUEUE_SIZE;
 
         // use calloc since we allocate for all possible NFs
@@ -506,11 +608,14 @@ init_shm_rings(void) {
                 /* Create an RX queue for each NF */
                 socket_id = rte_socket_id();
                 rq_name = get_rx_queue_name(i);
+                rq_hi_name = get_rx_hi_queue_name(i);
                 tq_name = get_tx_queue_name(i);
                 msg_q_name = get_msg_queue_name(i);
                 nfs[i].instance_id = i;
                 nfs[i].rx_q =
                     rte_ring_create(rq_name, ringsize, socket_id, RING_F_SC_DEQ); /* multi prod, single cons */
+                nfs[i].rx_q_hi =
+                    rte_ring_create(rq_hi_name, prioringsize, socket_id, RING_F_SC_DEQ); /* multi prod, single cons */
                 nfs[i].tx_q =
                     rte_ring_create(tq_name, ringsize, socket_id, RING_F_SC_DEQ); /* multi prod, single cons */
                 nfs[i].msg_q =
@@ -519,6 +624,9 @@ init_shm_rings(void) {
                 if (nfs[i].rx_q == NULL)
                         rte_exit(EXIT_FAILURE, "Cannot create rx ring queue for NF %u\n", i);
 
+                if (nfs[i].rx_q_hi == NULL)
+                        rte_exit(EXIT_FAILURE, "Cannot create high priority rx ring queue for NF %u\n", i);
+
                 if (nfs[i].tx_q == NULL)
                         rte_exit(EXIT_FAILURE, "Cannot create tx ring queue for NF %u\n", i);
 
@@ -66,6 +66,7 @@
 /*****************************Internal library********************************/
 
 #include "onvm_common.h"
+#include "onvm_flow_acl.h"
 #include "onvm_flow_dir.h"
 #include "onvm_flow_table.h"
 #include "onvm_includes.h"
@@ -74,15 +75,16 @@
 #include "onvm_sc_common.h"
 #include "onvm_sc_mgr.h"
 #include "onvm_threading.h"
+#include "onvm_trace.h"
 
 #include "pstack.h"
 
 /***********************************Macros************************************/
 
 #define MBUF_CACHE_SIZE 512
-#define MBUF_OVERHEAD (sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
+#define MBUF_OVERHEAD(priv_size) (sizeof(struct rte_mbuf) + (priv_size) + RTE_PKTMBUF_HEADROOM)
 #define RX_MBUF_DATA_SIZE 2048
-#define MBUF_SIZE (RX_MBUF_DATA_SIZE + MBUF_OVERHEAD)
+#define MBUF_SIZE(priv_size) (RX_MBUF_DATA_SIZE + MBUF_OVERHEAD(priv_size))
 
 #define NF_INFO_SIZE sizeof(struct onvm_nf_init_cfg)
 
@@ -95,11 +97,59 @@
 
 #define NO_FLAGS 0
 
-#define ONVM_NUM_RX_THREADS 1 // TODO: change RX threads
+/* Default number of manager RX threads, set at runtime with -q */
+#define ONVM_NUM_RX_THREADS 1
+#define ONVM_MAX_RX_THREADS 16
+/* Most (port, queue) pairs a single RX thread can poll */
+#define ONVM_MAX_RX_QUEUES_PER_THREAD 64
+/* How many packets ahead RX threads prefetch, changed at runtime with -f */
+#define RX_PREFETCH_DISTANCE_DEFAULT 4
+/* NIC TX queues per port NFs can ask for to send directly, changed at runtime with -x */
+#define NF_TX_QUEUES_DEFAULT 4
+#define ONVM_MAX_NF_TX_QUEUES 16
+/* Seconds between NF to TX thread rebalances, changed at runtime with -j */
+#define TX_REBALANCE_PERIOD_DEFAULT 1
+/* Seconds between moves of NFs off overloaded shared cores, changed at runtime with -h */
+#define CORE_REBALANCE_PERIOD_DEFAULT 0
+/* Busy or rx_q full percent services scale out above and in below, and seconds between changes, changed with -A */
+#define AUTOSCALE_OUT_PCT_DEFAULT 70
+#define AUTOSCALE_IN_PCT_DEFAULT 20
+#define AUTOSCALE_COOLDOWN_DEFAULT 10
 /* Number of auxiliary threads in manager, 1 reserved for stats */
 #define ONVM_NUM_MGR_AUX_THREADS 1
 #define ONVM_NUM_WAKEUP_THREADS 1  // Enabled when using shared core mode
 
+/* Adaptive polling counters of one manager RX or TX thread */
+struct adaptive_poll_stats {
+        uint64_t sleeps;
+        uint64_t sleep_cycles;
+        /* Sleeps ended by an interrupt or doorbell instead of the timeout */
+        uint64_t wakeups;
+        /* Doorbell ring to TX thread running, summed over wakeups */
+        uint64_t wakeup_latency_cycles;
+};
+
+/* A NIC RX queue polled by a manager RX thread */
+struct rx_queue_info {
+        uint16_t port_id;
+        uint16_t queue_id;
+};
+
+/* The queues polled by one manager RX thread, see -q and -m */
+struct rx_thread_info {
+        uint16_t num_queues;
+        struct rx_queue_info queues[ONVM_MAX_RX_QUEUES_PER_THREAD];
+        /* Only written by the owning thread, summed into ports->rx_stats by the master thread */
+        uint64_t rx_pkts[RTE_MAX_ETHPORTS];
+        /* Packets seen per RSS redirection table entry, NULL unless the RETA rebalancer runs */
+        uint64_t *reta_pkts[RTE_MAX_ETHPORTS];
+} __rte_cache_aligned;
+
+/* Packets the manager TX threads dequeued from one NF's tx_q */
+struct tx_nf_load {
+        uint64_t pkts;
+} __rte_cache_aligned;
+
 /*************************External global variables***************************/
 
 /* NF to Manager data flow */
@@ -116,6 +166,18 @@ extern uint16_t num_services;
 extern uint16_t default_service;
 extern uint16_t **services;
 extern uint16_t *nf_per_service_count;
+extern struct service_dispatch *service_dispatch;
+extern struct onvm_quiesce_info *quiesce_info;
+extern struct onvm_service_taps *service_taps;
+extern struct tx_doorbell_info *tx_doorbells;
+extern struct adaptive_poll_stats rx_poll_stats[ONVM_MAX_RX_THREADS];
+extern uint16_t num_rx_threads;
+extern struct rx_thread_info rx_threads[ONVM_MAX_RX_THREADS];
+extern uint16_t num_rx_queues[RTE_MAX_ETHPORTS];
+extern struct adaptive_poll_stats tx_poll_stats[RTE_MAX_LCORE];
+extern struct onvm_flush_stats rx_flush_stats[ONVM_MAX_RX_THREADS];
+extern struct onvm_flush_stats tx_flush_stats[RTE_MAX_LCORE];
+extern uint16_t num_tx_threads;
 extern unsigned num_sockets;
 extern struct onvm_service_chain *default_chain;
 extern struct onvm_ft *sdn_ft;
@@ -124,6 +186,15 @@ extern uint16_t global_stats_sleep_time;
 extern uint32_t global_time_to_live;
 extern uint32_t global_pkt_limit;
 extern uint8_t global_verbosity_level;
+extern uint16_t global_reta_rebalance_period;
+extern uint16_t global_rx_prefetch_distance;
+extern uint16_t global_tx_rebalance_period;
+extern uint16_t global_core_rebalance_period;
+extern uint16_t global_autoscale_out_pct;
+extern uint16_t global_autoscale_in_pct;
+extern uint16_t global_autoscale_cooldown;
+extern uint16_t global_num_nf_tx_queues;
+extern const char *global_acl_rules_file;
 
 /* Custom flags for onvm */
 extern struct onvm_configuration *onvm_config;
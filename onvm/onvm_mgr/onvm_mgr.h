@@ -66,6 +66,7 @@
 
 /******************************Internal headers*******************************/
 
+#include "onvm_flow_acl.h"
 #include "onvm_flow_dir.h"
 #include "onvm_flow_table.h"
 #include "onvm_includes.h"
@@ -49,12 +49,16 @@
 #include "onvm_nf.h"
 #include "onvm_mgr.h"
 #include "onvm_stats.h"
+#include "onvm_tx_balance.h"
 #include <rte_lpm.h>
 
 /* ID 0 is reserved */
 uint16_t next_instance_id = 1;
 uint16_t starting_instance_id = 1;
 
+/* Instance ID using each NIC TX queue reserved for NFs, 0 if free */
+static uint16_t nic_tx_queue_owner[ONVM_MAX_NF_TX_QUEUES];
+
 /************************Internal functions prototypes************************/
 
 /*
@@ -88,25 +92,44 @@ inline static int
 onvm_nf_stop(struct onvm_nf *nf);
 
 /*
- * Function to move a NF to another core.
+ * Function that initializes an LPM object
  *
- * Input  : instance id of the NF that needs to be moved
- *          new_core value of where the NF should be moved
- * Output : an error code
+ * Input  : the address of an lpm_request struct
+ * Output : a return code based on initialization of the LPM object
  *
  */
-inline int
-onvm_nf_relocate_nf(uint16_t nf, uint16_t new_core);
+static void
+onvm_nf_init_lpm_region(struct lpm_request *req_lpm);
 
 /*
- * Function that initializes an LPM object
+ * Function to hand an NF one of the NIC TX queues reserved for NFs.
  *
- * Input  : the address of an lpm_request struct
- * Output : a return code based on initialization of the LPM object
+ * Input  : instance id of the NF
+ * Output : the TX queue it uses on every port, 0 if none is left
  *
  */
+static uint16_t
+onvm_nf_get_nic_tx_queue(uint16_t instance_id);
+
+/*
+ * Function removing an NF from its service's instances and dispatch table.
+ *
+ * Input  : the NF instance ID and its service ID
+ */
 static void
-onvm_nf_init_lpm_region(struct lpm_request *req_lpm);
+onvm_nf_remove_from_service(uint16_t nf_id, uint16_t service_id);
+
+/*
+ * Functions to attach a tap NF to the service it taps, and to detach it
+ *
+ * Input  : a pointer to the tap NF
+ *
+ */
+static void
+onvm_nf_add_tap(struct onvm_nf *nf);
+
+static void
+onvm_nf_remove_tap(struct onvm_nf *nf);
 
 /********************************Interfaces***********************************/
 
@@ -170,6 +193,9 @@ onvm_nf_check_status(void) {
                                 req_lpm = (struct lpm_request *)msg->msg_data;
                                 onvm_nf_init_lpm_region(req_lpm);
                                 break;
+                        case MSG_FLOW_DIR_GROW:
+                                onvm_flow_dir_grow();
+                                break;
                         case MSG_NF_STARTING:
                                 nf_init_cfg = (struct onvm_nf_init_cfg *)msg->msg_data;
                                 if (onvm_nf_start(nf_init_cfg) == 0) {
@@ -216,6 +242,19 @@ onvm_nf_send_msg(uint16_t dest, uint8_t msg_type, void *msg_data) {
         return rte_ring_enqueue(nfs[dest].msg_q, (void *)msg);
 }
 
+int
+onvm_nf_drain(uint16_t instance_id) {
+        struct onvm_nf *nf = &nfs[instance_id];
+
+        if (!onvm_nf_is_valid(nf) || nf->draining || nf->flags.tap_service != 0)
+                return -1;
+
+        /* It keeps running and sending, only no new packets are dispatched to it */
+        onvm_nf_remove_from_service(instance_id, nf->service_id);
+        nf->draining = 1;
+        return 0;
+}
+
 /******************************Internal functions*****************************/
 
 inline static int
@@ -241,7 +280,7 @@ onvm_nf_start(struct onvm_nf_init_cfg *nf_init_cfg) {
                 return 1;
         }
 
-        if (nf_init_cfg->service_id >= MAX_SERVICES) {
+        if (nf_init_cfg->service_id >= MAX_SERVICES || nf_init_cfg->tap_service >= MAX_SERVICES) {
                 // Service ID must be less than MAX_SERVICES and greater than 0
                 nf_init_cfg->status = NF_SERVICE_MAX;
                 return 1;
@@ -262,8 +301,14 @@ onvm_nf_start(struct onvm_nf_init_cfg *nf_init_cfg) {
         // Keep reference to this NF in the manager
         nf_init_cfg->instance_id = nf_id;
 
+        /* A fused NF runs in the thread of another NF, it takes no core of its own */
+        if (ONVM_CHECK_BIT(nf_init_cfg->init_options, FUSED_NF_BIT))
+                ret = nf_init_cfg->core < onvm_threading_get_num_cores() && cores[nf_init_cfg->core].enabled
+                              ? 0
+                              : NF_CORE_OUT_OF_RANGE;
         /* If not successful return will contain the error code */
-        ret = onvm_threading_get_core(&nf_init_cfg->core, nf_init_cfg->init_options, cores);
+        else
+                ret = onvm_threading_get_core(&nf_init_cfg->core, nf_init_cfg->init_options, cores);
         if (ret != 0) {
                 nf_init_cfg->status = ret;
                 return 1;
@@ -274,8 +319,21 @@ onvm_nf_start(struct onvm_nf_init_cfg *nf_init_cfg) {
         spawned_nf->status = NF_STARTING;
         spawned_nf->tag = nf_init_cfg->tag;
         spawned_nf->thread_info.core = nf_init_cfg->core;
+        spawned_nf->flags.init_options = nf_init_cfg->init_options;
         spawned_nf->flags.time_to_live = nf_init_cfg->time_to_live;
         spawned_nf->flags.pkt_limit = nf_init_cfg->pkt_limit;
+        spawned_nf->flags.rx_hi_weight = nf_init_cfg->rx_hi_weight;
+        spawned_nf->flags.burst_size = nf_init_cfg->burst_size != 0 && nf_init_cfg->burst_size <= ONVM_MAX_BURST_SIZE
+                                               ? nf_init_cfg->burst_size
+                                               : PACKET_READ_SIZE;
+        spawned_nf->flags.tap_service = nf_init_cfg->tap_service;
+        spawned_nf->flags.tap_sample = nf_init_cfg->tap_sample != 0 ? nf_init_cfg->tap_sample : 1;
+        spawned_nf->flags.autoscale_max = nf_init_cfg->autoscale_max;
+        spawned_nf->rx_congested = 0;
+        spawned_nf->draining = 0;
+        spawned_nf->nic_tx_queue = 0;
+        if (ONVM_CHECK_BIT(nf_init_cfg->init_options, NIC_TX_QUEUE_BIT))
+                spawned_nf->nic_tx_queue = onvm_nf_get_nic_tx_queue(nf_id);
         // Let the NF continue its init process
         nf_init_cfg->status = NF_STARTING;
         return 0;
@@ -287,11 +345,23 @@ onvm_nf_ready(struct onvm_nf *nf) {
         if (nf->status != NF_STARTING)
                 return -1;
 
-        uint16_t service_count = nf_per_service_count[nf->service_id]++;
-        services[nf->service_id][service_count] = nf->instance_id;
+        /* Put its tx_q on the TX thread with the fewest NFs */
+        onvm_tx_balance_assign_nf(nf->instance_id);
+
+        /* Running before senders can pick it, or they drop its packets */
+        nf->status = NF_RUNNING;
+        rte_smp_wmb();
         num_nfs++;
+
         // Register this NF running within its service
-        nf->status = NF_RUNNING;
+        /* Taps only get clones, never packets dispatched to their own service */
+        if (nf->flags.tap_service != 0) {
+                onvm_nf_add_tap(nf);
+        } else {
+                uint16_t service_count = nf_per_service_count[nf->service_id]++;
+                services[nf->service_id][service_count] = nf->instance_id;
+                onvm_sc_update_service_dispatch(nf->service_id);
+        }
         return 0;
 }
 
@@ -305,7 +375,6 @@ onvm_nf_stop(struct onvm_nf *nf) {
         struct rte_mempool *nf_info_mp;
         struct rte_mbuf *pkts[PACKET_READ_SIZE];
         uint16_t candidate_nf_id, candidate_core;
-        int mapIndex;
 
         if (nf == NULL)
                 return 1;
@@ -328,22 +397,43 @@ onvm_nf_stop(struct onvm_nf *nf) {
         nf->status = NF_STOPPED;
         nfs[nf->instance_id].status = NF_STOPPED;
 
+        /* Its main loop is done, the NIC TX queue can go to the next NF */
+        if (nf->nic_tx_queue != 0) {
+                nic_tx_queue_owner[nf->nic_tx_queue - ports->nf_tx_queue_base] = 0;
+                nf->nic_tx_queue = 0;
+        }
+
+        /* Stop cloning packets to it before its rings are drained */
+        if (nf->flags.tap_service != 0 && nf_status != NF_STARTING)
+                onvm_nf_remove_tap(nf);
+
+        /* Remove this NF from the service map before draining its rings, a
+         * draining NF already left it and a tap never joined it */
+        if ((nf_status == NF_RUNNING || nf_status == NF_PAUSED) && !nf->draining && nf->flags.tap_service == 0)
+                onvm_nf_remove_from_service(nf_id, service_id);
+
         /* Tell parent we stopped running */
         if (nfs[nf_id].thread_info.parent != 0)
                 rte_atomic16_dec(&nfs[nfs[nf_id].thread_info.parent].thread_info.children_cnt);
 
-        /* Remove the NF from the core it was running on */
-        cores[nf->thread_info.core].nf_count--;
-        cores[nf->thread_info.core].is_dedicated_core = 0;
+        /* Remove the NF from the core it was running on, fused NFs never took one */
+        if (!ONVM_CHECK_BIT(nf->flags.init_options, FUSED_NF_BIT)) {
+                cores[nf->thread_info.core].nf_count--;
+                cores[nf->thread_info.core].is_dedicated_core = 0;
+        }
 
         /* Clean up possible left over objects in rings */
         while ((nb_pkts = rte_ring_dequeue_burst(nfs[nf_id].rx_q, (void **)pkts, PACKET_READ_SIZE, NULL)) > 0) {
                 for (i = 0; i < nb_pkts; i++)
-                        rte_pktmbuf_free(pkts[i]);
+                        onvm_pkt_discard(pkts[i]);
+        }
+        while ((nb_pkts = rte_ring_dequeue_burst(nfs[nf_id].rx_q_hi, (void **)pkts, PACKET_READ_SIZE, NULL)) > 0) {
+                for (i = 0; i < nb_pkts; i++)
+                        onvm_pkt_discard(pkts[i]);
         }
         while ((nb_pkts = rte_ring_dequeue_burst(nfs[nf_id].tx_q, (void **)pkts, PACKET_READ_SIZE, NULL)) > 0) {
                 for (i = 0; i < nb_pkts; i++)
-                        rte_pktmbuf_free(pkts[i]);
+                        onvm_pkt_discard(pkts[i]);
         }
         nf_msg_pool = rte_mempool_lookup(_NF_MSG_POOL_NAME);
         while (rte_ring_dequeue(nfs[nf_id].msg_q, (void**)(&msg)) == 0) {
@@ -368,28 +458,6 @@ onvm_nf_stop(struct onvm_nf *nf) {
         /* Reset stats */
         onvm_stats_clear_nf(nf_id);
 
-        /* Remove this NF from the service map.
-         * Need to shift all elements past it in the array left to avoid gaps */
-        nf_per_service_count[service_id]--;
-        for (mapIndex = 0; mapIndex < MAX_NFS_PER_SERVICE; mapIndex++) {
-                if (services[service_id][mapIndex] == nf_id) {
-                        break;
-                }
-        }
-
-        if (mapIndex < MAX_NFS_PER_SERVICE) {  // sanity error check
-                services[service_id][mapIndex] = 0;
-                for (; mapIndex < MAX_NFS_PER_SERVICE - 1; mapIndex++) {
-                        // Shift the NULL to the end of the array
-                        if (services[service_id][mapIndex + 1] == 0) {
-                                // Short circuit when we reach the end of this service's list
-                                break;
-                        }
-                        services[service_id][mapIndex] = services[service_id][mapIndex + 1];
-                        services[service_id][mapIndex + 1] = 0;
-                }
-        }
-
         /* As this NF stopped we can reevaluate core mappings */
         if (ONVM_NF_SHUTDOWN_CORE_REASSIGNMENT) {
                 /* As this NF stopped we can reevaluate core mappings */
@@ -418,7 +486,7 @@ onvm_nf_init_lpm_region(struct lpm_request *req_lpm) {
         }
 }
 
-inline int
+int
 onvm_nf_relocate_nf(uint16_t dest, uint16_t new_core) {
         uint16_t *msg_data;
 
@@ -437,3 +505,77 @@ onvm_nf_relocate_nf(uint16_t dest, uint16_t new_core) {
         cores[new_core].nf_count++;
         return 0;
 }
+
+static uint16_t
+onvm_nf_get_nic_tx_queue(uint16_t instance_id) {
+        uint16_t i;
+
+        for (i = 0; i < ports->num_nf_tx_queues; i++) {
+                if (nic_tx_queue_owner[i] == 0) {
+                        nic_tx_queue_owner[i] = instance_id;
+                        return ports->nf_tx_queue_base + i;
+                }
+        }
+
+        RTE_LOG(INFO, APP, "No NIC TX queue left for NF %u, it will send through the TX threads\n", instance_id);
+        return 0;
+}
+
+static void
+onvm_nf_remove_from_service(uint16_t nf_id, uint16_t service_id) {
+        int mapIndex;
+
+        /* Publish a new dispatch table so RX/TX threads stop picking it.
+         * Packet paths only read the dispatch table, never services[].
+         * Need to shift all elements past it in the array left to avoid gaps */
+        for (mapIndex = 0; mapIndex < nf_per_service_count[service_id]; mapIndex++) {
+                if (services[service_id][mapIndex] == nf_id) {
+                        break;
+                }
+        }
+
+        if (mapIndex < nf_per_service_count[service_id]) {  // sanity error check
+                for (; mapIndex < nf_per_service_count[service_id] - 1; mapIndex++) {
+                        services[service_id][mapIndex] = services[service_id][mapIndex + 1];
+                }
+                services[service_id][mapIndex] = 0;
+                nf_per_service_count[service_id]--;
+        }
+        onvm_sc_update_service_dispatch(service_id);
+}
+
+static void
+onvm_nf_add_tap(struct onvm_nf *nf) {
+        struct onvm_service_taps *taps;
+
+        taps = &service_taps[nf->flags.tap_service];
+        if (taps->count >= MAX_TAPS_PER_SERVICE) {
+                RTE_LOG(INFO, APP, "Service %u already has %d taps, NF %u will get no packets\n",
+                        nf->flags.tap_service, MAX_TAPS_PER_SERVICE, nf->instance_id);
+                return;
+        }
+
+        taps->taps[taps->count].instance_id = nf->instance_id;
+        taps->taps[taps->count].sample = nf->flags.tap_sample;
+        /* The slot must be visible before the count that covers it */
+        rte_wmb();
+        taps->count++;
+}
+
+static void
+onvm_nf_remove_tap(struct onvm_nf *nf) {
+        struct onvm_service_taps *taps;
+        uint16_t i;
+
+        taps = &service_taps[nf->flags.tap_service];
+        for (i = 0; i < taps->count; i++) {
+                if (taps->taps[i].instance_id != nf->instance_id)
+                        continue;
+                /* Readers check the NF is valid, so one briefly seeing the
+                 * moved slot twice or the stopped NF is harmless */
+                taps->taps[i] = taps->taps[taps->count - 1];
+                rte_wmb();
+                taps->count--;
+                return;
+        }
+}
@@ -82,4 +82,25 @@ onvm_nf_check_status(void);
 int
 onvm_nf_send_msg(uint16_t dest, uint8_t msg_type, void *msg_data);
 
+/*
+ * Interface to take a running NF out of its service before stopping it: no
+ * new packets are dispatched to it while it empties its rx_q.
+ *
+ * Input  : instance id of the NF to drain
+ * Output : 0 on success, -1 if the NF is not running or already draining
+ */
+int
+onvm_nf_drain(uint16_t instance_id);
+
+/*
+ * Interface to move a NF to another core.
+ *
+ * Input  : instance id of the NF that needs to be moved
+ *          new_core value of where the NF should be moved
+ * Output : an error code
+ *
+ */
+int
+onvm_nf_relocate_nf(uint16_t nf, uint16_t new_core);
+
 #endif  // _ONVM_NF_H_
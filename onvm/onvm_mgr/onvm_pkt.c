@@ -56,22 +56,87 @@
 // #define ENABLE_PSTACK
 // extern struct pstack_thread_info pstack_info;
 
+/*****************************Internal functions******************************/
+
+/*
+ * Start loading the mbuf's second cache line, which holds the packet
+ * metadata, and the start of the packet data.
+ */
+static inline void
+onvm_pkt_prefetch(struct rte_mbuf *pkt) {
+        rte_prefetch0(&pkt->cacheline1);
+        rte_prefetch0(rte_pktmbuf_mtod(pkt, void *));
+}
+
 /**********************************Interfaces*********************************/
 
 void
 onvm_pkt_process_rx_batch(struct queue_mgr *rx_mgr, struct rte_mbuf *pkts[], uint16_t rx_count, uint16_t rx_queue_id) {
+        const uint16_t dist = global_rx_prefetch_distance;
         uint16_t i;
         struct onvm_pkt_meta *meta;
-#ifdef FLOW_LOOKUP
-        struct onvm_flow_entry *flow_entry;
         struct onvm_service_chain *sc;
-        int ret;
+        uint64_t rx_tsc = 0;
+        int sampled;
+#ifdef FLOW_LOOKUP
+        struct onvm_ft_ipv4_5tuple keys[ONVM_MAX_BURST_SIZE];
+        hash_sig_t sigs[ONVM_MAX_BURST_SIZE];
+        uint16_t key_pkt[ONVM_MAX_BURST_SIZE];
+        struct onvm_flow_entry *key_entries[ONVM_MAX_BURST_SIZE];
+        struct onvm_flow_entry *flow_entries[ONVM_MAX_BURST_SIZE];
+        struct onvm_ft *ft;
+        uint16_t num_keys = 0;
 #endif
 
         if (rx_mgr == NULL || pkts == NULL)
                 return;
+        if (unlikely(trace_stats != NULL))
+                rx_tsc = rte_get_tsc_cycles();
+
+        /* Stage 1: start loading the first packets, later ones are prefetched dist ahead */
+        for (i = 0; i < dist && i < rx_count; i++)
+                onvm_pkt_prefetch(pkts[i]);
+
+        /* Stage 2: parse the headers once for all NFs, and extract every flow key and signature */
+#ifdef FLOW_LOOKUP
+        ft = onvm_flow_dir_table();
+#endif
+        for (i = 0; i < rx_count; i++) {
+                if (dist && i + dist < rx_count)
+                        onvm_pkt_prefetch(pkts[i + dist]);
+                onvm_pkt_parse_hdrs(pkts[i]);
+#ifdef FLOW_LOOKUP
+                flow_entries[i] = NULL;
+                if (onvm_ft_fill_key(&keys[num_keys], pkts[i]) == 0) {
+                        sigs[num_keys] = onvm_ft_hash(ft, pkts[i], &keys[num_keys]);
+                        key_pkt[num_keys++] = i;
+                }
+#endif
+        }
+
+#ifdef FLOW_LOOKUP
+        /* Stage 3: look all keys up in bulk, prefetching the entries found */
+        onvm_ft_lookup_key_bulk(ft, keys, sigs, num_keys, (char **)key_entries, NULL);
+        for (i = 0; i < num_keys; i++) {
+                flow_entries[key_pkt[i]] = key_entries[i];
+                if (key_entries[i] != NULL && dist)
+                        rte_prefetch0(key_entries[i]);
+        }
 
+        /* Stage 3b: packets with no exact match entry fall back to the wildcard rules */
+        onvm_flow_acl_classify(pkts, rx_count, flow_entries);
+#endif
+
+        /* Stage 4: pick each packet's next hop and buffer it for that NF */
         for (i = 0; i < rx_count; i++) {
+#ifdef FLOW_LOOKUP
+                if (dist && i + dist < rx_count && flow_entries[i + dist] != NULL)
+                        rte_prefetch0(flow_entries[i + dist]->sc);
+                /* A flow being added has no chain yet */
+                sc = flow_entries[i] != NULL && flow_entries[i]->sc != NULL ? flow_entries[i]->sc : default_chain;
+#else
+                sc = default_chain;
+#endif
                 RTE_SET_USED(rx_queue_id);
 #ifdef ENABLE_PSTACK
                 pstack_process((char *)onvm_pkt_ipv4_hdr(pkts[i]), pkts[i]->data_len - sizeof(struct ether_hdr), rx_queue_id);
@@ -79,19 +144,17 @@ onvm_pkt_process_rx_batch(struct queue_mgr *rx_mgr, struct rte_mbuf *pkts[], uin
                 meta = (struct onvm_pkt_meta *)&(((struct rte_mbuf *)pkts[i])->udata64);
                 meta->src = 0;
                 meta->chain_index = 0;
-#ifdef FLOW_LOOKUP
-                ret = onvm_flow_dir_get_pkt(pkts[i], &flow_entry);
-                if (ret >= 0) {
-                        sc = flow_entry->sc;
-                        meta->action = onvm_sc_next_action(sc, pkts[i]);
-                        meta->destination = onvm_sc_next_destination(sc, pkts[i]);
-                } else {
-#endif
-                        meta->action = onvm_sc_next_action(default_chain, pkts[i]);
-                        meta->destination = onvm_sc_next_destination(default_chain, pkts[i]);
-#ifdef FLOW_LOOKUP
+                /* Recycled mbufs may still carry the bit of a branch clone */
+                meta->flags &= ~(1 << ONVM_PKT_BRANCH_BIT);
+                if (unlikely(trace_stats != NULL)) {
+                        sampled = ++rx_mgr->trace_seq >= onvm_config->trace_sample;
+                        if (sampled)
+                                rx_mgr->trace_seq = 0;
+                        onvm_trace_rx(pkts[i], sampled, rx_tsc);
                 }
-#endif
+                onvm_set_pkt_prio(pkts[i], sc->rx_prio);
+                meta->action = onvm_sc_next_action(sc, pkts[i]);
+                meta->destination = onvm_sc_next_destination(sc, pkts[i]);
                 /* PERF: this might hurt performance since it will cause cache
                  * invalidations. Ideally the data modified by the NF manager
                  * would be a different line than that modified/read by NFs.
@@ -99,21 +162,11 @@ onvm_pkt_process_rx_batch(struct queue_mgr *rx_mgr, struct rte_mbuf *pkts[], uin
                  */
 
                 (meta->chain_index)++;
-                onvm_pkt_enqueue_nf(rx_mgr, meta->destination, pkts[i], NULL);
+                if (unlikely(meta->action == ONVM_NF_ACTION_PARALLEL))
+                        onvm_pkt_fork(rx_mgr, pkts[i], sc, NULL);
+                else
+                        onvm_pkt_enqueue_nf(rx_mgr, meta->destination, pkts[i], NULL);
         }
-
-        onvm_pkt_flush_all_nfs(rx_mgr, NULL);
-}
-
-void
-onvm_pkt_flush_all_ports(struct queue_mgr *tx_mgr) {
-        uint16_t i;
-
-        if (tx_mgr == NULL)
-                return;
-
-        for (i = 0; i < ports->num_ports; i++)
-                onvm_pkt_flush_port_queue(tx_mgr, ports->id[i]);
 }
 
 void
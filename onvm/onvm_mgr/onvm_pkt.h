@@ -64,15 +64,6 @@
 void
 onvm_pkt_process_rx_batch(struct queue_mgr *rx_mgr, struct rte_mbuf *pkts[], uint16_t rx_count, uint16_t rx_queue_id);
 
-/*
- * Interface to send packets to all ports after processing them.
- *
- * Input : a pointer to the tx queue
- *
- */
-void
-onvm_pkt_flush_all_ports(struct queue_mgr *tx_mgr);
-
 /*
  * Interface to drop a batch of packets.
  *
@@ -0,0 +1,213 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+/******************************************************************************
+
+                              onvm_rss.c
+
+       This file contains the RSS redirection table rebalancer. Each RX
+       thread counts the packets hitting every table entry, and the master
+       thread periodically moves hot entries from the busiest queue of a
+       port to its idlest one with rte_eth_dev_rss_reta_update.
+
+******************************************************************************/
+
+#include "onvm_mgr.h"
+#include "onvm_rss.h"
+
+/******************************Global variables*******************************/
+
+uint16_t port_reta_size[RTE_MAX_ETHPORTS];
+
+/* Per port, the packet totals of each table entry at the previous round. NULL
+ * if the port is not rebalanced, the RX threads may still count its packets */
+static uint64_t *reta_last_pkts[RTE_MAX_ETHPORTS];
+
+static uint64_t last_rebalance_cycles;
+
+/************************Internal functions prototypes************************/
+
+static void
+onvm_rss_rebalance_port(uint16_t port_id, uint64_t elapsed_cycles);
+
+/********************************Interfaces***********************************/
+
+int
+onvm_rss_init(void) {
+        struct rte_eth_dev_info dev_info;
+        uint16_t i, j, port_id;
+
+        for (i = 0; i < ports->num_ports; i++) {
+                port_id = ports->id[i];
+                rte_eth_dev_info_get(port_id, &dev_info);
+                /* The NIC picks the entry with the low bits of the hash */
+                if (num_rx_queues[port_id] < 2 || !rte_is_power_of_2(dev_info.reta_size) ||
+                    dev_info.reta_size < RTE_RETA_GROUP_SIZE || dev_info.reta_size > ETH_RSS_RETA_SIZE_512) {
+                        RTE_LOG(INFO, APP, "Port %u RSS redirection table will not be rebalanced\n", port_id);
+                        continue;
+                }
+
+                reta_last_pkts[port_id] = rte_calloc("reta last pkts", dev_info.reta_size, sizeof(uint64_t), 0);
+                if (reta_last_pkts[port_id] == NULL)
+                        return -1;
+                for (j = 0; j < num_rx_threads; j++) {
+                        rx_threads[j].reta_pkts[port_id] =
+                            rte_calloc("reta pkts", dev_info.reta_size, sizeof(uint64_t), RTE_CACHE_LINE_SIZE);
+                        if (rx_threads[j].reta_pkts[port_id] == NULL)
+                                return -1;
+                }
+                port_reta_size[port_id] = dev_info.reta_size;
+        }
+
+        last_rebalance_cycles = rte_get_tsc_cycles();
+        return 0;
+}
+
+void
+onvm_rss_rebalance(void) {
+        const uint64_t now = rte_get_tsc_cycles();
+        uint16_t i;
+
+        if (now - last_rebalance_cycles < (uint64_t)global_reta_rebalance_period * rte_get_timer_hz())
+                return;
+
+        for (i = 0; i < ports->num_ports; i++) {
+                if (reta_last_pkts[ports->id[i]] != NULL)
+                        onvm_rss_rebalance_port(ports->id[i], now - last_rebalance_cycles);
+        }
+        last_rebalance_cycles = now;
+}
+
+/******************************Internal functions*****************************/
+
+static void
+onvm_rss_rebalance_port(uint16_t port_id, uint64_t elapsed_cycles) {
+        struct rte_eth_rss_reta_entry64 reta_conf[ETH_RSS_RETA_SIZE_512 / RTE_RETA_GROUP_SIZE];
+        uint64_t entry_pkts[ETH_RSS_RETA_SIZE_512];
+        uint64_t queue_pkts[RTE_MAX_QUEUES_PER_PORT];
+        const uint16_t reta_size = port_reta_size[port_id];
+        const uint16_t nb_queues = num_rx_queues[port_id];
+        uint64_t total_pkts = 0, pkts, gap;
+        uint16_t i, j, q, hot, cold, best, moves = 0;
+        int ret;
+
+        memset(reta_conf, 0, sizeof(reta_conf));
+        for (i = 0; i < reta_size / RTE_RETA_GROUP_SIZE; i++)
+                reta_conf[i].mask = UINT64_MAX;
+        ret = rte_eth_dev_rss_reta_query(port_id, reta_conf, reta_size);
+        if (ret != 0) {
+                RTE_LOG(WARNING, APP, "Port %u cannot read RSS redirection table (%d), not rebalancing it\n",
+                        port_id, ret);
+                rte_free(reta_last_pkts[port_id]);
+                reta_last_pkts[port_id] = NULL;
+                return;
+        }
+
+        /* Packets per entry and per queue since the last round */
+        memset(queue_pkts, 0, sizeof(uint64_t) * nb_queues);
+        for (i = 0; i < reta_size; i++) {
+                pkts = 0;
+                for (j = 0; j < num_rx_threads; j++)
+                        pkts += rx_threads[j].reta_pkts[port_id][i];
+                entry_pkts[i] = pkts - reta_last_pkts[port_id][i];
+                reta_last_pkts[port_id][i] = pkts;
+
+                q = reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE];
+                if (q < nb_queues)
+                        queue_pkts[q] += entry_pkts[i];
+                total_pkts += entry_pkts[i];
+        }
+        if (total_pkts < RETA_REBALANCE_MIN_PKTS)
+                return;
+
+        /* Only the entries moved below are written back */
+        for (i = 0; i < reta_size / RTE_RETA_GROUP_SIZE; i++)
+                reta_conf[i].mask = 0;
+
+        while (moves < RETA_REBALANCE_MAX_MOVES) {
+                hot = cold = 0;
+                for (q = 1; q < nb_queues; q++) {
+                        if (queue_pkts[q] > queue_pkts[hot])
+                                hot = q;
+                        if (queue_pkts[q] < queue_pkts[cold])
+                                cold = q;
+                }
+                if (queue_pkts[hot] * nb_queues * 100 <= total_pkts * (100 + RETA_REBALANCE_THRESHOLD_PCT))
+                        break;
+
+                /* Busiest entry on the hot queue that still narrows the gap to the cold one */
+                gap = queue_pkts[hot] - queue_pkts[cold];
+                best = reta_size;
+                for (i = 0; i < reta_size; i++) {
+                        if (reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE] != hot ||
+                            entry_pkts[i] == 0 || entry_pkts[i] >= gap)
+                                continue;
+                        if (best == reta_size || entry_pkts[i] > entry_pkts[best])
+                                best = i;
+                }
+                /* A single entry carries the hot queue's load, moving it won't help */
+                if (best == reta_size)
+                        break;
+
+                reta_conf[best / RTE_RETA_GROUP_SIZE].reta[best % RTE_RETA_GROUP_SIZE] = cold;
+                reta_conf[best / RTE_RETA_GROUP_SIZE].mask |= 1ULL << (best % RTE_RETA_GROUP_SIZE);
+                queue_pkts[hot] -= entry_pkts[best];
+                queue_pkts[cold] += entry_pkts[best];
+                moves++;
+        }
+        if (moves == 0)
+                return;
+
+        ret = rte_eth_dev_rss_reta_update(port_id, reta_conf, reta_size);
+        if (ret != 0) {
+                RTE_LOG(WARNING, APP, "Port %u cannot update RSS redirection table (%d), not rebalancing it\n",
+                        port_id, ret);
+                rte_free(reta_last_pkts[port_id]);
+                reta_last_pkts[port_id] = NULL;
+                return;
+        }
+
+        for (q = 0, hot = 0; q < nb_queues; q++) {
+                if (queue_pkts[q] > queue_pkts[hot])
+                        hot = q;
+        }
+        RTE_LOG(INFO, APP, "Port %u: moved %u RSS table entries, busiest queue %u now ~%" PRIu64 " pps\n", port_id,
+                moves, hot, queue_pkts[hot] * rte_get_timer_hz() / elapsed_cycles);
+}
@@ -0,0 +1,115 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+/******************************************************************************
+
+                                 onvm_rss.h
+
+     This file contains the prototypes for spreading NIC RX load over the
+     manager RX queues by rewriting the RSS redirection tables.
+
+******************************************************************************/
+
+#ifndef _ONVM_RSS_H_
+#define _ONVM_RSS_H_
+
+#include "onvm_mgr/onvm_init.h"
+
+/***********************************Macros************************************/
+
+/* Rebalance a port while its busiest queue is this many percent above the mean */
+#define RETA_REBALANCE_THRESHOLD_PCT 20
+/* Most redirection table entries moved per port in one round */
+#define RETA_REBALANCE_MAX_MOVES 16
+/* Rounds with fewer packets on a port are too noisy to act on */
+#define RETA_REBALANCE_MIN_PKTS 10000
+
+/*************************External global variables***************************/
+
+/* Redirection table size of each port, 0 if it is not rebalanced */
+extern uint16_t port_reta_size[RTE_MAX_ETHPORTS];
+
+/********************************Interfaces***********************************/
+
+/*
+ * Interface to count a burst against the redirection table entries its RSS
+ * hashes select. Does nothing unless the port is being rebalanced.
+ *
+ * Input : the calling RX thread's info
+ *         the port the burst came from
+ *         an array of packets and its size
+ *
+ */
+static inline void
+onvm_rss_count_pkts(struct rx_thread_info *rx_info, uint16_t port_id, struct rte_mbuf **pkts, uint16_t count) {
+        uint64_t *reta_pkts = rx_info->reta_pkts[port_id];
+        uint32_t mask;
+        uint16_t i;
+
+        if (reta_pkts == NULL)
+                return;
+
+        mask = port_reta_size[port_id] - 1;
+        for (i = 0; i < count; i++) {
+                if (likely(pkts[i]->ol_flags & PKT_RX_RSS_HASH))
+                        reta_pkts[pkts[i]->hash.rss & mask]++;
+        }
+}
+
+/*
+ * Interface to allocate the per RX thread counters for every port whose
+ * redirection table can be rewritten. Must run before the RX threads start.
+ *
+ * Output : 0 on success, -1 if memory allocation failed
+ *
+ */
+int
+onvm_rss_init(void);
+
+/*
+ * Interface called periodically by the master thread. Once the rebalance
+ * period has passed, measures per queue packet rates on every port and moves
+ * the busiest redirection table entries off overloaded queues.
+ *
+ */
+void
+onvm_rss_rebalance(void);
+
+#endif  // _ONVM_RSS_H_
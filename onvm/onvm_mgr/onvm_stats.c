@@ -79,6 +79,64 @@ onvm_stats_display_ports(unsigned difftime, uint8_t verbosity_level);
 static void
 onvm_stats_display_nfs(unsigned difftime, uint8_t verbosity_level);
 
+/*
+ * Function displaying sleep statistics of manager RX/TX threads in
+ * adaptive polling mode
+ *
+ * Input : time passed since last display (to compute sleep share)
+ *
+ */
+static void
+onvm_stats_display_adaptive_poll(unsigned difftime);
+
+/*
+ * Function displaying why manager threads and NFs flushed their packet
+ * buffers, and how full the buffers were when they did
+ *
+ * Input : time passed since last display (to compute rates)
+ *
+ */
+static void
+onvm_stats_display_flushes(unsigned difftime);
+
+/*
+ * Function displaying how many packets each NF got and dropped on its high
+ * and low priority RX rings, and how long they waited there
+ *
+ * Input : time passed since last display (to compute rates)
+ *
+ */
+static void
+onvm_stats_display_rx_prio(unsigned difftime);
+
+/*
+ * Function displaying the latency percentiles of the packets traced since
+ * the last display, for each chain stage they went through
+ *
+ */
+static void
+onvm_stats_display_trace(void);
+
+/*
+ * Function taking the cycle stats of an NF since the last display
+ *
+ * Input  : NF instance id, the cycle stats it had at the last display
+ * Output : the cycle stats since then, in delta
+ *
+ */
+static void
+onvm_stats_nf_cycles(unsigned id, struct onvm_nf_cycle_stats *last, struct onvm_nf_cycle_stats *delta);
+
+/*
+ * Function displaying where each NF spent its cycles since the last display,
+ * and at verbosity level 2 how long its handler took per batch
+ *
+ * Input : cycle stats of all NFs since the last display, time passed since then
+ *
+ */
+static void
+onvm_stats_display_nf_cycles(struct onvm_nf_cycle_stats *cycles, unsigned difftime, uint8_t verbosity_level);
+
 /*
  * Function clearing the terminal and moving back the cursor to the top left.
  *
@@ -197,6 +255,14 @@ onvm_stats_display_all(unsigned difftime, uint8_t verbosity_level) {
         }
 
         onvm_stats_display_ports(difftime, verbosity_level);
+        if (onvm_config->flags.ONVM_ADAPTIVE_POLL && verbosity_level != ONVM_RAW_STATS_DUMP)
+                onvm_stats_display_adaptive_poll(difftime);
+        if ((onvm_config->flush_deadline_us != 0 && verbosity_level != ONVM_RAW_STATS_DUMP) || verbosity_level == 2)
+                onvm_stats_display_flushes(difftime);
+        if (verbosity_level == 2)
+                onvm_stats_display_rx_prio(difftime);
+        if (trace_stats != NULL && verbosity_level != ONVM_RAW_STATS_DUMP)
+                onvm_stats_display_trace();
         onvm_stats_display_nfs(difftime, verbosity_level);
 
         if (stats_destination == ONVM_STATS_WEB) {
@@ -223,6 +289,9 @@ onvm_stats_clear_nf(uint16_t id) {
         nfs[id].stats.act_drop = nfs[id].stats.act_tonf = 0;
         nfs[id].stats.act_next = nfs[id].stats.act_out = 0;
         nfs[id].stats.tx_returned = nfs[id].stats.tx_buffer = 0;
+        memset((void *)&nfs[id].stats.flush, 0, sizeof(nfs[id].stats.flush));
+        memset((void *)&nfs[id].stats.cycles, 0, sizeof(nfs[id].stats.cycles));
+        memset((void *)nfs[id].stats.rx_prio, 0, sizeof(nfs[id].stats.rx_prio));
 }
 
 void
@@ -365,6 +434,231 @@ onvm_stats_display_ports(unsigned difftime, uint8_t verbosity_level) {
         }
 }
 
+static void
+onvm_stats_display_adaptive_poll_thread(const char *label, unsigned id, struct adaptive_poll_stats *stats,
+                                        struct adaptive_poll_stats *last, unsigned difftime) {
+        uint64_t sleeps, wakeups, slept_pct, latency_us;
+
+        sleeps = stats->sleeps - last->sleeps;
+        wakeups = stats->wakeups - last->wakeups;
+        slept_pct = (stats->sleep_cycles - last->sleep_cycles) * 100 / (rte_get_timer_hz() * difftime);
+        latency_us = wakeups ? (stats->wakeup_latency_cycles - last->wakeup_latency_cycles) * US_PER_S /
+                                   rte_get_timer_hz() / wakeups
+                             : 0;
+
+        fprintf(stats_out, ONVM_STATS_ADAPTIVE_POLL_CONTENT, label, id, sleeps / difftime, slept_pct,
+                wakeups / difftime, latency_us);
+        *last = *stats;
+}
+
+static void
+onvm_stats_display_adaptive_poll(unsigned difftime) {
+        static struct adaptive_poll_stats rx_last[ONVM_MAX_RX_THREADS];
+        static struct adaptive_poll_stats tx_last[RTE_MAX_LCORE];
+        unsigned i;
+
+        fprintf(stats_out, ONVM_STATS_ADAPTIVE_POLL_MSG);
+        for (i = 0; i < num_rx_threads; i++)
+                onvm_stats_display_adaptive_poll_thread("RX", i, &rx_poll_stats[i], &rx_last[i], difftime);
+        for (i = 0; i < num_tx_threads; i++)
+                onvm_stats_display_adaptive_poll_thread("TX", i, &tx_poll_stats[i], &tx_last[i], difftime);
+}
+
+static void
+onvm_stats_display_flushes_of(const char *label, unsigned id, struct onvm_flush_stats *stats,
+                              struct onvm_flush_stats *last, unsigned difftime) {
+        uint64_t flushes[ONVM_FLUSH_REASONS];
+        uint64_t total_flushes = 0, total_pkts = 0;
+        unsigned r;
+
+        for (r = 0; r < ONVM_FLUSH_REASONS; r++) {
+                /* The NF id was reused and its stats cleared */
+                if (stats->flushes[r] < last->flushes[r])
+                        last->flushes[r] = last->pkts[r] = 0;
+                flushes[r] = stats->flushes[r] - last->flushes[r];
+                total_flushes += flushes[r];
+                total_pkts += stats->pkts[r] - last->pkts[r];
+                last->flushes[r] = stats->flushes[r];
+                last->pkts[r] = stats->pkts[r];
+        }
+
+        fprintf(stats_out, ONVM_STATS_FLUSH_CONTENT, label, id, flushes[ONVM_FLUSH_FULL] / difftime,
+                flushes[ONVM_FLUSH_DEADLINE] / difftime, flushes[ONVM_FLUSH_LOOP] / difftime,
+                flushes[ONVM_FLUSH_IDLE] / difftime, total_flushes ? total_pkts / total_flushes : 0);
+}
+
+static void
+onvm_stats_display_flushes(unsigned difftime) {
+        static struct onvm_flush_stats rx_last[ONVM_MAX_RX_THREADS];
+        static struct onvm_flush_stats tx_last[RTE_MAX_LCORE];
+        static struct onvm_flush_stats nf_last[MAX_NFS];
+        unsigned i;
+
+        fprintf(stats_out, ONVM_STATS_FLUSH_MSG);
+        for (i = 0; i < num_rx_threads; i++)
+                onvm_stats_display_flushes_of("RX", i, &rx_flush_stats[i], &rx_last[i], difftime);
+        for (i = 0; i < num_tx_threads; i++)
+                onvm_stats_display_flushes_of("TX", i, &tx_flush_stats[i], &tx_last[i], difftime);
+        for (i = 0; i < MAX_NFS; i++) {
+                if (!onvm_nf_is_valid(&nfs[i]))
+                        continue;
+                onvm_stats_display_flushes_of("NF", i, &nfs[i].stats.flush, &nf_last[i], difftime);
+        }
+}
+
+static void
+onvm_stats_display_rx_prio(unsigned difftime) {
+        static uint64_t rx_last[MAX_NFS][ONVM_RX_PRIOS];
+        static uint64_t drop_last[MAX_NFS][ONVM_RX_PRIOS];
+        static uint64_t dequeued_last[MAX_NFS][ONVM_RX_PRIOS];
+        static uint64_t delay_last[MAX_NFS][ONVM_RX_PRIOS];
+        uint64_t rx[ONVM_RX_PRIOS], drop[ONVM_RX_PRIOS], delay_us[ONVM_RX_PRIOS];
+        uint64_t dequeued, delay;
+        unsigned i, p;
+
+        fprintf(stats_out, ONVM_STATS_RX_PRIO_MSG);
+        for (i = 0; i < MAX_NFS; i++) {
+                if (!onvm_nf_is_valid(&nfs[i]))
+                        continue;
+                for (p = 0; p < ONVM_RX_PRIOS; p++) {
+                        /* The NF id was reused and its stats cleared */
+                        if (nfs[i].stats.rx_prio[p].dequeued < dequeued_last[i][p])
+                                rx_last[i][p] = drop_last[i][p] = dequeued_last[i][p] = delay_last[i][p] = 0;
+                        rx[p] = (nfs[i].stats.rx_prio[p].rx - rx_last[i][p]) / difftime;
+                        drop[p] = (nfs[i].stats.rx_prio[p].rx_drop - drop_last[i][p]) / difftime;
+                        dequeued = nfs[i].stats.rx_prio[p].dequeued - dequeued_last[i][p];
+                        delay = nfs[i].stats.rx_prio[p].delay_cycles - delay_last[i][p];
+                        delay_us[p] = dequeued ? delay * US_PER_S / rte_get_timer_hz() / dequeued : 0;
+
+                        rx_last[i][p] = nfs[i].stats.rx_prio[p].rx;
+                        drop_last[i][p] = nfs[i].stats.rx_prio[p].rx_drop;
+                        dequeued_last[i][p] = nfs[i].stats.rx_prio[p].dequeued;
+                        delay_last[i][p] = nfs[i].stats.rx_prio[p].delay_cycles;
+                }
+                fprintf(stats_out, ONVM_STATS_RX_PRIO_CONTENT, i, rx[ONVM_RX_PRIO_HIGH], drop[ONVM_RX_PRIO_HIGH],
+                        delay_us[ONVM_RX_PRIO_HIGH], rx[ONVM_RX_PRIO_LOW], drop[ONVM_RX_PRIO_LOW],
+                        delay_us[ONVM_RX_PRIO_LOW]);
+        }
+}
+
+static void
+onvm_stats_nf_cycles(unsigned id, struct onvm_nf_cycle_stats *last, struct onvm_nf_cycle_stats *delta) {
+        struct onvm_nf_cycle_stats now;
+        unsigned b;
+
+        now = nfs[id].stats.cycles;
+        /* The NF id was reused and its stats cleared */
+        if (now.batches < last->batches || now.idle < last->idle)
+                memset(last, 0, sizeof(*last));
+
+        delta->handler = now.handler - last->handler;
+        delta->tx = now.tx - last->tx;
+        delta->idle = now.idle - last->idle;
+        delta->pkts = now.pkts - last->pkts;
+        delta->batches = now.batches - last->batches;
+        for (b = 0; b < ONVM_CYCLE_HIST_BUCKETS; b++)
+                delta->batch_hist[b] = now.batch_hist[b] - last->batch_hist[b];
+        *last = now;
+}
+
+static void
+onvm_stats_display_nf_cycles(struct onvm_nf_cycle_stats *cycles, unsigned difftime, uint8_t verbosity_level) {
+        uint64_t wall, busy;
+        unsigned i, b;
+
+        wall = rte_get_timer_hz() * difftime;
+        fprintf(stats_out, ONVM_STATS_CYCLES_MSG);
+        for (i = 0; i < MAX_NFS; i++) {
+                if (!onvm_nf_is_valid(&nfs[i]))
+                        continue;
+                busy = cycles[i].handler + cycles[i].tx;
+                fprintf(stats_out, ONVM_STATS_CYCLES_CONTENT, i, cycles[i].pkts ? busy / cycles[i].pkts : 0,
+                        cycles[i].pkts ? cycles[i].handler / cycles[i].pkts : 0,
+                        cycles[i].pkts ? cycles[i].tx / cycles[i].pkts : 0, busy * 100 / wall,
+                        cycles[i].idle * 100 / wall, cycles[i].batches / difftime,
+                        cycles[i].batches ? cycles[i].pkts / cycles[i].batches : 0);
+                if (verbosity_level != 2 || cycles[i].batches == 0)
+                        continue;
+
+                /* Bucket b > 0 starts at 2^(b + ONVM_CYCLE_HIST_SHIFT - 1) cycles */
+                fprintf(stats_out, "        batch cycles ");
+                if (cycles[i].batch_hist[0])
+                        fprintf(stats_out, " <2^%u:%" PRIu64, ONVM_CYCLE_HIST_SHIFT, cycles[i].batch_hist[0]);
+                for (b = 1; b < ONVM_CYCLE_HIST_BUCKETS; b++) {
+                        if (cycles[i].batch_hist[b])
+                                fprintf(stats_out, " %s2^%u:%" PRIu64, b == ONVM_CYCLE_HIST_BUCKETS - 1 ? ">=" : "",
+                                        b + ONVM_CYCLE_HIST_SHIFT - 1, cycles[i].batch_hist[b]);
+                }
+                fprintf(stats_out, "\n");
+        }
+}
+
+/* Latency in ns below which permille of the count packets of hist were */
+static uint64_t
+onvm_stats_trace_percentile(const uint64_t *hist, uint64_t count, unsigned permille) {
+        uint64_t target, seen = 0, cycles;
+        unsigned b;
+
+        target = (count * permille + 999) / 1000;
+        for (b = 0; b < ONVM_TRACE_HIST_BUCKETS - 1; b++) {
+                seen += hist[b];
+                if (seen >= target)
+                        break;
+        }
+        /* Middle of the bucket, its values are at most 1/16 off */
+        cycles = b < ONVM_TRACE_HIST_BUCKETS - 1 ? (onvm_trace_hist_value(b) + onvm_trace_hist_value(b + 1)) / 2
+                                                 : onvm_trace_hist_value(b);
+        return cycles * 1000 * US_PER_S / rte_get_timer_hz();
+}
+
+static void
+onvm_stats_display_trace_hist(const char *label, struct onvm_trace_hist *hist, uint64_t *last) {
+        uint64_t delta[ONVM_TRACE_HIST_BUCKETS];
+        uint64_t count = 0, now;
+        unsigned b;
+
+        for (b = 0; b < ONVM_TRACE_HIST_BUCKETS; b++) {
+                now = rte_atomic64_read(&hist->buckets[b]);
+                delta[b] = now - last[b];
+                last[b] = now;
+                count += delta[b];
+        }
+        if (count == 0)
+                return;
+
+        fprintf(stats_out, ONVM_STATS_TRACE_CONTENT, label, count, onvm_stats_trace_percentile(delta, count, 500),
+                onvm_stats_trace_percentile(delta, count, 990), onvm_stats_trace_percentile(delta, count, 999));
+}
+
+static void
+onvm_stats_display_trace(void) {
+        static uint64_t wait_last[ONVM_TRACE_MAX_HOPS][MAX_SERVICES][ONVM_TRACE_HIST_BUCKETS];
+        static uint64_t nf_last[ONVM_TRACE_MAX_HOPS][MAX_SERVICES][ONVM_TRACE_HIST_BUCKETS];
+        static uint64_t egress_last[ONVM_TRACE_HIST_BUCKETS];
+        static uint64_t total_last[ONVM_TRACE_HIST_BUCKETS];
+        static uint64_t samples_last, truncated_last;
+        uint64_t samples, truncated;
+        char label[32];
+        unsigned hop, sid;
+
+        samples = rte_atomic64_read(&trace_stats->samples);
+        truncated = rte_atomic64_read(&trace_stats->truncated);
+        fprintf(stats_out, ONVM_STATS_TRACE_MSG, samples - samples_last, truncated - truncated_last);
+        samples_last = samples;
+        truncated_last = truncated;
+
+        for (hop = 0; hop < ONVM_TRACE_MAX_HOPS; hop++) {
+                for (sid = 0; sid < MAX_SERVICES; sid++) {
+                        snprintf(label, sizeof(label), "hop %u SID %u wait", hop, sid);
+                        onvm_stats_display_trace_hist(label, &trace_stats->wait[hop][sid], wait_last[hop][sid]);
+                        snprintf(label, sizeof(label), "hop %u SID %u nf", hop, sid);
+                        onvm_stats_display_trace_hist(label, &trace_stats->nf[hop][sid], nf_last[hop][sid]);
+                }
+        }
+        onvm_stats_display_trace_hist("egress wait", &trace_stats->egress, egress_last);
+        onvm_stats_display_trace_hist("total", &trace_stats->total, total_last);
+}
+
 static void
 onvm_stats_display_client_wakeup_thread_context(int difftime) {
         uint64_t num_wakeups = 0;
@@ -394,6 +688,11 @@ onvm_stats_display_nfs(unsigned difftime, uint8_t verbosity_level) {
         /* Arrays to store last TX/RX pkts dropped for NFs to calculate drop rate */
         static uint64_t nf_tx_drop_last[MAX_NFS];
         static uint64_t nf_rx_drop_last[MAX_NFS];
+        /* Cycle stats at the last display and since then */
+        static struct onvm_nf_cycle_stats nf_cycles_last[MAX_NFS];
+        static struct onvm_nf_cycle_stats nf_cycles[MAX_NFS];
+        cJSON *hist;
+        unsigned b;
         static const char *NF_MSG[3];
 
         NF_MSG[0] = ONVM_STATS_MSG;
@@ -460,8 +759,11 @@ onvm_stats_display_nfs(unsigned difftime, uint8_t verbosity_level) {
                 const uint64_t num_wakeups = nf_wakeup_infos[i].num_wakeups;
                 const uint64_t prev_num_wakeups = nf_wakeup_infos[i].prev_num_wakeups;
                 const uint64_t wakeup_rate = (num_wakeups - prev_num_wakeups) / difftime;
+                struct onvm_nf_cycle_stats *cycles = &nf_cycles[i];
                 char state;
 
+                onvm_stats_nf_cycles(i, &nf_cycles_last[i], cycles);
+
                 uint8_t active = 0;
                 if (ONVM_NF_SHARE_CORES)
                         active = rte_atomic16_read(nf_wakeup_infos[i].shm_server);
@@ -526,6 +828,18 @@ onvm_stats_display_nfs(unsigned difftime, uint8_t verbosity_level) {
                         cJSON_AddNumberToObject(onvm_json_nf_stats[i], "instance_id",
                                                 (int16_t)nfs[i].instance_id);
                         cJSON_AddNumberToObject(onvm_json_nf_stats[i], "core", (int16_t)nfs[i].thread_info.core);
+                        cJSON_AddNumberToObject(onvm_json_nf_stats[i], "Cycles_Per_Pkt",
+                                                cycles->pkts ? (cycles->handler + cycles->tx) / cycles->pkts : 0);
+                        cJSON_AddNumberToObject(onvm_json_nf_stats[i], "Handler_Cycles_Per_Pkt",
+                                                cycles->pkts ? cycles->handler / cycles->pkts : 0);
+                        cJSON_AddNumberToObject(onvm_json_nf_stats[i], "Busy_Pct",
+                                                (cycles->handler + cycles->tx) * 100 /
+                                                        (rte_get_timer_hz() * difftime));
+                        cJSON_AddNumberToObject(onvm_json_nf_stats[i], "Idle_Pct",
+                                                cycles->idle * 100 / (rte_get_timer_hz() * difftime));
+                        cJSON_AddItemToObject(onvm_json_nf_stats[i], "Batch_Cycles_Hist", hist = cJSON_CreateArray());
+                        for (b = 0; b < ONVM_CYCLE_HIST_BUCKETS; b++)
+                                cJSON_AddItemToArray(hist, cJSON_CreateNumber(cycles->batch_hist[b]));
 
                         free(nf_label);
                         nf_label = NULL;
@@ -564,6 +878,8 @@ onvm_stats_display_nfs(unsigned difftime, uint8_t verbosity_level) {
                 }
         }
 
+        onvm_stats_display_nf_cycles(nf_cycles, difftime, verbosity_level);
+
         if (ONVM_NF_SHARE_CORES) {
                 fprintf(stats_out, "\n\nShared core stats\n");
                 fprintf(stats_out, "-----------------\n");
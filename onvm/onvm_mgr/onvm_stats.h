@@ -70,6 +70,33 @@ extern const char *NF_MSG[3];
         "               PNT / S|W / CHLD  drop_pps  /  drop_pps      rx_drop  /  tx_drop           next  /    buf      /   ret\n"\
         "                                  wakeups  /  wakeup_rt\n"\
         "----------------------------------------------------------------------------------------------------------------------\n"
+#define ONVM_STATS_ADAPTIVE_POLL_MSG "\n"\
+        "MGR THREADS   sleeps/s   slept   wakeups/s   wakeup_lat_us\n"\
+        "----------------------------------------------------------\n"
+#define ONVM_STATS_ADAPTIVE_POLL_CONTENT \
+        "%s %-4u     %9" PRIu64 "   %3" PRIu64 "%%   %9" PRIu64 "   %13" PRIu64 "\n"
+#define ONVM_STATS_FLUSH_MSG "\n"\
+        "BUFFER FLUSHES   full/s   deadline/s   loop/s   idle/s   pkts/flush\n"\
+        "--------------------------------------------------------------------\n"
+#define ONVM_STATS_FLUSH_CONTENT \
+        "%s %-4u       %8" PRIu64 "   %10" PRIu64 "   %6" PRIu64 "   %6" PRIu64 "   %10" PRIu64 "\n"
+#define ONVM_STATS_RX_PRIO_MSG "\n"\
+        "NF RX PRIORITY   hi_rx/s   hi_drop/s   hi_delay_us   lo_rx/s   lo_drop/s   lo_delay_us\n"\
+        "-------------------------------------------------------------------------------------\n"
+#define ONVM_STATS_RX_PRIO_CONTENT \
+        "NF %-4u       %9" PRIu64 "   %9" PRIu64 "   %11" PRIu64 "   %7" PRIu64 "   %9" PRIu64 "   %11" PRIu64 "\n"
+#define ONVM_STATS_CYCLES_MSG "\n"\
+        "NF CYCLES     cyc/pkt   handler/pkt   tx/pkt   busy   idle   batches/s   pkts/batch\n"\
+        "-----------------------------------------------------------------------------------\n"
+#define ONVM_STATS_CYCLES_CONTENT \
+        "NF %-4u   %11" PRIu64 "   %11" PRIu64 "   %6" PRIu64 "   %3" PRIu64 "%%   %3" PRIu64 "%%   %9" PRIu64\
+        "   %10" PRIu64 "\n"
+#define ONVM_STATS_TRACE_MSG "\n"\
+        "LATENCY TRACE (%" PRIu64 " pkts, %" PRIu64 " with too many hops)\n"\
+        "STAGE                    samples     p50_ns     p99_ns    p999_ns\n"\
+        "-----------------------------------------------------------------\n"
+#define ONVM_STATS_TRACE_CONTENT \
+        "%-20s   %9" PRIu64 "   %8" PRIu64 "   %8" PRIu64 "   %8" PRIu64 "\n"
 #define ONVM_STATS_RAW_DUMP_PORT_MSG \
         "#YYYY-MM-DD HH:MM:SS,nic_rx_pkts,nic_rx_pps,nic_tx_pkts,nic_tx_pps\n"
 #define ONVM_STATS_RAW_DUMP_NF_MSG \
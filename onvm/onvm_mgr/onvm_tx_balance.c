@@ -0,0 +1,223 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+
+/******************************************************************************
+
+                              onvm_tx_balance.c
+
+       This file contains the assignment of NF TX rings to manager TX
+       threads. Each NF's tx_q is drained by exactly one TX thread, the
+       one in tx_doorbells->tx_thread. The master thread only records the
+       thread it wants in tx_nf_target, and the current owner hands the
+       ring over from its own loop, so a ring never has two consumers.
+
+******************************************************************************/
+
+#include "onvm_mgr.h"
+#include "onvm_tx_balance.h"
+
+/******************************Global variables*******************************/
+
+rte_atomic32_t tx_assign_gen;
+
+struct tx_nf_load tx_nf_loads[MAX_NFS];
+
+/* The TX thread each NF should move to, equal to tx_doorbells->tx_thread once settled */
+static volatile uint16_t tx_nf_target[MAX_NFS];
+
+/* Per NF, the packet totals at the previous round */
+static uint64_t tx_nf_last_pkts[MAX_NFS];
+
+static uint64_t last_rebalance_cycles;
+
+/************************Internal functions prototypes************************/
+
+static void
+onvm_tx_balance_move_nf(uint16_t instance_id, uint16_t tx_thread);
+
+/********************************Interfaces***********************************/
+
+void
+onvm_tx_balance_init(void) {
+        uint16_t i;
+
+        /* Stripe the instance IDs so consecutive NFs start on different threads */
+        for (i = 0; i < MAX_NFS; i++) {
+                tx_nf_target[i] = i % num_tx_threads;
+                tx_doorbells->tx_thread[i] = tx_nf_target[i];
+        }
+        rte_atomic32_init(&tx_assign_gen);
+        last_rebalance_cycles = rte_get_tsc_cycles();
+}
+
+void
+onvm_tx_balance_update_thread(struct queue_mgr *tx_mgr) {
+        struct tx_thread_info *info = tx_mgr->tx_thread_info;
+        uint16_t nf_id, target;
+        uint32_t gen;
+        int released = 0;
+
+        gen = (uint32_t)rte_atomic32_read(&tx_assign_gen);
+        info->num_nfs = 0;
+        for (nf_id = 0; nf_id < MAX_NFS; nf_id++) {
+                if (tx_doorbells->tx_thread[nf_id] != tx_mgr->id)
+                        continue;
+
+                target = tx_nf_target[nf_id];
+                if (target == tx_mgr->id) {
+                        info->nfs[info->num_nfs++] = nf_id;
+                        continue;
+                }
+
+                /* We no longer dequeue from this tx_q, the new owner may start */
+                tx_doorbells->tx_thread[nf_id] = target;
+                released = 1;
+                /* It may be asleep with packets already waiting */
+                if (rte_ring_count(nfs[nf_id].tx_q) > 0)
+                        onvm_pkt_ring_tx_doorbell(&nfs[nf_id]);
+        }
+        if (released) {
+                rte_smp_wmb();
+                rte_atomic32_inc(&tx_assign_gen);
+        }
+        info->assign_gen = gen;
+}
+
+void
+onvm_tx_balance_assign_nf(uint16_t instance_id) {
+        uint16_t nf_count[RTE_MAX_LCORE];
+        uint16_t i, best;
+
+        memset(nf_count, 0, sizeof(uint16_t) * num_tx_threads);
+        for (i = 0; i < MAX_NFS; i++) {
+                if (i != instance_id && onvm_nf_is_valid(&nfs[i]))
+                        nf_count[tx_nf_target[i]]++;
+        }
+
+        best = tx_nf_target[instance_id];
+        for (i = 0; i < num_tx_threads; i++) {
+                if (nf_count[i] < nf_count[best])
+                        best = i;
+        }
+        onvm_tx_balance_move_nf(instance_id, best);
+}
+
+void
+onvm_tx_balance_rebalance(void) {
+        uint64_t thread_pkts[RTE_MAX_LCORE];
+        uint64_t nf_pkts[MAX_NFS];
+        const uint64_t now = rte_get_tsc_cycles();
+        const uint64_t elapsed_cycles = now - last_rebalance_cycles;
+        uint64_t total_pkts = 0, pkts, gap;
+        uint16_t i, t, hot, cold, best, moves = 0;
+
+        if (elapsed_cycles < (uint64_t)global_tx_rebalance_period * rte_get_timer_hz())
+                return;
+        last_rebalance_cycles = now;
+
+        /* Packets per NF and per TX thread since the last round */
+        memset(thread_pkts, 0, sizeof(uint64_t) * num_tx_threads);
+        for (i = 0; i < MAX_NFS; i++) {
+                pkts = tx_nf_loads[i].pkts;
+                nf_pkts[i] = pkts - tx_nf_last_pkts[i];
+                tx_nf_last_pkts[i] = pkts;
+                if (!onvm_nf_is_valid(&nfs[i]))
+                        nf_pkts[i] = 0;
+                thread_pkts[tx_nf_target[i]] += nf_pkts[i];
+                total_pkts += nf_pkts[i];
+        }
+        if (num_tx_threads < 2 || total_pkts < TX_REBALANCE_MIN_PKTS)
+                return;
+
+        while (moves < TX_REBALANCE_MAX_MOVES) {
+                hot = cold = 0;
+                for (t = 1; t < num_tx_threads; t++) {
+                        if (thread_pkts[t] > thread_pkts[hot])
+                                hot = t;
+                        if (thread_pkts[t] < thread_pkts[cold])
+                                cold = t;
+                }
+                if (thread_pkts[hot] * num_tx_threads * 100 <= total_pkts * (100 + TX_REBALANCE_THRESHOLD_PCT))
+                        break;
+
+                /* Busiest settled NF on the hot thread that still narrows the gap to the cold one */
+                gap = thread_pkts[hot] - thread_pkts[cold];
+                best = MAX_NFS;
+                for (i = 0; i < MAX_NFS; i++) {
+                        if (tx_nf_target[i] != hot || tx_doorbells->tx_thread[i] != hot || nf_pkts[i] == 0 ||
+                            nf_pkts[i] >= gap)
+                                continue;
+                        if (best == MAX_NFS || nf_pkts[i] > nf_pkts[best])
+                                best = i;
+                }
+                /* A single NF carries the hot thread's load, moving it won't help */
+                if (best == MAX_NFS)
+                        break;
+
+                onvm_tx_balance_move_nf(best, cold);
+                thread_pkts[hot] -= nf_pkts[best];
+                thread_pkts[cold] += nf_pkts[best];
+                moves++;
+        }
+        if (moves == 0)
+                return;
+
+        for (t = 0, hot = 0; t < num_tx_threads; t++) {
+                if (thread_pkts[t] > thread_pkts[hot])
+                        hot = t;
+        }
+        RTE_LOG(INFO, APP, "Moved %u NFs between TX threads, busiest thread %u now ~%" PRIu64 " pps\n", moves, hot,
+                thread_pkts[hot] * rte_get_timer_hz() / elapsed_cycles);
+}
+
+/******************************Internal functions*****************************/
+
+static void
+onvm_tx_balance_move_nf(uint16_t instance_id, uint16_t tx_thread) {
+        if (tx_nf_target[instance_id] == tx_thread)
+                return;
+
+        tx_nf_target[instance_id] = tx_thread;
+        rte_smp_wmb();
+        rte_atomic32_inc(&tx_assign_gen);
+        /* The current owner does the handover, make sure it is awake to see it */
+        onvm_pkt_ring_tx_doorbell(&nfs[instance_id]);
+}
@@ -0,0 +1,125 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *            2010-2019 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************/
+
+
+/******************************************************************************
+
+                              onvm_tx_balance.h
+
+     This file contains the prototypes for spreading the NFs' TX rings over
+     the manager TX threads according to measured load.
+
+******************************************************************************/
+
+#ifndef _ONVM_TX_BALANCE_H_
+#define _ONVM_TX_BALANCE_H_
+
+#include "onvm_mgr/onvm_init.h"
+
+/***********************************Macros************************************/
+
+/* Rebalance while the busiest TX thread is this many percent above the mean */
+#define TX_REBALANCE_THRESHOLD_PCT 20
+/* Most NFs moved to another TX thread in one round */
+#define TX_REBALANCE_MAX_MOVES 4
+/* Rounds with fewer packets are too noisy to act on */
+#define TX_REBALANCE_MIN_PKTS 10000
+
+/*************************External global variables***************************/
+
+/* Bumped whenever an NF's TX thread is about to change or has changed */
+extern rte_atomic32_t tx_assign_gen;
+
+/* Packets dequeued from each NF's tx_q, only written by its current TX thread */
+extern struct tx_nf_load tx_nf_loads[MAX_NFS];
+
+/********************************Interfaces***********************************/
+
+/*
+ * Interface telling a TX thread whether NF ownership changed since it last
+ * built its list of tx_qs to drain.
+ *
+ * Input  : the TX thread's info
+ * Output : 1 if onvm_tx_balance_update_thread must run, 0 otherwise
+ *
+ */
+static inline int
+onvm_tx_balance_changed(const struct tx_thread_info *info) {
+        return (uint32_t)rte_atomic32_read(&tx_assign_gen) != info->assign_gen;
+}
+
+/*
+ * Interface to give every NF slot an initial TX thread. Must run before the
+ * TX threads start.
+ *
+ */
+void
+onvm_tx_balance_init(void);
+
+/*
+ * Interface called by a TX thread when onvm_tx_balance_changed says so, with
+ * its packet buffers flushed. Hands the NFs that were moved away over to
+ * their new thread and rebuilds the list of NFs it drains.
+ *
+ * Input : the TX thread's queue manager
+ *
+ */
+void
+onvm_tx_balance_update_thread(struct queue_mgr *tx_mgr);
+
+/*
+ * Interface to pick the least loaded TX thread for an NF that is starting.
+ *
+ * Input : the instance ID of the NF
+ *
+ */
+void
+onvm_tx_balance_assign_nf(uint16_t instance_id);
+
+/*
+ * Interface called periodically by the master thread. Once the rebalance
+ * period has passed, measures how many packets each TX thread dequeued and
+ * moves busy NFs off overloaded threads.
+ *
+ */
+void
+onvm_tx_balance_rebalance(void);
+
+#endif  // _ONVM_TX_BALANCE_H_
@@ -53,6 +53,7 @@
 #include <signal.h>
 #include <rte_ether.h>
 #include <rte_mbuf.h>
+#include <rte_spinlock.h>
 
 #include "onvm_config_common.h"
 #include "onvm_msg_common.h"
@@ -60,22 +61,52 @@
 #define ONVM_NF_HANDLE_TX 1                   // should be true if NFs primarily pass packets to each other
 #define ONVM_NF_SHUTDOWN_CORE_REASSIGNMENT 0  // should be true if on NF shutdown onvm_mgr tries to reallocate cores
 
-#define ONVM_MAX_CHAIN_LENGTH 4  // the maximum chain length
+#define ONVM_MAX_CHAIN_LENGTH 8  // the maximum chain length, entry 0 is reserved
+#define ONVM_MAX_BRANCHES 4      // most services one parallel chain step can send a packet to
+#define MAX_TAPS_PER_SERVICE 4   // most monitoring taps attached to one service
 #define MAX_NFS 128              // total number of concurrent NFs allowed (-1 because ID 0 is reserved)
 #define MAX_SERVICES 32          // total number of unique services allowed
 #define MAX_NFS_PER_SERVICE 32   // max number of NFs per service.
+#define SERVICE_DISPATCH_SIZE 1021  // entries in each service's consistent hash table, prime and >> MAX_NFS_PER_SERVICE
+#define SERVICE_DISPATCH_WAIT_US 1000  // longest the manager waits for readers of a dispatch table before deferring its update
+#define ONVM_SC_INTERN_MAX 4096      // distinct service chains the flow director's flows can point to
+#define ONVM_SC_INTERN_BUCKETS 1024  // hash buckets of the interned chains, a power of 2
 
 #define NUM_MBUFS 32767          // total number of mbufs (2^15 - 1)
 #define NF_QUEUE_RINGSIZE 16384  // size of queue for NFs
+#define NF_RX_CONGESTION_FRACTION 8  // rx_q is congested below 1/8 free, and clears again at 2/8 free
+#define NF_PRIO_QUEUE_RINGSIZE 1024  // size of the high priority RX queue for NFs
 
-#define PACKET_READ_SIZE ((uint16_t)32)
+#define PACKET_READ_SIZE ((uint16_t)32)      // default burst size of NFs and manager threads
+#define ONVM_MAX_BURST_SIZE ((uint16_t)256)  // largest burst size that can be set at runtime, sizes packet buffers
+#define ONVM_BULK_HANDLER_MAX_PKTS 32        // pkt_bulk_handler reports buffered packets in an int bitmap
+#define ONVM_BURST_BITMAP_WORDS (ONVM_MAX_BURST_SIZE / 64)
+#define ONVM_CYCLE_HIST_BUCKETS 16  // log2 buckets of the per batch handler cycle histogram of NFs
+#define ONVM_CYCLE_HIST_SHIFT 8     // the first bucket holds batches under 2^8 cycles, the last is open ended
 
 #define ONVM_NF_SHARE_CORES_DEFAULT 0  // default value for shared core logic, if true NFs sleep while waiting for packets
+#define ONVM_LOAD_AWARE_DISPATCH_DEFAULT 0  // if true new flows go to the less loaded of two instances of a service
+#define FLOW_AFFINITY_BUCKETS 256           // buckets of flows pinned per RX/TX thread or NF in load aware mode, power of 2
+#define FLOW_AFFINITY_WAYS 8                // flows pinned per bucket
+#define FLOW_AFFINITY_IDLE_MS 10000         // a pinned flow idle this long may give its entry to a new flow
+
+#define ONVM_ADAPTIVE_POLL_DEFAULT 0            // if true manager RX/TX threads sleep when idle instead of busy polling
+#define ADAPTIVE_POLL_IDLE_US_DEFAULT 100       // how long a manager thread must be idle before sleeping (us)
+#define ADAPTIVE_POLL_SPIN_BUDGET_DEFAULT 1024  // empty polls before a manager thread starts timing its idle period
+#define ADAPTIVE_POLL_MAX_SLEEP_MS 10           // longest single sleep, bounds how long shutdown can take
+
+#define FLUSH_DEADLINE_US_DEFAULT 0  // if set, buffered packets wait until a burst fills or the oldest is this old (us)
+
+#define ONVM_FLOW_DIR_ENTRIES_DEFAULT 1024   // initial size of the flow director, it grows as flows are added
+#define ONVM_FLOW_DIR_MAX_ENTRIES (1 << 24)  // the flow director doubles in size until it holds this many flows
+
+#define TRACE_SAMPLE_DEFAULT 0  // if set, RX threads trace the latency of 1 in this many packets along their chain
 
 #define ONVM_NF_ACTION_DROP 0  // drop packet
 #define ONVM_NF_ACTION_NEXT 1  // to whatever the next action is configured by the SDN controller in the flow table
 #define ONVM_NF_ACTION_TONF 2  // send to the NF specified in the argument field (assume it is on the same host)
 #define ONVM_NF_ACTION_OUT  3  // send the packet out the NIC port set in the argument field
+#define ONVM_NF_ACTION_PARALLEL 4  // chain steps only: send the packet to all branch services of the step, then merge
 
 #define PKT_WAKEUP_THRESHOLD 1 // for shared core mode, how many packets are required to wake up the NF
 #define MSG_WAKEUP_THRESHOLD 1 // for shared core mode, how many messages on an NF's ring are required to wake up the NF
@@ -83,9 +114,26 @@
 /* Used in setting bit flags for core options */
 #define MANUAL_CORE_ASSIGNMENT_BIT 0
 #define SHARE_CORE_BIT 1
+/* NF asks for a NIC TX queue of its own to send packets out directly */
+#define NIC_TX_QUEUE_BIT 2
+/* NF runs in the thread of another NF on its core, see onvm_nflib_fuse */
+#define FUSED_NF_BIT 3
+
+/* Bit of onvm_pkt_meta flags marking packets whose hops are timestamped, set
+ * by the manager RX threads for a sample of packets, see onvm_trace.h */
+#define ONVM_PKT_TRACE_BIT 2
+/* Bit of onvm_pkt_meta flags marking a clone sent down a parallel branch of
+ * a service chain, see onvm_pkt_join_branch */
+#define ONVM_PKT_BRANCH_BIT 3
+/* Bit of onvm_pkt_meta flags marking high priority packets, set by the manager
+ * from the packet's service chain. NFs keep their own bits above it */
+#define ONVM_PKT_PRIO_BIT 4
 
 #define ONVM_SIGNAL_TERMINATION -999
 
+/* Most NFs that can be fused into the thread of one leader NF */
+#define ONVM_MAX_FUSED_NFS 4
+
 /* Maximum length of NF_TAG including the \0 */
 #define TAG_SIZE 15
 
@@ -118,12 +166,102 @@ onvm_get_pkt_meta(struct rte_mbuf *pkt) {
         return (struct onvm_pkt_meta *)&pkt->udata64;
 }
 
+/*
+ * Headers of a packet parsed once by the manager RX threads, kept in the mbuf
+ * private area so that NFs down the chain read them instead of parsing them
+ * again. Offsets are from the start of the packet data, addresses and ports
+ * are in network order, and the ports are 0 unless the packet is TCP or UDP.
+ * hash is the packet's symmetric RSS hash, from the NIC or computed in
+ * software.
+ */
+struct onvm_pkt_hdr_cache {
+        uint8_t flags;
+        uint8_t proto;
+        uint16_t l3_off;
+        uint16_t l4_off;
+        uint16_t payload_off;
+        uint32_t src_addr;
+        uint32_t dst_addr;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint32_t hash;
+};
+
+#define ONVM_PKT_HDR_VALID 0x1  // the cache was filled since the packet was received
+#define ONVM_PKT_HDR_IPV4 0x2   // the packet is IPv4, proto and the addresses are set
+#define ONVM_PKT_HDR_HASH 0x4   // hash is set
+
+/* Size of the mbuf private area of the manager's packet pool */
+#define ONVM_MBUF_PRIV_SIZE RTE_ALIGN(sizeof(struct onvm_pkt_hdr_cache), RTE_MBUF_PRIV_ALIGN)
+
+/* The header cache area of a packet, shared with the mbuf it was cloned
+ * from, or NULL if its pool has no private area for it. */
+static inline struct onvm_pkt_hdr_cache *
+onvm_pkt_hdr_cache_area(struct rte_mbuf *pkt) {
+        struct rte_mbuf *direct = RTE_MBUF_INDIRECT(pkt) ? rte_mbuf_from_indirect(pkt) : pkt;
+
+        if (unlikely(direct->priv_size < sizeof(struct onvm_pkt_hdr_cache)))
+                return NULL;
+        return (struct onvm_pkt_hdr_cache *)RTE_PTR_ADD(direct, sizeof(struct rte_mbuf));
+}
+
+/*
+ * The parsed headers of a packet, or NULL if they have to be parsed. The
+ * manager sets l2_len along with the cache, and rte_pktmbuf_alloc clears it,
+ * so a recycled mbuf never shows the headers of the packet it last held.
+ */
+static inline struct onvm_pkt_hdr_cache *
+onvm_pkt_hdr_cache(struct rte_mbuf *pkt) {
+        struct onvm_pkt_hdr_cache *cache;
+
+        if (pkt->l2_len == 0)
+                return NULL;
+        cache = onvm_pkt_hdr_cache_area(pkt);
+        if (cache == NULL || !(cache->flags & ONVM_PKT_HDR_VALID))
+                return NULL;
+        return cache;
+}
+
+/*
+ * Merge state of a packet sent down parallel branches. While its clones are
+ * out, the original mbuf keeps this in place of its onvm_pkt_meta.
+ */
+struct onvm_pkt_join {
+        rte_atomic16_t pending; /* branches that did not return the packet yet */
+        rte_atomic16_t drop;    /* set once any branch dropped it */
+};
+
 static inline uint8_t
 onvm_get_pkt_chain_index(struct rte_mbuf *pkt) {
         struct onvm_pkt_meta* pkt_meta = (struct onvm_pkt_meta*) &pkt->udata64;
         return pkt_meta->chain_index;
 }
 
+/*
+ * RX queue class of a packet: high priority packets go to an NF's rx_q_hi,
+ * everything else to its rx_q
+ */
+enum onvm_rx_prio {
+        ONVM_RX_PRIO_LOW = 0,
+        ONVM_RX_PRIO_HIGH,
+        ONVM_RX_PRIOS
+};
+
+static inline uint8_t
+onvm_get_pkt_prio(struct rte_mbuf *pkt) {
+        return ONVM_CHECK_BIT(onvm_get_pkt_meta(pkt)->flags, ONVM_PKT_PRIO_BIT) ? ONVM_RX_PRIO_HIGH : ONVM_RX_PRIO_LOW;
+}
+
+static inline void
+onvm_set_pkt_prio(struct rte_mbuf *pkt, uint8_t prio) {
+        struct onvm_pkt_meta *pkt_meta = onvm_get_pkt_meta(pkt);
+
+        if (prio == ONVM_RX_PRIO_HIGH)
+                pkt_meta->flags = ONVM_SET_BIT(pkt_meta->flags, ONVM_PKT_PRIO_BIT);
+        else
+                pkt_meta->flags &= ~(1 << ONVM_PKT_PRIO_BIT);
+}
+
 /*
  * Shared port info, including statistics information for display by server.
  * Structure will be put in a memzone.
@@ -143,8 +281,10 @@ onvm_get_pkt_chain_index(struct rte_mbuf *pkt) {
  * tx threads.
  */
 struct tx_thread_info {
-        unsigned first_nf;
-        unsigned last_nf;
+        /* NFs whose tx_q this thread drains, rebuilt when tx_assign_gen changes */
+        uint16_t num_nfs;
+        uint16_t nfs[MAX_NFS];
+        uint32_t assign_gen;
         struct packet_buf *port_tx_bufs;
 };
 
@@ -153,8 +293,78 @@ struct tx_thread_info {
  * NFs or to the NIC
  */
 struct packet_buf {
-        struct rte_mbuf *buffer[PACKET_READ_SIZE];
+        struct rte_mbuf *buffer[ONVM_MAX_BURST_SIZE];
         uint16_t count;
+        /* Set while this buffer is on its queue_mgr dirty list */
+        uint8_t dirty;
+        /* When the oldest packet was buffered, only kept with a flush deadline */
+        uint64_t first_tsc;
+};
+
+/*
+ * Why a packet buffer was sent on to its NF or port
+ */
+enum onvm_flush_reason {
+        ONVM_FLUSH_FULL = 0,  // it held a full burst
+        ONVM_FLUSH_DEADLINE,  // its oldest packet reached the flush deadline
+        ONVM_FLUSH_LOOP,      // end of a poll loop, without a flush deadline
+        ONVM_FLUSH_IDLE,      // the thread is about to sleep
+        ONVM_FLUSH_REASONS
+};
+
+/* Flushes and the packets they sent, per reason */
+struct onvm_flush_stats {
+        volatile uint64_t flushes[ONVM_FLUSH_REASONS];
+        volatile uint64_t pkts[ONVM_FLUSH_REASONS];
+};
+
+/*
+ * TSC cycles an NF spent in its packet handler, in the rest of the poll loops
+ * that handled packets, which hand on and flush them (tx), and in poll loops
+ * that found nothing (idle).
+ * batch_hist counts handler calls by their cycles, bucket b > 0 holds calls
+ * of 2^(b + ONVM_CYCLE_HIST_SHIFT - 1) up to twice that many cycles.
+ */
+struct onvm_nf_cycle_stats {
+        volatile uint64_t handler;
+        volatile uint64_t tx;
+        volatile uint64_t idle;
+        volatile uint64_t pkts;
+        volatile uint64_t batches;
+        volatile uint64_t batch_hist[ONVM_CYCLE_HIST_BUCKETS];
+};
+
+static inline unsigned
+onvm_cycle_hist_bucket(uint64_t cycles) {
+        unsigned bits;
+
+        if (cycles >> ONVM_CYCLE_HIST_SHIFT == 0)
+                return 0;
+        bits = 64 - __builtin_clzll(cycles) - ONVM_CYCLE_HIST_SHIFT;
+        return bits < ONVM_CYCLE_HIST_BUCKETS ? bits : ONVM_CYCLE_HIST_BUCKETS - 1;
+}
+
+/*
+ * Flow to instance pinning used by load aware dispatch, matched on the RSS
+ * hash and service. Flows sharing an RSS hash also share their consistent
+ * hash slot, so pinning them together moves none of them.
+ * instance_id 0 marks an empty entry.
+ */
+struct flow_affinity_entry {
+        uint32_t rss;
+        uint16_t service_id;
+        uint16_t instance_id;
+        uint64_t last_seen;
+};
+
+/*
+ * Live entries are never evicted. A new flow finding all of a bucket's
+ * entries live is not pinned and goes to its consistent hash instance.
+ */
+struct flow_affinity_bucket {
+        struct flow_affinity_entry entries[FLOW_AFFINITY_WAYS];
+        /* When a flow last found the bucket full */
+        uint64_t overflow_tsc;
 };
 
 /*
@@ -169,6 +379,80 @@ struct queue_mgr {
                 struct packet_buf *to_tx_buf;
         };
         struct packet_buf *nf_rx_bufs;
+        /* Per port buffers of an NF with its own NIC TX queue, NULL otherwise */
+        struct packet_buf *nic_tx_bufs;
+        uint16_t nic_tx_queue;
+        /* Packets per burst, buffers are flushed once they hold this many */
+        uint16_t burst_size;
+        /* Oldest a buffered packet may get before its buffer is sent, 0 flushes every loop */
+        uint64_t flush_deadline_cycles;
+        struct onvm_flush_stats *flush_stats;
+        /* Instance IDs whose nf_rx_bufs hold packets, so flushes skip idle NFs */
+        uint16_t nf_rx_dirty[MAX_NFS];
+        uint16_t nf_rx_dirty_count;
+        /* Packets this thread sent to tapped services, drives tap sampling */
+        uint32_t tap_seq;
+        /* Packets this RX thread received since it last traced one */
+        uint32_t trace_seq;
+        /* Flows pinned to an instance by this thread, only used in load aware dispatch mode */
+        struct flow_affinity_bucket flow_affinity[FLOW_AFFINITY_BUCKETS];
+};
+
+/*
+ * Consistent hash table mapping a packet's RSS hash to an instance of a
+ * service. Built by the manager with Maglev style permutations so adding or
+ * removing an instance only remaps about 1/N of the flows.
+ */
+struct service_dispatch_table {
+        uint16_t num_nfs;
+        uint16_t entries[SERVICE_DISPATCH_SIZE];
+};
+
+/*
+ * Two tables per service. The manager rebuilds the inactive one and then
+ * flips active, so readers never take a lock or see a half built table.
+ * The inactive table is only rebuilt once every reader passed a quiescent
+ * point in flip_gen or later, see struct onvm_quiesce_info.
+ */
+struct service_dispatch {
+        volatile uint16_t active;
+        /* Quiescence generation of the last flip */
+        uint32_t flip_gen;
+        /* An update had to wait for readers, the master thread retries it */
+        uint8_t pending;
+        struct service_dispatch_table tables[2];
+};
+
+/* Value of a reader's gen while it holds no shared pointers, e.g. asleep */
+#define ONVM_QUIESCE_OFFLINE UINT32_MAX
+
+/*
+ * Quiescent state tracking for data the manager replaces while NFs and
+ * manager threads read it without locks, like the dispatch tables. Readers
+ * note gen at the top of their loop, when they hold no pointers into such
+ * data. The manager bumps gen after replacing data, and reuses what it
+ * replaced once every reader noted that gen or later.
+ */
+struct onvm_quiesce_info {
+        volatile uint32_t gen;
+        volatile uint32_t nf_gen[MAX_NFS];
+        volatile uint32_t mgr_gen[RTE_MAX_LCORE];
+        uint8_t mgr_reader[RTE_MAX_LCORE];
+};
+
+/*
+ * Monitoring NFs attached to a service. They get a clone of 1 in sample
+ * packets sent to the service, if their RX ring has room. The manager
+ * fills a slot before bumping count, so readers never see an empty one.
+ */
+struct onvm_service_tap {
+        uint16_t instance_id;
+        uint16_t sample;
+};
+
+struct onvm_service_taps {
+        volatile uint16_t count;
+        struct onvm_service_tap taps[MAX_TAPS_PER_SERVICE];
 };
 
 /* NFs wakeup Info: used by manager to update NFs pool and wakeup stats */
@@ -201,12 +485,40 @@ struct port_info {
         struct ether_addr mac[RTE_MAX_ETHPORTS];
         volatile struct rx_stats rx_stats;
         volatile struct tx_stats tx_stats;
+        /* TX queues nf_tx_queue_base and up on every port are handed out to NFs */
+        uint16_t nf_tx_queue_base;
+        uint16_t num_nf_tx_queues;
 };
 
 struct onvm_configuration {
         struct {
                 uint8_t ONVM_NF_SHARE_CORES;
+                uint8_t ONVM_LOAD_AWARE_DISPATCH;
+                uint8_t ONVM_ADAPTIVE_POLL;
+                /* Packets are stamped when put on an NF's RX rings, to show how long they waited there */
+                uint8_t ONVM_RX_DELAY_STATS;
         } flags;
+        uint32_t adaptive_poll_idle_us;
+        uint32_t adaptive_poll_spin_budget;
+        uint32_t flush_deadline_us;
+        /* Burst size of the manager RX/TX threads */
+        uint16_t burst_size;
+        /* Initial number of flows in the flow director */
+        uint32_t flow_dir_entries;
+        /* RX threads trace 1 in trace_sample packets, 0 traces none */
+        uint32_t trace_sample;
+};
+
+/*
+ * Doorbells used by NFs to wake manager TX threads that went to sleep in
+ * adaptive polling mode. tx_thread[i] is the TX thread draining NF i's tx_q
+ * (the manager moves NFs between TX threads as their load changes),
+ * ring_tsc is when the doorbell was last rung, to measure wakeup latency.
+ */
+struct tx_doorbell_info {
+        rte_atomic16_t sleeping[RTE_MAX_LCORE];
+        volatile uint64_t ring_tsc[RTE_MAX_LCORE];
+        uint16_t tx_thread[MAX_NFS];
 };
 
 struct core_status {
@@ -223,6 +535,10 @@ typedef int (*nf_pkt_handler_fn)(struct rte_mbuf *pkt, struct onvm_pkt_meta *met
 /* Function prototype for NF packet handlers for bulk processing */
 typedef int (*nf_pkt_handler_bulk_fn)(struct rte_mbuf **pkt, uint16_t nb_pkts, // pkt_handler retrieves the meta manually
                                  __attribute__((unused)) struct onvm_nf_local_ctx *nf_local_ctx);
+/* Function prototype for NF packet handlers for bursts of up to ONVM_MAX_BURST_SIZE packets, the handler sets
+ * bit i of buffered (ONVM_BURST_BITMAP_WORDS words, cleared by the caller) for packets it keeps */
+typedef void (*nf_pkt_handler_burst_fn)(struct rte_mbuf **pkts, uint16_t nb_pkts, uint64_t *buffered,
+                                        struct onvm_nf_local_ctx *nf_local_ctx);
 /* Function prototype for NF the callback */
 typedef int (*nf_user_actions_fn)(__attribute__((unused)) struct onvm_nf_local_ctx *nf_local_ctx);
 /* Function prototype for NFs that want extra initalization/setup before running */
@@ -239,6 +555,7 @@ struct onvm_nf_function_table {
         nf_user_actions_fn user_actions;
         nf_pkt_handler_fn  pkt_handler;
         nf_pkt_handler_bulk_fn  pkt_bulk_handler;
+        nf_pkt_handler_burst_fn  pkt_burst_handler;
 };
 
 /* Information needed to initialize a new NF child thread */
@@ -254,6 +571,9 @@ struct onvm_nf_local_ctx {
         rte_atomic16_t nf_init_finished;
         rte_atomic16_t keep_running;
         rte_atomic16_t nf_stopped;
+        /* NFs run to completion in this NF's thread, in chain order */
+        uint16_t num_fused;
+        struct onvm_nf_local_ctx *fused[ONVM_MAX_FUSED_NFS];
 };
 
 /*
@@ -264,8 +584,16 @@ struct onvm_nf_local_ctx {
  */
 struct onvm_nf {
         struct rte_ring *rx_q;
+        /* High priority packets, dequeued ahead of rx_q, see flags.rx_hi_weight */
+        struct rte_ring *rx_q_hi;
         struct rte_ring *tx_q;
         struct rte_ring *msg_q;
+        /* Set by senders while rx_q is (nearly) full, see onvm_nflib_nf_is_congested */
+        volatile uint8_t rx_congested;
+        /* Set by the manager once the NF left its service, it stops when its rx_q is empty */
+        volatile uint8_t draining;
+        /* NIC TX queue this NF sends on directly on every port, 0 if a TX thread sends for it */
+        uint16_t nic_tx_queue;
         /* Struct for NF to NF communication (NF tx) */
         struct queue_mgr *nf_tx_mgr;
         uint16_t instance_id;
@@ -280,6 +608,8 @@ struct onvm_nf {
                 /* Instance ID of parent NF or 0 */
                 uint16_t parent;
                 rte_atomic16_t children_cnt;
+                /* Percent of the last measurement the NF was busy, set by the manager */
+                uint16_t load;
         } thread_info;
 
         struct {
@@ -288,6 +618,16 @@ struct onvm_nf {
                 uint16_t time_to_live;
                 /* If set NF will stop after pkts TX reach pkt_limit */
                 uint16_t pkt_limit;
+                /* High priority packets dequeued per low priority one, 0 for strict priority */
+                uint16_t rx_hi_weight;
+                /* Packets dequeued and handled per burst */
+                uint16_t burst_size;
+                /* Service this NF taps, 0 if it is not a tap */
+                uint16_t tap_service;
+                /* A tap gets 1 in tap_sample packets */
+                uint16_t tap_sample;
+                /* Children the manager may scale this NF out to, 0 if it does not autoscale */
+                uint16_t autoscale_max;
         } flags;
 
         /* NF specific functions */
@@ -313,6 +653,15 @@ struct onvm_nf {
                 volatile uint64_t act_drop;
                 volatile uint64_t act_next;
                 volatile uint64_t act_buffer;
+                struct onvm_flush_stats flush;
+                struct onvm_nf_cycle_stats cycles;
+                /* Per RX queue class, delay is the time packets spent in the ring */
+                struct {
+                        volatile uint64_t rx;
+                        volatile uint64_t rx_drop;
+                        volatile uint64_t dequeued;
+                        volatile uint64_t delay_cycles;
+                } rx_prio[ONVM_RX_PRIOS];
         } stats;
 
         struct {
@@ -341,6 +690,16 @@ struct onvm_nf_init_cfg {
         uint16_t time_to_live;
         /* If set NF will stop after pkts TX reach pkt_limit */
         uint16_t pkt_limit;
+        /* High priority packets dequeued per low priority one, 0 for strict priority */
+        uint16_t rx_hi_weight;
+        /* Packets dequeued and handled per burst */
+        uint16_t burst_size;
+        /* Service to tap instead of joining chains, 0 for none */
+        uint16_t tap_service;
+        /* A tap gets 1 in tap_sample packets */
+        uint16_t tap_sample;
+        /* Children the manager may scale this NF out to, 0 to not autoscale */
+        uint16_t autoscale_max;
 };
 
 /*
@@ -354,7 +713,28 @@ struct onvm_service_chain_entry {
 struct onvm_service_chain {
         struct onvm_service_chain_entry sc[ONVM_MAX_CHAIN_LENGTH];
         uint8_t chain_length;
+        /* RX queue class of packets on this chain, see enum onvm_rx_prio */
+        uint8_t rx_prio;
         int ref_cnt;
+        /* Services of each ONVM_NF_ACTION_PARALLEL step, whose destination is their count */
+        uint16_t branches[ONVM_MAX_CHAIN_LENGTH][ONVM_MAX_BRANCHES];
+};
+
+/*
+ * Shared copies of the service chains of flow director entries, so that
+ * flows on the same path point to one reference counted chain instead of
+ * each owning one. Chains are found by content through buckets and linked
+ * by next, both holding index + 1 so that 0 ends a list. Released chains go
+ * on the free list, new ones are taken from there or past used.
+ */
+struct onvm_sc_intern_table {
+        rte_spinlock_t lock;
+        uint16_t used;
+        uint16_t count;
+        uint16_t free_list;
+        uint16_t buckets[ONVM_SC_INTERN_BUCKETS];
+        uint16_t next[ONVM_SC_INTERN_MAX];
+        struct onvm_service_chain chains[ONVM_SC_INTERN_MAX];
 };
 
 struct lpm_request {
@@ -367,6 +747,7 @@ struct lpm_request {
 
 /* define common names for structures shared between server and NF */
 #define MP_NF_RXQ_NAME "MProc_Client_%u_RX"
+#define MP_NF_RXQ_HI_NAME "MProc_Client_%u_RX_HI"
 #define MP_NF_TXQ_NAME "MProc_Client_%u_TX"
 #define MP_CLIENT_SEM_NAME "MProc_Client_%u_SEM"
 #define PKTMBUF_POOL_NAME "MProc_pktmbuf_pool"
@@ -375,9 +756,16 @@ struct lpm_request {
 #define MZ_NF_INFO "MProc_nf_init_cfg"
 #define MZ_SERVICES_INFO "MProc_services_info"
 #define MZ_NF_PER_SERVICE_INFO "MProc_nf_per_service_info"
+#define MZ_SERVICE_DISPATCH_INFO "MProc_service_dispatch_info"
+#define MZ_QUIESCE_INFO "MProc_quiesce_info"
+#define MZ_SERVICE_TAPS_INFO "MProc_service_taps_info"
+#define MZ_TX_DOORBELL_INFO "MProc_tx_doorbell_info"
+#define MP_TX_THREAD_SEM_NAME "MProc_TX_%u_SEM"
 #define MZ_ONVM_CONFIG "MProc_onvm_config"
 #define MZ_SCP_INFO "MProc_scp_info"
 #define MZ_FTP_INFO "MProc_ftp_info"
+#define MZ_SC_INTERN_INFO "MProc_sc_intern_info"
+#define MZ_FLOW_ACL_INFO "MProc_flow_acl_info"
 
 #define _MGR_MSG_QUEUE_NAME "MSG_MSG_QUEUE"
 #define _NF_MSG_QUEUE_NAME "NF_%u_MSG_QUEUE"
@@ -421,6 +809,19 @@ get_rx_queue_name(unsigned id) {
         return buffer;
 }
 
+/*
+ * Given the high priority rx queue name template above, get the queue name
+ */
+static inline const char *
+get_rx_hi_queue_name(unsigned id) {
+        /* buffer for return value. Size calculated by %u being replaced
+         * by maximum 3 digits (plus an extra byte for safety) */
+        static char buffer[sizeof(MP_NF_RXQ_HI_NAME) + 2];
+
+        snprintf(buffer, sizeof(buffer) - 1, MP_NF_RXQ_HI_NAME, id);
+        return buffer;
+}
+
 /*
  * Given the tx queue name template above, get the queue name
  */
@@ -447,6 +848,19 @@ get_msg_queue_name(unsigned id) {
         return buffer;
 }
 
+/*
+ * Set and test bit i of a burst bitmap of ONVM_BURST_BITMAP_WORDS words, one bit per packet.
+ */
+static inline void
+onvm_burst_bitmap_set(uint64_t *bitmap, uint16_t i) {
+        bitmap[i / 64] |= 1ULL << (i % 64);
+}
+
+static inline int
+onvm_burst_bitmap_test(const uint64_t *bitmap, uint16_t i) {
+        return !!(bitmap[i / 64] & (1ULL << (i % 64)));
+}
+
 /*
  * Interface checking if a given NF is "valid", meaning if it's running.
  */
@@ -476,9 +890,21 @@ get_sem_name(unsigned id) {
         return buffer;
 }
 
+/*
+ * Given the TX thread sem name template above, get the sem name
+ */
+static inline const char *
+get_tx_thread_sem_name(unsigned id) {
+        static char buffer[sizeof(MP_TX_THREAD_SEM_NAME) + 2];
+
+        snprintf(buffer, sizeof(buffer) - 1, MP_TX_THREAD_SEM_NAME, id);
+        return buffer;
+}
+
 static inline int
 whether_wakeup_client(struct onvm_nf *nf, struct nf_wakeup_info *nf_wakeup_info) {
-        if (rte_ring_count(nf->rx_q) < PKT_WAKEUP_THRESHOLD && rte_ring_count(nf->msg_q) < MSG_WAKEUP_THRESHOLD)
+        if (rte_ring_count(nf->rx_q) < PKT_WAKEUP_THRESHOLD && rte_ring_count(nf->rx_q_hi) == 0 &&
+            rte_ring_count(nf->msg_q) < MSG_WAKEUP_THRESHOLD)
                 return 0;
 
         /* Check if its already woken up */
@@ -0,0 +1,453 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * onvm_flow_acl.c - wildcard flow classifier APIs
+ ********************************************************************/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <rte_malloc.h>
+#include <rte_memzone.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "onvm_flow_acl.h"
+#include "onvm_pkt_helper.h"
+#include "onvm_sc_common.h"
+#include "onvm_sc_mgr.h"
+
+#define NO_FLAGS 0
+#define ACL_RULE_LINE_MAX 256
+
+/* The classifier reads the IPv4 header from the protocol field onwards, and
+ * the ports right after a header without options. */
+enum {
+        ACL_FIELD_PROTO,
+        ACL_FIELD_SRC_ADDR,
+        ACL_FIELD_DST_ADDR,
+        ACL_FIELD_SRC_PORT,
+        ACL_FIELD_DST_PORT,
+        ACL_NUM_FIELDS
+};
+
+RTE_ACL_RULE_DEF(onvm_acl_rule, ACL_NUM_FIELDS);
+
+static const struct rte_acl_field_def acl_field_defs[ACL_NUM_FIELDS] = {
+    {
+        .type = RTE_ACL_FIELD_TYPE_BITMASK,
+        .size = sizeof(uint8_t),
+        .field_index = ACL_FIELD_PROTO,
+        .input_index = 0,
+        .offset = 0,
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_MASK,
+        .size = sizeof(uint32_t),
+        .field_index = ACL_FIELD_SRC_ADDR,
+        .input_index = 1,
+        .offset = offsetof(struct ipv4_hdr, src_addr) - offsetof(struct ipv4_hdr, next_proto_id),
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_MASK,
+        .size = sizeof(uint32_t),
+        .field_index = ACL_FIELD_DST_ADDR,
+        .input_index = 2,
+        .offset = offsetof(struct ipv4_hdr, dst_addr) - offsetof(struct ipv4_hdr, next_proto_id),
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_RANGE,
+        .size = sizeof(uint16_t),
+        .field_index = ACL_FIELD_SRC_PORT,
+        .input_index = 3,
+        .offset = sizeof(struct ipv4_hdr) - offsetof(struct ipv4_hdr, next_proto_id),
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_RANGE,
+        .size = sizeof(uint16_t),
+        .field_index = ACL_FIELD_DST_PORT,
+        .input_index = 3,
+        .offset = sizeof(struct ipv4_hdr) - offsetof(struct ipv4_hdr, next_proto_id) + sizeof(uint16_t),
+    },
+};
+
+struct onvm_flow_acl *flow_acl;
+
+static int
+onvm_flow_acl_parse_prefix(const char *str, struct rte_acl_field *field);
+static int
+onvm_flow_acl_parse_range(const char *str, struct rte_acl_field *field);
+static int
+onvm_flow_acl_parse_proto(const char *str, struct rte_acl_field *field);
+static int
+onvm_flow_acl_parse_parallel(char *str, struct onvm_service_chain *chain);
+static int
+onvm_flow_acl_parse_chain(char *str, struct onvm_service_chain *chain);
+static int
+onvm_flow_acl_parse_rule(char *line, struct onvm_acl_rule *rule, struct onvm_service_chain *chain);
+static int
+onvm_flow_acl_load(const char *rules_file);
+
+int
+onvm_flow_acl_init(const char *rules_file) {
+        const struct rte_memzone *mz_acl;
+
+        mz_acl = rte_memzone_reserve(MZ_FLOW_ACL_INFO, sizeof(struct onvm_flow_acl), rte_socket_id(), NO_FLAGS);
+        if (mz_acl == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for flow classifier\n");
+        }
+        memset(mz_acl->addr, 0, sizeof(struct onvm_flow_acl));
+        flow_acl = mz_acl->addr;
+
+        if (rules_file == NULL)
+                return 0;
+
+        return onvm_flow_acl_load(rules_file);
+}
+
+int
+onvm_flow_acl_nf_init(void) {
+        const struct rte_memzone *mz_acl;
+
+        /* Older managers have no classifier, everything goes to the exact match table */
+        mz_acl = rte_memzone_lookup(MZ_FLOW_ACL_INFO);
+        flow_acl = mz_acl != NULL ? mz_acl->addr : NULL;
+
+        return 0;
+}
+
+int
+onvm_flow_acl_classify(struct rte_mbuf **pkts, uint16_t count, struct onvm_flow_entry **flow_entries) {
+        const uint8_t *data[PACKET_READ_SIZE];
+        uint32_t results[PACKET_READ_SIZE];
+        uint16_t pkt_index[PACKET_READ_SIZE];
+        struct ipv4_hdr *ipv4_hdr;
+        uint16_t start, i, num;
+        int hits = 0;
+
+        if (flow_acl == NULL || flow_acl->ctx == NULL)
+                return 0;
+
+        for (start = 0; start < count; start += PACKET_READ_SIZE) {
+                num = 0;
+                for (i = start; i < count && i < start + PACKET_READ_SIZE; i++) {
+                        if (flow_entries[i] != NULL || !onvm_pkt_is_ipv4(pkts[i]))
+                                continue;
+                        ipv4_hdr = onvm_pkt_ipv4_hdr(pkts[i]);
+                        /* The port fields are at a fixed offset, so headers with options are not classified */
+                        if ((ipv4_hdr->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER !=
+                            sizeof(struct ipv4_hdr))
+                                continue;
+                        data[num] = &ipv4_hdr->next_proto_id;
+                        pkt_index[num++] = i;
+                }
+                if (num == 0)
+                        continue;
+
+                rte_acl_classify(flow_acl->ctx, data, results, num, 1);
+                for (i = 0; i < num; i++) {
+                        if (results[i] == 0)
+                                continue;
+                        flow_entries[pkt_index[i]] = &flow_acl->entries[results[i] - 1];
+                        hits++;
+                }
+        }
+
+        return hits;
+}
+
+/* Loads every rule of rules_file and builds the classifier. Rule i gets
+ * userdata i + 1, as rte_acl reports no match with 0. */
+static int
+onvm_flow_acl_load(const char *rules_file) {
+        struct rte_acl_param param;
+        struct rte_acl_config cfg;
+        struct onvm_acl_rule rule;
+        struct onvm_service_chain *chain;
+        char line[ACL_RULE_LINE_MAX];
+        char *start;
+        unsigned line_num = 0;
+        FILE *f;
+        int ret;
+
+        f = fopen(rules_file, "r");
+        if (f == NULL) {
+                RTE_LOG(ERR, APP, "Cannot open flow classifier rules %s: %s\n", rules_file, strerror(errno));
+                return -1;
+        }
+
+        memset(&param, 0, sizeof(param));
+        param.name = ONVM_FLOW_ACL_NAME;
+        param.socket_id = rte_socket_id();
+        param.rule_size = RTE_ACL_RULE_SZ(ACL_NUM_FIELDS);
+        param.max_rule_num = ONVM_FLOW_ACL_MAX_RULES;
+        flow_acl->ctx = rte_acl_create(&param);
+        if (flow_acl->ctx == NULL) {
+                RTE_LOG(ERR, APP, "Cannot create flow classifier: %s\n", rte_strerror(rte_errno));
+                fclose(f);
+                return -1;
+        }
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+                line_num++;
+                for (start = line; *start == ' ' || *start == '\t'; start++)
+                        ;
+                if (*start == '#' || *start == '\n' || *start == '\0')
+                        continue;
+
+                if (flow_acl->num_rules == ONVM_FLOW_ACL_MAX_RULES) {
+                        RTE_LOG(ERR, APP, "Flow classifier rules %s: more than %u rules\n", rules_file,
+                                ONVM_FLOW_ACL_MAX_RULES);
+                        goto fail;
+                }
+                chain = onvm_sc_create();
+                if (onvm_flow_acl_parse_rule(start, &rule, chain) != 0) {
+                        RTE_LOG(ERR, APP, "Flow classifier rules %s: bad rule on line %u\n", rules_file, line_num);
+                        rte_free(chain);
+                        goto fail;
+                }
+                rule.data.category_mask = 1;
+                rule.data.priority = RTE_ACL_MAX_PRIORITY - flow_acl->num_rules;
+                rule.data.userdata = flow_acl->num_rules + 1;
+                ret = rte_acl_add_rules(flow_acl->ctx, (struct rte_acl_rule *)&rule, 1);
+                if (ret != 0) {
+                        RTE_LOG(ERR, APP, "Flow classifier rules %s: cannot add line %u (%d)\n", rules_file, line_num,
+                                ret);
+                        rte_free(chain);
+                        goto fail;
+                }
+                flow_acl->entries[flow_acl->num_rules].sc = chain;
+                flow_acl->num_rules++;
+        }
+        fclose(f);
+
+        if (flow_acl->num_rules == 0) {
+                rte_acl_free(flow_acl->ctx);
+                flow_acl->ctx = NULL;
+                return 0;
+        }
+
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.num_categories = 1;
+        cfg.num_fields = ACL_NUM_FIELDS;
+        memcpy(cfg.defs, acl_field_defs, sizeof(acl_field_defs));
+        ret = rte_acl_build(flow_acl->ctx, &cfg);
+        if (ret != 0) {
+                RTE_LOG(ERR, APP, "Cannot build flow classifier (%d)\n", ret);
+                goto free_rules;
+        }
+        RTE_LOG(INFO, APP, "Flow classifier: %u wildcard rules loaded from %s\n", flow_acl->num_rules, rules_file);
+
+        return 0;
+
+fail:
+        fclose(f);
+free_rules:
+        /* Leave no half loaded classifier for onvm_flow_acl_classify to use */
+        for (; flow_acl->num_rules > 0; flow_acl->num_rules--) {
+                rte_free(flow_acl->entries[flow_acl->num_rules - 1].sc);
+                flow_acl->entries[flow_acl->num_rules - 1].sc = NULL;
+        }
+        rte_acl_free(flow_acl->ctx);
+        flow_acl->ctx = NULL;
+        return -1;
+}
+
+static int
+onvm_flow_acl_parse_rule(char *line, struct onvm_acl_rule *rule, struct onvm_service_chain *chain) {
+        char *fields[ACL_NUM_FIELDS + 1];
+        char *save = NULL;
+        int i;
+
+        for (i = 0; i < ACL_NUM_FIELDS + 1; i++) {
+                fields[i] = strtok_r(i == 0 ? line : NULL, " \t\r\n", &save);
+                if (fields[i] == NULL)
+                        return -1;
+        }
+        if (strtok_r(NULL, " \t\r\n", &save) != NULL)
+                return -1;
+
+        memset(rule, 0, sizeof(*rule));
+        if (onvm_flow_acl_parse_prefix(fields[0], &rule->field[ACL_FIELD_SRC_ADDR]) != 0 ||
+            onvm_flow_acl_parse_prefix(fields[1], &rule->field[ACL_FIELD_DST_ADDR]) != 0 ||
+            onvm_flow_acl_parse_range(fields[2], &rule->field[ACL_FIELD_SRC_PORT]) != 0 ||
+            onvm_flow_acl_parse_range(fields[3], &rule->field[ACL_FIELD_DST_PORT]) != 0 ||
+            onvm_flow_acl_parse_proto(fields[4], &rule->field[ACL_FIELD_PROTO]) != 0)
+                return -1;
+
+        return onvm_flow_acl_parse_chain(fields[5], chain);
+}
+
+/* ADDR/DEPTH, rte_acl wants the address in host order */
+static int
+onvm_flow_acl_parse_prefix(const char *str, struct rte_acl_field *field) {
+        char addr[INET_ADDRSTRLEN];
+        const char *slash;
+        char *end = NULL;
+        struct in_addr in;
+        unsigned long depth;
+
+        if (strcmp(str, "*") == 0)
+                return 0;
+
+        slash = strchr(str, '/');
+        if (slash == NULL || (size_t)(slash - str) >= sizeof(addr))
+                return -1;
+        memcpy(addr, str, slash - str);
+        addr[slash - str] = '\0';
+        if (inet_pton(AF_INET, addr, &in) != 1)
+                return -1;
+        depth = strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || depth > 32)
+                return -1;
+
+        field->value.u32 = rte_be_to_cpu_32(in.s_addr);
+        field->mask_range.u32 = depth;
+        return 0;
+}
+
+/* LO:HI */
+static int
+onvm_flow_acl_parse_range(const char *str, struct rte_acl_field *field) {
+        char *end = NULL;
+        unsigned long lo, hi;
+
+        if (strcmp(str, "*") == 0) {
+                field->value.u16 = 0;
+                field->mask_range.u16 = UINT16_MAX;
+                return 0;
+        }
+
+        lo = strtoul(str, &end, 10);
+        if (end == str || *end != ':')
+                return -1;
+        str = end + 1;
+        hi = strtoul(str, &end, 10);
+        if (end == str || *end != '\0' || lo > hi || hi > UINT16_MAX)
+                return -1;
+
+        field->value.u16 = (uint16_t)lo;
+        field->mask_range.u16 = (uint16_t)hi;
+        return 0;
+}
+
+/* PROTO/MASK */
+static int
+onvm_flow_acl_parse_proto(const char *str, struct rte_acl_field *field) {
+        char *end = NULL;
+        unsigned long proto, mask;
+
+        if (strcmp(str, "*") == 0)
+                return 0;
+
+        proto = strtoul(str, &end, 0);
+        if (end == str || *end != '/' || proto > UINT8_MAX)
+                return -1;
+        str = end + 1;
+        mask = strtoul(str, &end, 0);
+        if (end == str || *end != '\0' || mask > UINT8_MAX)
+                return -1;
+
+        field->value.u8 = (uint8_t)proto;
+        field->mask_range.u8 = (uint8_t)mask;
+        return 0;
+}
+
+/* par:SERVICE_ID+SERVICE_ID+... */
+static int
+onvm_flow_acl_parse_parallel(char *str, struct onvm_service_chain *chain) {
+        uint16_t services[ONVM_MAX_BRANCHES];
+        uint8_t count = 0;
+        char *end = NULL;
+        unsigned long id;
+
+        for (;;) {
+                id = strtoul(str, &end, 10);
+                if (end == str || id > UINT16_MAX || count == ONVM_MAX_BRANCHES)
+                        return -1;
+                services[count++] = (uint16_t)id;
+                if (*end == '\0')
+                        break;
+                if (*end != '+')
+                        return -1;
+                str = end + 1;
+        }
+
+        return onvm_sc_append_parallel(chain, services, count) == 0 ? 0 : -1;
+}
+
+/* nf:SERVICE_ID,par:SERVICE_ID+SERVICE_ID,port:PORT,drop,... with an optional prio:high anywhere */
+static int
+onvm_flow_acl_parse_chain(char *str, struct onvm_service_chain *chain) {
+        char *hop;
+        char *save = NULL;
+        char *end = NULL;
+        unsigned long id;
+
+        for (hop = strtok_r(str, ",", &save); hop != NULL; hop = strtok_r(NULL, ",", &save)) {
+                if (strcmp(hop, "prio:high") == 0) {
+                        chain->rx_prio = ONVM_RX_PRIO_HIGH;
+                        continue;
+                }
+                /* Entry 0 of a chain is reserved */
+                if (chain->chain_length >= ONVM_MAX_CHAIN_LENGTH - 1)
+                        return -1;
+                if (strcmp(hop, "drop") == 0) {
+                        if (onvm_sc_append_entry(chain, ONVM_NF_ACTION_DROP, 0) != 0)
+                                return -1;
+                        continue;
+                }
+                if (strncmp(hop, "par:", 4) == 0) {
+                        if (onvm_flow_acl_parse_parallel(hop + 4, chain) != 0)
+                                return -1;
+                        continue;
+                }
+                if (strncmp(hop, "nf:", 3) == 0 || strncmp(hop, "port:", 5) == 0) {
+                        id = strtoul(strchr(hop, ':') + 1, &end, 10);
+                        if (end == strchr(hop, ':') + 1 || *end != '\0' || id > UINT16_MAX)
+                                return -1;
+                        if (onvm_sc_append_entry(chain, hop[0] == 'n' ? ONVM_NF_ACTION_TONF : ONVM_NF_ACTION_OUT,
+                                                 (uint16_t)id) != 0)
+                                return -1;
+                        continue;
+                }
+                return -1;
+        }
+
+        return chain->chain_length > 0 ? 0 : -1;
+}
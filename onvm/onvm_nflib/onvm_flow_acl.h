@@ -0,0 +1,92 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * onvm_flow_acl.h - wildcard flow classifier APIs
+ ********************************************************************/
+
+#ifndef _ONVM_FLOW_ACL_H_
+#define _ONVM_FLOW_ACL_H_
+
+#include <rte_acl.h>
+#include "onvm_common.h"
+#include "onvm_flow_dir.h"
+
+#define ONVM_FLOW_ACL_NAME "onvm_flow_acl"
+#define ONVM_FLOW_ACL_MAX_RULES 1024
+
+/* Rules built into an rte_acl context by the manager. A packet matching rule
+ * i is handed entries[i], whose sc is the rule's service chain, exactly as if
+ * the flow director had an entry for it. */
+struct onvm_flow_acl {
+        struct rte_acl_ctx *ctx;
+        uint32_t num_rules;
+        struct onvm_flow_entry entries[ONVM_FLOW_ACL_MAX_RULES];
+};
+
+extern struct onvm_flow_acl *flow_acl;
+
+/* Manager side: reserve the shared classifier state and, if rules_file is
+ * not NULL, load its rules and build the classifier.
+ * Each non empty line not starting with '#' is one rule, matched in file
+ * order (the first matching line wins):
+ *   SRC_IP/DEPTH DST_IP/DEPTH SPORT_LO:SPORT_HI DPORT_LO:DPORT_HI PROTO/MASK CHAIN
+ * Any of the first five fields can be '*'. CHAIN is a comma separated list
+ * of up to ONVM_MAX_CHAIN_LENGTH - 1 hops, each one of nf:SERVICE_ID, port:PORT,
+ * drop or par:SERVICE_ID+SERVICE_ID+... for services that see the packet in
+ * parallel, plus prio:high to queue the rule's packets on the NFs' high
+ * priority RX rings, e.g.
+ *   10.0.0.0/8 * * 80:80 6/0xff nf:2,nf:3,port:1
+ *   * * * 53:53 17/0xff par:5+6,nf:2
+ *   * * * 179:179 6/0xff prio:high,nf:4
+ * Returns 0 on success, -1 if the file cannot be read or has a bad rule.
+ */
+int
+onvm_flow_acl_init(const char *rules_file);
+/* NF side: find the classifier the manager built, if any */
+int
+onvm_flow_acl_nf_init(void);
+/* Classify the packets of a burst whose flow_entries[i] is NULL and point
+ * flow_entries[i] at the entry of the rule they match, if any. Packets
+ * that already have an exact match flow entry are left alone, so the flow
+ * director table always overrides the wildcard rules.
+ * Returns the number of packets that matched a rule.
+ */
+int
+onvm_flow_acl_classify(struct rte_mbuf **pkts, uint16_t count, struct onvm_flow_entry **flow_entries);
+
+#endif  // _ONVM_FLOW_ACL_H_
@@ -39,147 +39,389 @@
  ********************************************************************/
 
 #include "onvm_flow_dir.h"
+#include <rte_eal.h>
 #include <rte_malloc.h>
 #include <rte_mbuf.h>
 #include <rte_memory.h>
+#include <rte_mempool.h>
 #include <rte_memzone.h>
+#include <rte_ring.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "onvm_common.h"
+#include "onvm_flow_acl.h"
 #include "onvm_flow_table.h"
+#include "onvm_msg_common.h"
+#include "onvm_sc_common.h"
+#include "onvm_sc_mgr.h"
 
 #define NO_FLAGS 0
-#define SDN_FT_ENTRIES 1024
 
 struct onvm_ft *sdn_ft;
 struct onvm_ft **sdn_ft_p;
+struct onvm_flow_dir_state *flow_dir_state;
+
+/* Manager only: the table replaced by the last growth, freed once every
+ * reader passed a quiescent point in retired_gen or later */
+static struct onvm_ft *retired_ft;
+static uint32_t retired_gen;
+
+/* NF processes ask the manager to grow the table through its message ring */
+static struct rte_ring *flow_dir_mgr_msg_queue;
+static struct rte_mempool *flow_dir_msg_pool;
+
+static int
+onvm_flow_dir_add_with_hash(struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, const struct onvm_service_chain *chain,
+                            struct onvm_flow_entry **flow_entry);
+
+static void
+onvm_flow_dir_request_grow(void);
+
+static void
+onvm_flow_dir_set_key(struct onvm_ft *ft, int32_t tbl_index, struct onvm_flow_entry *flow_entry);
 
 int
-onvm_flow_dir_init(void) {
+onvm_flow_dir_init(uint32_t entries) {
         const struct rte_memzone *mz_ftp;
 
-        sdn_ft = onvm_ft_create(SDN_FT_ENTRIES, sizeof(struct onvm_flow_entry));
+        sdn_ft = onvm_ft_create_with_flags(entries, sizeof(struct onvm_flow_entry), ONVM_FT_FLAG_RSS_HASH);
         if (sdn_ft == NULL) {
                 rte_exit(EXIT_FAILURE, "Unable to create flow table\n");
         }
-        mz_ftp = rte_memzone_reserve(MZ_FTP_INFO, sizeof(struct onvm_ft *), rte_socket_id(), NO_FLAGS);
+        mz_ftp = rte_memzone_reserve(MZ_FTP_INFO, sizeof(struct onvm_flow_dir_state), rte_socket_id(), NO_FLAGS);
         if (mz_ftp == NULL) {
                 rte_exit(EXIT_FAILURE, "Canot reserve memory zone for flow table pointer\n");
         }
-        memset(mz_ftp->addr, 0, sizeof(struct onvm_ft *));
-        sdn_ft_p = mz_ftp->addr;
-        *sdn_ft_p = sdn_ft;
+        memset(mz_ftp->addr, 0, sizeof(struct onvm_flow_dir_state));
+        flow_dir_state = mz_ftp->addr;
+        rte_spinlock_init(&flow_dir_state->write_lock);
+        rte_atomic16_init(&flow_dir_state->grow_requested);
+        flow_dir_state->ft = sdn_ft;
+        sdn_ft_p = &flow_dir_state->ft;
+
+        if (onvm_sc_intern_init() != 0) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for interned service chains\n");
+        }
 
         return 0;
 }
 
 int
-onvm_flow_dir_nf_init(void) {
+onvm_flow_dir_nf_map(void) {
         const struct rte_memzone *mz_ftp;
-        struct onvm_ft **ftp;
+
+        if (flow_dir_state != NULL)
+                return 0;
 
         mz_ftp = rte_memzone_lookup(MZ_FTP_INFO);
-        if (mz_ftp == NULL)
-                rte_exit(EXIT_FAILURE, "Cannot get table pointer\n");
-        ftp = mz_ftp->addr;
-        sdn_ft = *ftp;
+        flow_dir_mgr_msg_queue = rte_ring_lookup(_MGR_MSG_QUEUE_NAME);
+        flow_dir_msg_pool = rte_mempool_lookup(_NF_MSG_POOL_NAME);
+        if (mz_ftp == NULL || flow_dir_mgr_msg_queue == NULL || flow_dir_msg_pool == NULL)
+                return -1;
+        flow_dir_state = mz_ftp->addr;
+        sdn_ft_p = &flow_dir_state->ft;
+        sdn_ft = *sdn_ft_p;
 
         return 0;
 }
 
+int
+onvm_flow_dir_nf_init(void) {
+        if (onvm_flow_dir_nf_map() != 0)
+                rte_exit(EXIT_FAILURE, "Cannot get table pointer\n");
+
+        if (onvm_sc_intern_nf_init() != 0)
+                rte_exit(EXIT_FAILURE, "Cannot get interned service chains\n");
+
+        return onvm_flow_acl_nf_init();
+}
+
 int
 onvm_flow_dir_get_pkt(struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry) {
         int ret;
-        ret = onvm_ft_lookup_pkt(sdn_ft, pkt, (char **)flow_entry);
+        ret = onvm_ft_lookup_pkt(onvm_flow_dir_table(), pkt, (char **)flow_entry);
 
         return ret;
 }
 
 int
-onvm_flow_dir_add_pkt(struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry) {
+onvm_flow_dir_get_pkt_bulk(struct rte_mbuf **pkts, uint16_t count, struct onvm_flow_entry **flow_entries) {
+        int hits;
+
+        hits = onvm_ft_lookup_pkt_bulk(onvm_flow_dir_table(), pkts, count, (char **)flow_entries, NULL);
+        if (hits < count)
+                hits += onvm_flow_acl_classify(pkts, count, flow_entries);
+
+        return hits;
+}
+
+int
+onvm_flow_dir_add_pkt(struct rte_mbuf *pkt, const struct onvm_service_chain *chain,
+                      struct onvm_flow_entry **flow_entry) {
+        struct onvm_ft_ipv4_5tuple key;
         int ret;
-        ret = onvm_ft_add_pkt(sdn_ft, pkt, (char **)flow_entry);
 
-        return ret;
+        ret = onvm_ft_fill_key(&key, pkt);
+        if (ret < 0)
+                return ret;
+
+        return onvm_flow_dir_add_with_hash(&key, onvm_ft_hash(onvm_flow_dir_table(), pkt, &key), chain, flow_entry);
+}
+
+int
+onvm_flow_dir_set_chain(struct onvm_flow_entry *flow_entry, const struct onvm_service_chain *chain) {
+        struct onvm_service_chain *shared, *old;
+        struct onvm_ft *ft;
+        int ret;
+
+        if (flow_entry->key == NULL)
+                return -ENOENT;
+
+        shared = onvm_sc_intern(chain);
+        if (shared == NULL)
+                return -ENOSPC;
+
+        /* flow_entry may point into a table the manager replaced since it was
+         * looked up, whose key copy stays valid until the caller's next
+         * quiescent point. Update the entry in the current table instead. */
+        rte_spinlock_lock(&flow_dir_state->write_lock);
+        ft = onvm_flow_dir_table();
+        ret = onvm_ft_lookup_key_with_hash(ft, flow_entry->key, onvm_ft_hash_key(ft, flow_entry->key),
+                                           (char **)&flow_entry);
+        if (ret >= 0) {
+                old = flow_entry->sc;
+                flow_entry->sc = shared;
+        }
+        rte_spinlock_unlock(&flow_dir_state->write_lock);
+
+        if (ret < 0) {
+                onvm_sc_release(shared);
+                return ret;
+        }
+        onvm_sc_release(old);
+
+        return 0;
 }
 
 int
 onvm_flow_dir_del_pkt(struct rte_mbuf *pkt) {
         int ret;
         struct onvm_flow_entry *flow_entry;
-        int ref_cnt;
+        struct onvm_service_chain *old = NULL;
 
+        rte_spinlock_lock(&flow_dir_state->write_lock);
         ret = onvm_flow_dir_get_pkt(pkt, &flow_entry);
         if (ret >= 0) {
-                ref_cnt = flow_entry->sc->ref_cnt--;
-                if (ref_cnt <= 0) {
-                        ret = onvm_flow_dir_del_and_free_pkt(pkt);
-                }
+                /* The slot is reused by a later add, which must not show this chain */
+                old = flow_entry->sc;
+                flow_entry->sc = NULL;
+                ret = onvm_ft_remove_pkt(onvm_flow_dir_table(), pkt);
         }
+        rte_spinlock_unlock(&flow_dir_state->write_lock);
+        onvm_sc_release(old);
 
         return ret;
 }
 
 int
 onvm_flow_dir_del_and_free_pkt(struct rte_mbuf *pkt) {
-        int ret;
         struct onvm_flow_entry *flow_entry;
 
-        ret = onvm_flow_dir_get_pkt(pkt, &flow_entry);
-        if (ret >= 0) {
+        if (onvm_flow_dir_get_pkt(pkt, &flow_entry) >= 0 && !onvm_sc_is_interned(flow_entry->sc))
                 rte_free(flow_entry->sc);
-                rte_free(flow_entry->key);
-                ret = onvm_ft_remove_pkt(sdn_ft, pkt);
-        }
 
-        return ret;
+        return onvm_flow_dir_del_pkt(pkt);
 }
 
 int
 onvm_flow_dir_get_key(struct onvm_ft_ipv4_5tuple *key, struct onvm_flow_entry **flow_entry) {
         int ret;
-        ret = onvm_ft_lookup_key(sdn_ft, key, (char **)flow_entry);
+        ret = onvm_ft_lookup_key(onvm_flow_dir_table(), key, (char **)flow_entry);
 
         return ret;
 }
 
 int
-onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple *key, struct onvm_flow_entry **flow_entry) {
-        int ret;
-        ret = onvm_ft_add_key(sdn_ft, key, (char **)flow_entry);
-
-        return ret;
+onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple *key, const struct onvm_service_chain *chain,
+                      struct onvm_flow_entry **flow_entry) {
+        return onvm_flow_dir_add_with_hash(key, onvm_ft_hash_key(onvm_flow_dir_table(), key), chain, flow_entry);
 }
 
 int
 onvm_flow_dir_del_key(struct onvm_ft_ipv4_5tuple *key) {
         int ret;
         struct onvm_flow_entry *flow_entry;
-        int ref_cnt;
+        struct onvm_service_chain *old = NULL;
 
+        rte_spinlock_lock(&flow_dir_state->write_lock);
         ret = onvm_flow_dir_get_key(key, &flow_entry);
         if (ret >= 0) {
-                ref_cnt = flow_entry->sc->ref_cnt--;
-                if (ref_cnt <= 0) {
-                        ret = onvm_flow_dir_del_and_free_key(key);
-                }
+                /* The slot is reused by a later add, which must not show this chain */
+                old = flow_entry->sc;
+                flow_entry->sc = NULL;
+                ret = onvm_ft_remove_key(onvm_flow_dir_table(), key);
         }
+        rte_spinlock_unlock(&flow_dir_state->write_lock);
+        onvm_sc_release(old);
 
         return ret;
 }
 
 int
 onvm_flow_dir_del_and_free_key(struct onvm_ft_ipv4_5tuple *key) {
-        int ret;
         struct onvm_flow_entry *flow_entry;
 
-        ret = onvm_flow_dir_get_key(key, &flow_entry);
-        if (ret >= 0) {
+        if (onvm_flow_dir_get_key(key, &flow_entry) >= 0 && !onvm_sc_is_interned(flow_entry->sc))
                 rte_free(flow_entry->sc);
-                rte_free(flow_entry->key);
-                ret = onvm_ft_remove_key(sdn_ft, key);
+
+        return onvm_flow_dir_del_key(key);
+}
+
+/*
+ * rte_hash tables cannot be resized, so the manager grows the flow director
+ * by copying its flows into a table twice the size and publishing it through
+ * sdn_ft_p, where readers pick it up on their next burst. Writers are held
+ * off by the write lock during the copy, so no add or delete is lost. Entries
+ * are copied whole, so their chain references move with them.
+ */
+int
+onvm_flow_dir_grow(void) {
+        struct onvm_ft *ft, *new_ft;
+        struct onvm_flow_entry *flow_entry;
+        const void *key;
+        void *data;
+        uint32_t next = 0;
+        int32_t tbl_index;
+
+        /* Readers may still be in the table replaced last time */
+        if (retired_ft != NULL)
+                return -EBUSY;
+
+        ft = onvm_flow_dir_table();
+        if (ft->cnt >= ONVM_FLOW_DIR_MAX_ENTRIES) {
+                rte_atomic16_clear(&flow_dir_state->grow_requested);
+                return -ENOSPC;
+        }
+
+        new_ft = onvm_ft_create_with_flags(RTE_MIN(ft->cnt * 2, ONVM_FLOW_DIR_MAX_ENTRIES), ft->entry_size, ft->flags);
+        if (new_ft == NULL)
+                return -ENOMEM;
+
+        rte_spinlock_lock(&flow_dir_state->write_lock);
+        while (onvm_ft_iterate(ft, &key, &data, &next) >= 0) {
+                tbl_index = onvm_ft_add_key(new_ft, (struct onvm_ft_ipv4_5tuple *)key, (char **)&flow_entry);
+                if (tbl_index < 0) {
+                        rte_spinlock_unlock(&flow_dir_state->write_lock);
+                        onvm_ft_free(new_ft);
+                        return tbl_index;
+                }
+                memcpy(flow_entry, data, ft->entry_size);
+                onvm_flow_dir_set_key(new_ft, tbl_index, flow_entry);
+        }
+
+        flow_dir_state->ft = new_ft;
+        sdn_ft = new_ft;
+        rte_spinlock_unlock(&flow_dir_state->write_lock);
+
+        retired_ft = ft;
+        retired_gen = onvm_quiesce_advance();
+        rte_atomic16_clear(&flow_dir_state->grow_requested);
+        RTE_LOG(INFO, APP, "Flow director grown to %d flows\n", new_ft->cnt);
+
+        return 0;
+}
+
+void
+onvm_flow_dir_maintain(void) {
+        if (flow_dir_state == NULL)
+                return;
+
+        if (retired_ft != NULL && onvm_quiesce_passed(retired_gen)) {
+                onvm_ft_free(retired_ft);
+                retired_ft = NULL;
+        }
+
+        /* Also retries a growth that had to wait for the last one to be freed */
+        if (rte_atomic16_read(&flow_dir_state->grow_requested))
+                onvm_flow_dir_grow();
+}
+
+/******************************Helper functions*******************************/
+
+/* Runs under the write lock, so a growth either sees this flow with its chain
+ * or has already published the table it is added to.
+ *
+ * Readers may find the key as soon as it is in the hash, before its entry is
+ * filled in. Deletes leave sc NULL in the slots they free, and fresh tables
+ * are zeroed, so such readers see no chain and use the default one until the
+ * chain is stored last. */
+static int
+onvm_flow_dir_add_with_hash(struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, const struct onvm_service_chain *chain,
+                            struct onvm_flow_entry **flow_entry) {
+        struct onvm_service_chain *shared, *old = NULL;
+        struct onvm_flow_entry *entry;
+        struct onvm_ft *ft;
+        int ret;
+
+        shared = onvm_sc_intern(chain);
+        if (shared == NULL)
+                return -ENOSPC;
+
+        rte_spinlock_lock(&flow_dir_state->write_lock);
+        ft = onvm_flow_dir_table();
+        ret = onvm_ft_lookup_key_with_hash(ft, key, sig, (char **)&entry);
+        if (ret >= 0) {
+                /* Already added, only point it to the new chain */
+                old = entry->sc;
+                entry->sc = shared;
+        } else {
+                if (rte_hash_count(ft->hash) >= ft->cnt - ft->cnt / 8)
+                        onvm_flow_dir_request_grow();
+
+                ret = onvm_ft_add_key_with_hash(ft, key, sig, (char **)&entry);
+                if (ret >= 0) {
+                        memset(entry, 0, sizeof(struct onvm_flow_entry));
+                        onvm_flow_dir_set_key(ft, ret, entry);
+                        rte_smp_wmb();
+                        entry->sc = shared;
+                } else {
+                        old = shared;
+                }
         }
+        rte_spinlock_unlock(&flow_dir_state->write_lock);
+        onvm_sc_release(old);
 
+        if (ret >= 0)
+                *flow_entry = entry;
         return ret;
 }
+
+/* Asks the manager once to grow the table. Its master thread also polls
+ * grow_requested, so a lost message only delays the growth. */
+static void
+onvm_flow_dir_request_grow(void) {
+        struct onvm_nf_msg *msg;
+
+        if (!rte_atomic16_test_and_set(&flow_dir_state->grow_requested))
+                return;
+        if (rte_eal_process_type() == RTE_PROC_PRIMARY || flow_dir_mgr_msg_queue == NULL)
+                return;
+
+        if (rte_mempool_get(flow_dir_msg_pool, (void **)&msg) != 0)
+                return;
+        msg->msg_type = MSG_FLOW_DIR_GROW;
+        msg->msg_data = NULL;
+        if (rte_ring_enqueue(flow_dir_mgr_msg_queue, msg) < 0)
+                rte_mempool_put(flow_dir_msg_pool, msg);
+}
+
+static void
+onvm_flow_dir_set_key(struct onvm_ft *ft, int32_t tbl_index, struct onvm_flow_entry *flow_entry) {
+        void *key;
+
+        if (rte_hash_get_key_with_position(ft->hash, tbl_index, &key) == 0)
+                flow_entry->key = (struct onvm_ft_ipv4_5tuple *)key;
+        else
+                flow_entry->key = NULL;
+}
@@ -41,12 +41,28 @@
 #ifndef _ONVM_FLOW_DIR_H_
 #define _ONVM_FLOW_DIR_H_
 
+#include <rte_spinlock.h>
 #include "onvm_common.h"
 #include "onvm_flow_table.h"
 
+/* Shared state of the flow director. Only the manager replaces ft, and it
+ * frees the table it replaced once every reader passed a quiescent point
+ * after the replacement, see struct onvm_quiesce_info. */
+struct onvm_flow_dir_state {
+        struct onvm_ft* ft;
+        /* Held by writers adding or deleting flows, and by the manager while it copies ft */
+        rte_spinlock_t write_lock;
+        /* Set once ft is 7/8 full, cleared by the manager after growing it */
+        rte_atomic16_t grow_requested;
+};
+
 extern struct onvm_ft* sdn_ft;
 extern struct onvm_ft** sdn_ft_p;
+extern struct onvm_flow_dir_state* flow_dir_state;
 
+/* key points to the table's own copy of the flow key and sc to an interned
+ * chain, neither is allocated per flow. sc is NULL while a flow is being
+ * added, readers route such flows down the default chain. */
 struct onvm_flow_entry {
         struct onvm_ft_ipv4_5tuple* key;
         struct onvm_service_chain* sc;
@@ -62,27 +78,77 @@ struct onvm_flow_entry {
  *  0        on success. *flow_entry points to this packet flow's flow entry
  *  -ENOENT  if flow has not been added to table. *flow_entry points to flow entry
  */
+/* Create the flow director with room for entries flows. The manager doubles
+ * it whenever it gets 7/8 full, up to ONVM_FLOW_DIR_MAX_ENTRIES flows. */
+int
+onvm_flow_dir_init(uint32_t entries);
+/* Map the flow director state, done for every NF by onvm_nflib */
 int
-onvm_flow_dir_init(void);
+onvm_flow_dir_nf_map(void);
 int
 onvm_flow_dir_nf_init(void);
+/* Manager only: replace the table with one twice the size. Returns -EBUSY
+ * while the last replaced table may still be read */
+int
+onvm_flow_dir_grow(void);
+/* Manager only, called by the master thread: grows the table if asked to and
+ * frees the replaced table once no reader can see it anymore */
+void
+onvm_flow_dir_maintain(void);
 int
 onvm_flow_dir_get_pkt(struct rte_mbuf* pkt, struct onvm_flow_entry** flow_entry);
+/* Look up a burst of packets with one bulk lookup.
+ * flow_entries[i] is set to the flow entry of pkts[i], or NULL if it has none.
+ * Packets without an exact match entry are then tried against the wildcard
+ * rules of onvm_flow_acl.h, whose entries must not be modified or freed.
+ * Returns the number of packets that matched a flow entry or rule.
+ */
 int
-onvm_flow_dir_add_pkt(struct rte_mbuf* pkt, struct onvm_flow_entry** flow_entry);
-/* delete the flow dir entry, but do not free the service chain (useful if a service chain is pointed to by several
- * different flows */
+onvm_flow_dir_get_pkt_bulk(struct rte_mbuf** pkts, uint16_t count, struct onvm_flow_entry** flow_entries);
+/* Add a flow sent down the interned copy of chain, which may be on the
+ * caller's stack. Adding a flow already in the table only points it to chain.
+ * Returns the table index, or -ENOSPC if the table is full or no more distinct
+ * chains can be interned. Adds and deletes are serialized with each other and
+ * with the manager growing the table.
+ *
+ * Entry pointers returned by lookups and adds point into the current table.
+ * When the manager grows it, they keep pointing into the old copy, which is
+ * freed once the caller passed its next quiescent point (the next iteration
+ * of the NF loop). Never keep them across bursts, and change chains only with
+ * onvm_flow_dir_set_chain: other changes made through a pointer to the old
+ * copy after the growth copied it are lost.
+ */
+int
+onvm_flow_dir_add_pkt(struct rte_mbuf* pkt, const struct onvm_service_chain* chain,
+                      struct onvm_flow_entry** flow_entry);
+/* Point the flow of an entry to the interned copy of chain and release the
+ * chain it pointed to. Also safe on entries of a table grown since.
+ * Returns 0 on success, -ENOSPC if no more distinct chains can be interned,
+ * -ENOENT if the flow was deleted. */
+int
+onvm_flow_dir_set_chain(struct onvm_flow_entry* flow_entry, const struct onvm_service_chain* chain);
+/* Delete the flow dir entry and release its chain */
 int
 onvm_flow_dir_del_pkt(struct rte_mbuf* pkt);
-/* Delete the flow dir entry and free the service chain */
+/* Like onvm_flow_dir_del_pkt, but also frees a chain that was set on the entry
+ * directly instead of through onvm_flow_dir_set_chain */
 int
 onvm_flow_dir_del_and_free_pkt(struct rte_mbuf* pkt);
 int
 onvm_flow_dir_get_key(struct onvm_ft_ipv4_5tuple* key, struct onvm_flow_entry** flow_entry);
 int
-onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple* key, struct onvm_flow_entry** flow_entry);
+onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple* key, const struct onvm_service_chain* chain,
+                      struct onvm_flow_entry** flow_entry);
 int
 onvm_flow_dir_del_key(struct onvm_ft_ipv4_5tuple* key);
 int
 onvm_flow_dir_del_and_free_key(struct onvm_ft_ipv4_5tuple* key);
+
+/* The current flow table. It is replaced when the flow director grows, so
+ * fetch it again for every burst instead of keeping the pointer. */
+static inline struct onvm_ft*
+onvm_flow_dir_table(void) {
+        return *sdn_ft_p;
+}
+
 #endif  // _ONVM_FLOW_DIR_H_
@@ -39,6 +39,7 @@
  ********************************************************************/
 
 #include <rte_cycles.h>
+#include <rte_eal.h>
 #include <rte_ether.h>
 #include <rte_hash.h>
 #include <rte_lcore.h>
@@ -52,10 +53,24 @@ uint8_t rss_symmetric_key[40] = {
     0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
 };
 
+static uint32_t
+onvm_ft_softrss_hash(const void *data, __rte_unused uint32_t data_len, __rte_unused uint32_t init_val) {
+        return onvm_softrss((struct onvm_ft_ipv4_5tuple *)data);
+}
+
 /* Create a new flow table made of an rte_hash table and a fixed size
  * data array for storing values. Only supports IPv4 5-tuple lookups. */
 struct onvm_ft *
 onvm_ft_create(int cnt, int entry_size) {
+        return onvm_ft_create_with_flags(cnt, entry_size, 0);
+}
+
+/* Create a new flow table. flags is 0 or ONVM_FT_FLAG_RSS_HASH.
+ * The hash_func given to rte_hash matches onvm_ft_hash_key so that rte_hash
+ * internals agree with the signatures we pass. Only the bulk lookup of the
+ * primary process relies on it. */
+struct onvm_ft *
+onvm_ft_create_with_flags(int cnt, int entry_size, uint32_t flags) {
         struct rte_hash *hash;
         struct onvm_ft *ft;
         struct rte_hash_parameters ipv4_hash_params = {
@@ -66,6 +81,12 @@ onvm_ft_create(int cnt, int entry_size) {
             .hash_func_init_val = 0,
         };
 
+        if (flags & ONVM_FT_FLAG_RSS_HASH) {
+                ipv4_hash_params.hash_func = onvm_ft_softrss_hash;
+        } else {
+                ipv4_hash_params.hash_func = onvm_ft_ipv4_hash_crc;
+        }
+
         char s[64];
         /* create ipv4 hash table. use core number and cycle counter to get a unique name. */
         ipv4_hash_params.name = s;
@@ -83,6 +104,8 @@ onvm_ft_create(int cnt, int entry_size) {
         ft->hash = hash;
         ft->cnt = cnt;
         ft->entry_size = entry_size;
+        ft->flags = flags;
+        ft->primary_owned = rte_eal_process_type() == RTE_PROC_PRIMARY;
         /* Create data array for storing values */
         ft->data = rte_calloc("entry", cnt, entry_size, 0);
         if (ft->data == NULL) {
@@ -102,7 +125,6 @@ Returns:
 */
 int
 onvm_ft_add_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data) {
-        int32_t tbl_index;
         struct onvm_ft_ipv4_5tuple key;
         int err;
 
@@ -110,11 +132,7 @@ onvm_ft_add_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data) {
         if (err < 0) {
                 return err;
         }
-        tbl_index = rte_hash_add_key_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
-        if (tbl_index >= 0) {
-                *data = &table->data[tbl_index * table->entry_size];
-        }
-        return tbl_index;
+        return onvm_ft_add_key_with_hash(table, &key, onvm_ft_hash(table, pkt, &key), data);
 }
 
 /* Lookup an entry in flow table and set data to point to the value.
@@ -125,7 +143,6 @@ onvm_ft_add_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data) {
 */
 int
 onvm_ft_lookup_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data) {
-        int32_t tbl_index;
         struct onvm_ft_ipv4_5tuple key;
         int ret;
 
@@ -133,11 +150,62 @@ onvm_ft_lookup_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data) {
         if (ret < 0) {
                 return ret;
         }
-        tbl_index = rte_hash_lookup_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
-        if (tbl_index >= 0) {
-                *data = onvm_ft_get_data(table, tbl_index);
+        return onvm_ft_lookup_key_with_hash(table, &key, onvm_ft_hash(table, pkt, &key), data);
+}
+
+/* Lookup a burst of packets in the flow table. The burst is parsed with
+   onvm_pkt_parse_burst and the keys and signatures of the whole burst are
+   built from its tuples, then looked up with onvm_ft_lookup_key_bulk.
+   data[i] points to the value of pkts[i], or is NULL if it was not found.
+   If positions is not NULL, positions[i] is set to what onvm_ft_lookup_pkt
+   would have returned for pkts[i].
+   Returns:
+    the number of packets found in the table
+*/
+int
+onvm_ft_lookup_pkt_bulk(struct onvm_ft *table, struct rte_mbuf **pkts, uint16_t count, char **data,
+                        int32_t *positions) {
+        struct onvm_pkt_burst_tuples tuples;
+        struct onvm_ft_ipv4_5tuple keys[RTE_HASH_LOOKUP_BULK_MAX];
+        hash_sig_t sigs[RTE_HASH_LOOKUP_BULK_MAX];
+        uint16_t pkt_index[RTE_HASH_LOOKUP_BULK_MAX];
+        char *key_data[RTE_HASH_LOOKUP_BULK_MAX];
+        int32_t key_positions[RTE_HASH_LOOKUP_BULK_MAX];
+        struct onvm_ft_ipv4_5tuple *key;
+        uint32_t start, i, n, num_keys;
+        int hits = 0;
+
+        for (start = 0; start < count; start += RTE_HASH_LOOKUP_BULK_MAX) {
+                n = RTE_MIN(count - start, (uint32_t)RTE_HASH_LOOKUP_BULK_MAX);
+                onvm_pkt_parse_burst(&pkts[start], n, &tuples);
+                num_keys = 0;
+                for (i = 0; i < n; i++) {
+                        data[start + i] = NULL;
+                        if (!(tuples.ipv4[i / 64] & (1ULL << (i % 64)))) {
+                                if (positions != NULL)
+                                        positions[start + i] = -EPROTONOSUPPORT;
+                                continue;
+                        }
+                        key = &keys[num_keys];
+                        memset(key, 0, sizeof(struct onvm_ft_ipv4_5tuple));
+                        key->src_addr = tuples.src_addr[i];
+                        key->dst_addr = tuples.dst_addr[i];
+                        key->src_port = tuples.src_port[i];
+                        key->dst_port = tuples.dst_port[i];
+                        key->proto = tuples.proto[i];
+                        sigs[num_keys] = onvm_ft_hash(table, pkts[start + i], key);
+                        pkt_index[num_keys++] = start + i;
+                }
+
+                hits += onvm_ft_lookup_key_bulk(table, keys, sigs, num_keys, key_data, key_positions);
+                for (i = 0; i < num_keys; i++) {
+                        data[pkt_index[i]] = key_data[i];
+                        if (positions != NULL)
+                                positions[pkt_index[i]] = key_positions[i];
+                }
         }
-        return tbl_index;
+
+        return hits;
 }
 
 /* Removes an entry from the flow table
@@ -156,17 +224,29 @@ onvm_ft_remove_pkt(struct onvm_ft *table, struct rte_mbuf *pkt) {
         if (ret < 0) {
                 return ret;
         }
-        return rte_hash_del_key_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
+        return onvm_ft_remove_key_with_hash(table, &key, onvm_ft_hash(table, pkt, &key));
 }
 
 int
 onvm_ft_add_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char **data) {
-        int32_t tbl_index;
-        uint32_t softrss;
+        return onvm_ft_add_key_with_hash(table, key, onvm_ft_hash_key(table, key), data);
+}
+
+int
+onvm_ft_lookup_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char **data) {
+        return onvm_ft_lookup_key_with_hash(table, key, onvm_ft_hash_key(table, key), data);
+}
 
-        softrss = onvm_softrss(key);
+int32_t
+onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key) {
+        return onvm_ft_remove_key_with_hash(table, key, onvm_ft_hash_key(table, key));
+}
+
+int
+onvm_ft_add_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, char **data) {
+        int32_t tbl_index;
 
-        tbl_index = rte_hash_add_key_with_hash(table->hash, (const void *)key, softrss);
+        tbl_index = rte_hash_add_key_with_hash(table->hash, (const void *)key, sig);
         if (tbl_index >= 0) {
                 *data = onvm_ft_get_data(table, tbl_index);
         }
@@ -175,13 +255,10 @@ onvm_ft_add_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char **d
 }
 
 int
-onvm_ft_lookup_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char **data) {
+onvm_ft_lookup_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, char **data) {
         int32_t tbl_index;
-        uint32_t softrss;
-
-        softrss = onvm_softrss(key);
 
-        tbl_index = rte_hash_lookup_with_hash(table->hash, (const void *)key, softrss);
+        tbl_index = rte_hash_lookup_with_hash(table->hash, (const void *)key, sig);
         if (tbl_index >= 0) {
                 *data = onvm_ft_get_data(table, tbl_index);
         }
@@ -190,11 +267,55 @@ onvm_ft_lookup_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char
 }
 
 int32_t
-onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key) {
-        uint32_t softrss;
+onvm_ft_remove_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig) {
+        return rte_hash_del_key_with_hash(table->hash, (const void *)key, sig);
+}
+
+/* Lookup count keys at once. data[i] points to the value of keys[i], or is
+   NULL if it was not found, and positions[i], if positions is not NULL, is
+   what onvm_ft_lookup_key_with_hash would have returned.
+   In the primary process of a table it created, the keys go to
+   rte_hash_lookup_bulk, which pipelines the bucket loads of up to
+   RTE_HASH_LOOKUP_BULK_MAX keys so their cache misses overlap. It hashes the
+   keys itself with the table's hash_func, which gives the same signatures as
+   onvm_ft_hash_key. DPDK 18.11 has no bulk lookup taking precomputed
+   signatures and hash_func is not valid in secondary processes, so there the
+   keys are looked up back to back with sigs.
+   Returns:
+    the number of keys found in the table
+*/
+int
+onvm_ft_lookup_key_bulk(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *keys, hash_sig_t *sigs, uint32_t count,
+                        char **data, int32_t *positions) {
+        const void *key_ptrs[RTE_HASH_LOOKUP_BULK_MAX];
+        int32_t tbl_index[RTE_HASH_LOOKUP_BULK_MAX];
+        uint32_t start, i, n;
+        int hits = 0;
+
+        for (start = 0; start < count; start += RTE_HASH_LOOKUP_BULK_MAX) {
+                n = RTE_MIN(count - start, (uint32_t)RTE_HASH_LOOKUP_BULK_MAX);
+                if (table->primary_owned && rte_eal_process_type() == RTE_PROC_PRIMARY) {
+                        for (i = 0; i < n; i++)
+                                key_ptrs[i] = &keys[start + i];
+                        rte_hash_lookup_bulk(table->hash, key_ptrs, n, tbl_index);
+                } else {
+                        for (i = 0; i < n; i++)
+                                tbl_index[i] = rte_hash_lookup_with_hash(table->hash, (const void *)&keys[start + i],
+                                                                         sigs[start + i]);
+                }
+
+                for (i = 0; i < n; i++) {
+                        data[start + i] = NULL;
+                        if (positions != NULL)
+                                positions[start + i] = tbl_index[i];
+                        if (tbl_index[i] >= 0) {
+                                data[start + i] = onvm_ft_get_data(table, tbl_index[i]);
+                                hits++;
+                        }
+                }
+        }
 
-        softrss = onvm_softrss(key);
-        return rte_hash_del_key_with_hash(table->hash, (const void *)key, softrss);
+        return hits;
 }
 
 /* Iterate through the hash table, returning key-value pairs.
@@ -223,4 +344,6 @@ void
 onvm_ft_free(struct onvm_ft *table) {
         rte_hash_reset(table->hash);
         rte_hash_free(table->hash);
+        rte_free(table->data);
+        rte_free(table);
 }
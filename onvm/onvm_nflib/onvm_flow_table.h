@@ -42,6 +42,7 @@
 #define _ONVM_FLOW_TABLE_H_
 
 #include <rte_common.h>
+#include <rte_hash.h>
 #include <rte_ip.h>
 #include <rte_mbuf.h>
 #include <rte_tcp.h>
@@ -61,11 +62,25 @@ extern uint8_t rss_symmetric_key[40];
 #define DEFAULT_HASH_FUNC rte_jhash
 #endif
 
+/* Take packet signatures from mbuf->hash.rss instead of hashing the 5-tuple in
+ * software. Only valid when packets were hashed by the NIC with the symmetric
+ * rss_symmetric_key over the IPv4 TCP/UDP tuple, as configured by the manager,
+ * and the headers were not rewritten since. Key based calls compute the same
+ * signature with onvm_softrss. */
+#define ONVM_FT_FLAG_RSS_HASH 0x1
+
+/* Signatures are always computed by the caller and passed to the rte_hash
+ * *_with_hash calls. The table is shared with secondary processes, where the
+ * hash_func pointer stored by rte_hash_create is not valid. Only the bulk
+ * lookup lets rte_hash hash the keys, in the primary of a table it created. */
 struct onvm_ft {
         struct rte_hash *hash;
         char *data;
         int cnt;
         int entry_size;
+        uint32_t flags;
+        /* Created by the primary process, where hash_func can be called */
+        uint8_t primary_owned;
 };
 
 struct onvm_ft_ipv4_5tuple {
@@ -95,12 +110,19 @@ union ipv4_5tuple_host {
 struct onvm_ft *
 onvm_ft_create(int cnt, int entry_size);
 
+struct onvm_ft *
+onvm_ft_create_with_flags(int cnt, int entry_size, uint32_t flags);
+
 int
 onvm_ft_add_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data);
 
 int
 onvm_ft_lookup_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data);
 
+int
+onvm_ft_lookup_pkt_bulk(struct onvm_ft *table, struct rte_mbuf **pkts, uint16_t count, char **data,
+                        int32_t *positions);
+
 int32_t
 onvm_ft_remove_pkt(struct onvm_ft *table, struct rte_mbuf *pkt);
 
@@ -113,17 +135,30 @@ onvm_ft_lookup_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, char
 int32_t
 onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key);
 
+/* Variants of the key functions taking a signature precomputed with
+ * onvm_ft_hash or onvm_ft_hash_key, so that a caller doing a lookup followed
+ * by an add only hashes once. */
+int
+onvm_ft_add_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, char **data);
+
+int
+onvm_ft_lookup_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig, char **data);
+
+int32_t
+onvm_ft_remove_key_with_hash(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key, hash_sig_t sig);
+
+/* Looks up count keys whose signatures were precomputed, see onvm_ft_lookup_key_bulk
+ * in onvm_flow_table.c. Returns the number of keys found. */
+int
+onvm_ft_lookup_key_bulk(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *keys, hash_sig_t *sigs, uint32_t count,
+                        char **data, int32_t *positions);
+
 int32_t
 onvm_ft_iterate(struct onvm_ft *table, const void **key, void **data, uint32_t *next);
 
 void
 onvm_ft_free(struct onvm_ft *table);
 
-/* TODO(@sdnfv): Add function to calculate hash and then make lookup/get
- * have versions with precomputed hash values */
-// hash_sig_t
-// onvm_ft_hash(struct rte_mbuf *buf);
-
 static inline void
 _onvm_ft_print_key(struct onvm_ft_ipv4_5tuple *key) {
         printf("IP: %" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8, key->src_addr & 0xFF, (key->src_addr >> 8) & 0xFF,
@@ -140,10 +175,26 @@ onvm_ft_get_data(struct onvm_ft *table, int32_t index) {
 
 static inline int
 onvm_ft_fill_key(struct onvm_ft_ipv4_5tuple *key, struct rte_mbuf *pkt) {
+        const struct onvm_pkt_hdr_cache *hdrs;
         struct ipv4_hdr *ipv4_hdr;
         struct tcp_hdr *tcp_hdr;
         struct udp_hdr *udp_hdr;
 
+        /* Packets from the NIC come with their headers parsed by the manager */
+        hdrs = onvm_pkt_hdr_cache(pkt);
+        if (likely(hdrs != NULL)) {
+                if (unlikely(!(hdrs->flags & ONVM_PKT_HDR_IPV4))) {
+                        return -EPROTONOSUPPORT;
+                }
+                memset(key, 0, sizeof(struct onvm_ft_ipv4_5tuple));
+                key->proto = hdrs->proto;
+                key->src_addr = hdrs->src_addr;
+                key->dst_addr = hdrs->dst_addr;
+                key->src_port = hdrs->src_port;
+                key->dst_port = hdrs->dst_port;
+                return 0;
+        }
+
         if (unlikely(!onvm_pkt_is_ipv4(pkt))) {
                 return -EPROTONOSUPPORT;
         }
@@ -188,29 +239,25 @@ onvm_ft_fill_key_symmetric(struct onvm_ft_ipv4_5tuple *key, struct rte_mbuf *pkt
         return 0;
 }
 
-/* Hash a flow key to get an int. From L3 fwd example */
+/* Hash a flow key to get an int. Adapted from the L3 fwd example to work
+ * directly on struct onvm_ft_ipv4_5tuple without copying it. */
 static inline uint32_t
 onvm_ft_ipv4_hash_crc(const void *data, __rte_unused uint32_t data_len, uint32_t init_val) {
-        union ipv4_5tuple_host *k;
-        uint32_t t;
-        const uint32_t *p;
-
-        k = (union ipv4_5tuple_host*) malloc(sizeof(union ipv4_5tuple_host));
-        memcpy(k, data, sizeof(union ipv4_5tuple_host));  
+        const struct onvm_ft_ipv4_5tuple *k = (const struct onvm_ft_ipv4_5tuple *)data;
+        uint32_t ports;
 
-        t = k->proto;
-        p = (const uint32_t *)&k->port_src;
+        ports = ((uint32_t)k->src_port << 16) | k->dst_port;
 
 #ifdef RTE_MACHINE_CPUFLAG_SSE4_2
-        init_val = rte_hash_crc_4byte(t, init_val);
-        init_val = rte_hash_crc_4byte(k->ip_src, init_val);
-        init_val = rte_hash_crc_4byte(k->ip_dst, init_val);
-        init_val = rte_hash_crc_4byte(*p, init_val);
+        init_val = rte_hash_crc_4byte(k->proto, init_val);
+        init_val = rte_hash_crc_4byte(k->src_addr, init_val);
+        init_val = rte_hash_crc_4byte(k->dst_addr, init_val);
+        init_val = rte_hash_crc_4byte(ports, init_val);
 #else  /* RTE_MACHINE_CPUFLAG_SSE4_2 */
-        init_val = rte_jhash_1word(t, init_val);
-        init_val = rte_jhash_1word(k->ip_src, init_val);
-        init_val = rte_jhash_1word(k->ip_dst, init_val);
-        init_val = rte_jhash_1word(*p, init_val);
+        init_val = rte_jhash_1word(k->proto, init_val);
+        init_val = rte_jhash_1word(k->src_addr, init_val);
+        init_val = rte_jhash_1word(k->dst_addr, init_val);
+        init_val = rte_jhash_1word(ports, init_val);
 #endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
         return (init_val);
 }
@@ -234,4 +281,33 @@ onvm_softrss(struct onvm_ft_ipv4_5tuple *key) {
         return rss_l3l4;
 }
 
+/* Signature of a flow key, as used by all table operations. */
+static inline hash_sig_t
+onvm_ft_hash_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key) {
+        if (table->flags & ONVM_FT_FLAG_RSS_HASH) {
+                return onvm_softrss(key);
+        }
+        return onvm_ft_ipv4_hash_crc(key, sizeof(struct onvm_ft_ipv4_5tuple), 0);
+}
+
+/* Signature of a packet whose key was filled by onvm_ft_fill_key or
+ * onvm_ft_fill_key_symmetric. Reuses the NIC hash, or the one the manager
+ * computed at RX, when the table is in RSS mode and the packet carries one,
+ * otherwise falls back to onvm_ft_hash_key. */
+static inline hash_sig_t
+onvm_ft_hash(struct onvm_ft *table, struct rte_mbuf *pkt, struct onvm_ft_ipv4_5tuple *key) {
+        const struct onvm_pkt_hdr_cache *hdrs;
+
+        if (table->flags & ONVM_FT_FLAG_RSS_HASH) {
+                if (pkt->ol_flags & PKT_RX_RSS_HASH) {
+                        return pkt->hash.rss;
+                }
+                hdrs = onvm_pkt_hdr_cache(pkt);
+                if (hdrs != NULL && (hdrs->flags & ONVM_PKT_HDR_HASH)) {
+                        return hdrs->hash;
+                }
+        }
+        return onvm_ft_hash_key(table, key);
+}
+
 #endif  // _ONVM_FLOW_TABLE_H_
@@ -54,6 +54,7 @@
 #define MSG_FROM_NF 6
 #define MSG_REQUEST_LPM_REGION 7
 #define MSG_CHANGE_CORE 8
+#define MSG_FLOW_DIR_GROW 9
 
 struct onvm_nf_msg {
         uint8_t msg_type; /* Constant saying what type of message is */
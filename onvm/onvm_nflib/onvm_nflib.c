@@ -58,6 +58,7 @@
 
 /*****************************Internal headers********************************/
 
+#include "onvm_flow_dir.h"
 #include "onvm_includes.h"
 #include "onvm_nflib.h"
 #include "onvm_sc_common.h"
@@ -88,6 +89,10 @@ struct onvm_nf *nfs;
 // Shared data from manager, has information used for nf_side tx
 uint16_t **services;
 uint16_t *nf_per_service_count;
+struct service_dispatch *service_dispatch;
+struct onvm_quiesce_info *quiesce_info;
+struct onvm_service_taps *service_taps;
+struct tx_doorbell_info *tx_doorbells;
 
 // Shared pool for all NFs info
 static struct rte_mempool *nf_init_cfg_mp;
@@ -154,6 +159,103 @@ static inline uint16_t
 onvm_nflib_dequeue_packets_bulk(void **pkts, struct onvm_nf_local_ctx *nf_local_ctx,
                            nf_pkt_handler_bulk_fn handler) __attribute__((always_inline));
 
+/*
+ * Check if there are packets in this NF's RX Queue and give the whole burst
+ * to the burst handler
+ */
+static inline uint16_t
+onvm_nflib_dequeue_packets_burst(void **pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                                 nf_pkt_handler_burst_fn handler) __attribute__((always_inline));
+
+/*
+ * Run the bulk or burst handler on packets and keep the ones it returned at
+ * the front of pkts. Returns how many it returned.
+ */
+static inline uint16_t
+onvm_nflib_call_bulk_handler(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                             nf_pkt_handler_bulk_fn handler) __attribute__((always_inline));
+
+static inline uint16_t
+onvm_nflib_call_burst_handler(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                              nf_pkt_handler_burst_fn handler) __attribute__((always_inline));
+
+/*
+ * Run the burst handler of the NF if it has one, else its bulk handler
+ */
+static inline uint16_t
+onvm_nflib_handle_pkts(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx)
+        __attribute__((always_inline));
+
+/*
+ * Dequeue and handle a burst of one fused NF stage, then route it
+ *
+ * Input: the leader's context, the stage (0 is the leader) and room for a burst
+ */
+static void
+onvm_nflib_fused_run_stage(struct onvm_nf_local_ctx *nf_local_ctx, uint16_t stage, struct rte_mbuf **pkts);
+
+/*
+ * Route a burst a fused NF stage returned. Packets for the service of the
+ * next stage, sent there directly or as the next hop of their chain, run
+ * through its handler right away, the rest are routed as usual with the
+ * stage that sent them as source.
+ *
+ * Input: the leader's context, the stage (0 is the leader) and its packets
+ */
+static void
+onvm_nflib_fused_hand_on(struct onvm_nf_local_ctx *nf_local_ctx, uint16_t stage, struct rte_mbuf **pkts,
+                         uint16_t nb_pkts);
+
+/*
+ * Serve the fused NFs of a leader: their own RX rings, buffers and messages
+ */
+static void
+onvm_nflib_fused_poll(struct onvm_nf_local_ctx *nf_local_ctx, struct rte_mbuf **pkts);
+
+/*
+ * Pass on the packets the handler returned: to the caller when NFs route
+ * their own packets, else to the manager TX thread
+ */
+static inline uint16_t
+onvm_nflib_hand_on(struct onvm_nf *nf, void **pkts, uint16_t nb_pkts) __attribute__((always_inline));
+
+/*
+ * How many packets can be dequeued from rx_q this round, limited by the room
+ * left in the buffer towards the TX thread
+ */
+static inline uint16_t
+onvm_nflib_dequeue_budget(struct onvm_nf *nf, struct packet_buf *tx_buf) __attribute__((always_inline));
+
+
+/*
+ * Dequeue up to max_pkts packets, high priority ones first. With a weight
+ * rx_q_hi only gets its share of the burst while rx_q has packets, the rest
+ * goes to rx_q, and leftover room goes back to rx_q_hi.
+ */
+static inline uint16_t
+onvm_nflib_dequeue_rx(struct onvm_nf *nf, void **pkts, uint16_t max_pkts) __attribute__((always_inline));
+
+/*
+ * Count the cycles of one handler call on nb_pkts packets, started at start
+ */
+static inline void
+onvm_nflib_account_batch(struct onvm_nf *nf, uint64_t start, uint16_t nb_pkts) __attribute__((always_inline));
+
+/*
+ * Handler cycles and batches of an NF and the NFs fused into it, read at the
+ * start of a poll loop so its end can tell what the handlers took
+ */
+static inline void
+onvm_nflib_loop_cycles(struct onvm_nf_local_ctx *nf_local_ctx, uint64_t *handler, uint64_t *batches)
+        __attribute__((always_inline));
+
+/*
+ * Count a poll loop started at start as tx cycles if a handler ran in it,
+ * else as idle cycles
+ */
+static inline void
+onvm_nflib_account_loop(struct onvm_nf_local_ctx *nf_local_ctx, uint64_t start, uint64_t handler,
+                        uint64_t batches) __attribute__((always_inline));
 
 /*
  * Check if there is a message available for this NF and process it
@@ -508,6 +610,13 @@ onvm_nflib_start_nf(struct onvm_nf_local_ctx *nf_local_ctx, struct onvm_nf_init_
                 RTE_LOG(INFO, APP, "Time to live set to %u\n", nf->flags.time_to_live);
         if (nf->flags.pkt_limit)
                 RTE_LOG(INFO, APP, "Packet limit (rx) set to %u\n", nf->flags.pkt_limit);
+        if (nf->flags.rx_hi_weight)
+                RTE_LOG(INFO, APP, "High priority RX weight set to %u\n", nf->flags.rx_hi_weight);
+        if (nf->flags.burst_size != PACKET_READ_SIZE)
+                RTE_LOG(INFO, APP, "Burst size set to %u\n", nf->flags.burst_size);
+        if (nf->flags.tap_service)
+                RTE_LOG(INFO, APP, "Tapping service %u, 1 in %u packets\n", nf->flags.tap_service,
+                        nf->flags.tap_sample);
 
         /*
          * Allow this for cases when there is not enough cores and using 
@@ -537,41 +646,111 @@ onvm_nflib_run(struct onvm_nf_local_ctx *nf_local_ctx) {
         return 0;
 }
 
+int
+onvm_nflib_fuse(struct onvm_nf_local_ctx *nf_local_ctx, struct onvm_nf_init_cfg *nf_init_cfg,
+                struct onvm_nf_function_table *nf_function_table) {
+        struct onvm_nf_local_ctx *fused_ctx;
+        int ret;
+
+        if (nf_local_ctx == NULL || nf_local_ctx->nf == NULL || nf_init_cfg == NULL || nf_function_table == NULL)
+                return -1;
+        if (nf_local_ctx->num_fused >= ONVM_MAX_FUSED_NFS) {
+                RTE_LOG(INFO, APP, "Can't fuse more than %d NFs\n", ONVM_MAX_FUSED_NFS);
+                return -1;
+        }
+        /* Fused NFs are called with bursts, not packet by packet */
+        if (nf_function_table->pkt_bulk_handler == NULL && nf_function_table->pkt_burst_handler == NULL) {
+                RTE_LOG(INFO, APP, "Fused NFs need a bulk or burst packet handler\n");
+                return -1;
+        }
+
+        /* Share the leader's core without taking a slot of its own */
+        nf_init_cfg->core = nf_local_ctx->nf->thread_info.core;
+        nf_init_cfg->init_options = ONVM_SET_BIT(nf_init_cfg->init_options, FUSED_NF_BIT);
+
+        fused_ctx = onvm_nflib_init_nf_local_ctx();
+        ret = onvm_nflib_start_nf(fused_ctx, nf_init_cfg);
+        if (ret < 0) {
+                onvm_nflib_stop(fused_ctx);
+                return ret;
+        }
+
+        /* Save the nf specifc function table */
+        fused_ctx->nf->function_table = nf_function_table;
+        nf_local_ctx->fused[nf_local_ctx->num_fused++] = fused_ctx;
+
+        RTE_LOG(INFO, APP, "Fused NF %u (service %u) into NF %u\n", fused_ctx->nf->instance_id,
+                fused_ctx->nf->service_id, nf_local_ctx->nf->instance_id);
+
+        return 0;
+}
+
 void *
 onvm_nflib_thread_main_loop(void *arg) {
-        struct rte_mbuf *pkts[PACKET_READ_SIZE];
+        struct rte_mbuf *pkts[ONVM_MAX_BURST_SIZE];
         struct onvm_nf_local_ctx *nf_local_ctx;
         struct onvm_nf *nf;
         uint16_t nb_pkts_added;
-        uint64_t start_time;
+        uint64_t start_time, loop_start, handler_cycles, batches;
+        uint16_t i;
         int ret;
 
         nf_local_ctx = (struct onvm_nf_local_ctx *)arg;
         nf = nf_local_ctx->nf;
         onvm_threading_core_affinitize(nf->thread_info.core);
 
+        /* Reported before the manager starts waiting for this NF. Fused NFs
+         * read shared tables in this thread, which reports for them */
+        onvm_quiesce_nf(nf->instance_id);
         printf("Sending NF_READY message to manager...\n");
         ret = onvm_nflib_nf_ready(nf);
         if (ret != 0)
                 rte_exit(EXIT_FAILURE, "Unable to message manager\n");
+        for (i = 0; i < nf_local_ctx->num_fused; i++) {
+                if (onvm_nflib_nf_ready(nf_local_ctx->fused[i]->nf) != 0)
+                        rte_exit(EXIT_FAILURE, "Unable to message manager\n");
+        }
 
         /* Run the setup function (this might send pkts so done after the state change) */
         if (nf->function_table->setup != NULL)
                 nf->function_table->setup(nf_local_ctx);
+        for (i = 0; i < nf_local_ctx->num_fused; i++) {
+                if (nf_local_ctx->fused[i]->nf->function_table->setup != NULL)
+                        nf_local_ctx->fused[i]->nf->function_table->setup(nf_local_ctx->fused[i]);
+        }
 
         start_time = rte_get_tsc_cycles();
         for (;rte_atomic16_read(&nf_local_ctx->keep_running) && rte_atomic16_read(&main_nf_local_ctx->keep_running);) {
-                /* Possibly sleep if in shared core mode, otherwise continue */
-                if (ONVM_NF_SHARE_CORES) {
-                        if (unlikely(rte_ring_count(nf->rx_q) == 0) && likely(rte_ring_count(nf->msg_q) == 0)) {
+                /* Possibly sleep if in shared core mode, otherwise continue. Fused
+                 * NFs are only polled, so their leader stays awake */
+                if (ONVM_NF_SHARE_CORES && nf_local_ctx->num_fused == 0) {
+                        if (unlikely(rte_ring_count(nf->rx_q) == 0) && likely(rte_ring_count(nf->rx_q_hi) == 0) &&
+                            likely(rte_ring_count(nf->msg_q) == 0)) {
+                                /* Nothing may wait in our buffers while we sleep */
+                                onvm_pkt_flush_all_idle(nf->nf_tx_mgr, nf);
                                 rte_atomic16_set(nf->shared_core.sleep_state, 1);
+                                onvm_quiesce_nf_offline(nf->instance_id);
                                 sem_wait(nf->shared_core.nf_mutex);
                         }
                 }
-
-                nb_pkts_added =
-                        // onvm_nflib_dequeue_packets((void **)pkts, nf_local_ctx, nf->function_table->pkt_handler);
-                        onvm_nflib_dequeue_packets_bulk((void **)pkts, nf_local_ctx, nf->function_table->pkt_bulk_handler);
+                /* No dispatch tables or flow entries are held between bursts */
+                onvm_quiesce_nf(nf->instance_id);
+
+                /* Time asleep is neither busy nor idle polling */
+                loop_start = rte_get_tsc_cycles();
+                onvm_nflib_loop_cycles(nf_local_ctx, &handler_cycles, &batches);
+
+                if (unlikely(nf_local_ctx->num_fused > 0)) {
+                        /* Routes what the fused NFs return itself */
+                        onvm_nflib_fused_run_stage(nf_local_ctx, 0, pkts);
+                        nb_pkts_added = 0;
+                } else if (nf->function_table->pkt_burst_handler != NULL)
+                        nb_pkts_added = onvm_nflib_dequeue_packets_burst((void **)pkts, nf_local_ctx,
+                                                                         nf->function_table->pkt_burst_handler);
+                else
+                        nb_pkts_added =
+                                // onvm_nflib_dequeue_packets((void **)pkts, nf_local_ctx, nf->function_table->pkt_handler);
+                                onvm_nflib_dequeue_packets_bulk((void **)pkts, nf_local_ctx, nf->function_table->pkt_bulk_handler);
 
                 if (likely(nb_pkts_added > 0)) {
                         onvm_pkt_process_tx_batch(nf->nf_tx_mgr, pkts, nb_pkts_added, nf);
@@ -580,6 +759,7 @@ onvm_nflib_thread_main_loop(void *arg) {
                 /* Flush the packet buffers */
                 onvm_pkt_enqueue_tx_thread(nf->nf_tx_mgr->to_tx_buf, nf);
                 onvm_pkt_flush_all_nfs(nf->nf_tx_mgr, nf);
+                onvm_pkt_flush_all_ports(nf->nf_tx_mgr);
 
                 onvm_nflib_dequeue_messages(nf_local_ctx);
                 if (nf->function_table->user_actions != ONVM_NO_CALLBACK) {
@@ -587,6 +767,9 @@ onvm_nflib_thread_main_loop(void *arg) {
                                          !(*nf->function_table->user_actions)(nf_local_ctx) &&
                                          rte_atomic16_read(&nf_local_ctx->keep_running));
                 }
+                if (unlikely(nf_local_ctx->num_fused > 0))
+                        onvm_nflib_fused_poll(nf_local_ctx, pkts);
+                onvm_nflib_account_loop(nf_local_ctx, loop_start, handler_cycles, batches);
 
                 if (nf->flags.time_to_live && unlikely((rte_get_tsc_cycles() - start_time) *
                                           TIME_TTL_MULTIPLIER / rte_get_timer_hz() >= nf->flags.time_to_live)) {
@@ -599,6 +782,7 @@ onvm_nflib_thread_main_loop(void *arg) {
                         rte_atomic16_set(&nf_local_ctx->keep_running, 0);
                 }
         }
+        onvm_quiesce_nf_offline(nf->instance_id);
         return NULL;
 }
 
@@ -609,22 +793,37 @@ onvm_nflib_return_pkt(struct onvm_nf *nf, struct rte_mbuf *pkt) {
 
 int
 onvm_nflib_return_pkt_bulk(struct onvm_nf *nf, struct rte_mbuf **pkts, uint16_t count) {
-        unsigned int i;
+        unsigned int i, sent;
         if (pkts == NULL || count == 0)
                 return -1;
-        if (unlikely(rte_ring_enqueue_bulk(nf->tx_q, (void **)pkts, count, NULL) == 0)) {
-                nf->stats.tx_drop += count;
-                for (i = 0; i < count; i++) {
-                        rte_pktmbuf_free(pkts[i]);
+        /* Packets the handler kept end their hop now */
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_done(pkts, count);
+        sent = rte_ring_enqueue_burst(nf->tx_q, (void **)pkts, count, NULL);
+        if (likely(sent > 0)) {
+                nf->stats.tx_returned += sent;
+                onvm_pkt_ring_tx_doorbell(nf);
+        }
+        if (unlikely(sent < count)) {
+                /* Only drop what did not fit on tx_q, branch clones through their join */
+                nf->stats.tx_drop += count - sent;
+                for (i = sent; i < count; i++) {
+                        onvm_pkt_discard(pkts[i]);
                 }
                 return -ENOBUFS;
-        } else {
-                nf->stats.tx_returned += count;
         }
 
         return 0;
 }
 
+int
+onvm_nflib_nf_is_congested(uint16_t instance_id) {
+        if (instance_id >= MAX_NFS || !onvm_nf_is_valid(&nfs[instance_id]))
+                return 0;
+
+        return nfs[instance_id].rx_congested;
+}
+
 int
 onvm_nflib_nf_ready(struct onvm_nf *nf) {
         struct onvm_nf_msg *startup_msg;
@@ -653,6 +852,8 @@ onvm_nflib_nf_ready(struct onvm_nf *nf) {
 
 int
 onvm_nflib_handle_msg(struct onvm_nf_msg *msg, struct onvm_nf_local_ctx *nf_local_ctx) {
+        struct onvm_nf_scale_info *scale_info;
+
         switch (msg->msg_type) {
                 case MSG_STOP:
                         RTE_LOG(INFO, APP, "Shutting down...\n");
@@ -660,7 +861,13 @@ onvm_nflib_handle_msg(struct onvm_nf_msg *msg, struct onvm_nf_local_ctx *nf_loca
                         break;
                 case MSG_SCALE:
                         RTE_LOG(INFO, APP, "Received scale message...\n");
-                        onvm_nflib_scale((struct onvm_nf_scale_info*)msg->msg_data);
+                        scale_info = (struct onvm_nf_scale_info *)msg->msg_data;
+                        /* The manager autoscaler sends none, its children copy this NF on any free core */
+                        if (scale_info == NULL) {
+                                scale_info = onvm_nflib_inherit_parent_config(nf_local_ctx->nf, nf_local_ctx->nf->data);
+                                scale_info->nf_init_cfg->init_options &= ~(1 << MANUAL_CORE_ASSIGNMENT_BIT);
+                        }
+                        onvm_nflib_scale(scale_info);
                         break;
                 case MSG_FROM_NF:
                         RTE_LOG(INFO, APP, "Received MSG from other NF\n");
@@ -702,6 +909,8 @@ onvm_nflib_send_msg_to_nf(uint16_t dest, void *msg_data) {
 
 void
 onvm_nflib_stop(struct onvm_nf_local_ctx *nf_local_ctx) {
+        uint16_t i;
+
         if (nf_local_ctx == NULL || nf_local_ctx->nf == NULL || rte_atomic16_read(&nf_local_ctx->nf_stopped) != 0) {
                 return;
         }
@@ -709,6 +918,11 @@ onvm_nflib_stop(struct onvm_nf_local_ctx *nf_local_ctx) {
         /* Ensure we only call nflib_stop once */
         rte_atomic16_set(&nf_local_ctx->nf_stopped, 1);
 
+        /* Fused NFs go down with their leader */
+        for (i = 0; i < nf_local_ctx->num_fused; i++)
+                onvm_nflib_stop(nf_local_ctx->fused[i]);
+        nf_local_ctx->num_fused = 0;
+
         /* Terminate children */
         onvm_nflib_terminate_children(nf_local_ctx->nf);
         /* Stop and free */
@@ -725,7 +939,7 @@ onvm_nflib_scale(struct onvm_nf_scale_info *scale_info) {
         int ret;
         pthread_t app_thread;
 
-        if (onvm_nflib_is_scale_info_valid(scale_info) < 0) {
+        if (!onvm_nflib_is_scale_info_valid(scale_info)) {
                 RTE_LOG(INFO, APP, "Scale info invalid\n");
                 return -1;
         }
@@ -781,6 +995,17 @@ onvm_nflib_init_nf_init_cfg(const char *tag) {
         nf_init_cfg->time_to_live = 0;
         nf_init_cfg->pkt_limit = 0;
 
+        /* Strict priority between the RX rings by default */
+        nf_init_cfg->rx_hi_weight = 0;
+        nf_init_cfg->burst_size = PACKET_READ_SIZE;
+
+        /* Not a tap, taps see every packet unless sampled */
+        nf_init_cfg->tap_service = 0;
+        nf_init_cfg->tap_sample = 1;
+
+        /* Not scaled by the manager */
+        nf_init_cfg->autoscale_max = 0;
+
         return nf_init_cfg;
 }
 
@@ -795,6 +1020,11 @@ onvm_nflib_inherit_parent_init_cfg(struct onvm_nf *parent) {
         nf_init_cfg->init_options = parent->flags.init_options;
         nf_init_cfg->time_to_live = parent->flags.time_to_live;
         nf_init_cfg->pkt_limit = parent->flags.pkt_limit;
+        nf_init_cfg->rx_hi_weight = parent->flags.rx_hi_weight;
+        nf_init_cfg->burst_size = parent->flags.burst_size;
+        /* Children are scaled to share the parent's load, they never tap */
+        nf_init_cfg->tap_service = 0;
+        nf_init_cfg->tap_sample = 1;
 
         return nf_init_cfg;
 }
@@ -846,6 +1076,10 @@ onvm_nflib_lookup_shared_structs(void) {
         const struct rte_memzone *mz_scp;
         const struct rte_memzone *mz_services;
         const struct rte_memzone *mz_nf_per_service;
+        const struct rte_memzone *mz_service_dispatch;
+        const struct rte_memzone *mz_quiesce;
+        const struct rte_memzone *mz_service_taps;
+        const struct rte_memzone *mz_tx_doorbell;
         const struct rte_memzone *mz_onvm_config;
         struct rte_mempool *mp;
         struct onvm_service_chain **scp;
@@ -882,6 +1116,30 @@ onvm_nflib_lookup_shared_structs(void) {
         }
         nf_per_service_count = mz_nf_per_service->addr;
 
+        mz_service_dispatch = rte_memzone_lookup(MZ_SERVICE_DISPATCH_INFO);
+        if (mz_service_dispatch == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot get service dispatch information\n");
+        }
+        service_dispatch = mz_service_dispatch->addr;
+
+        mz_quiesce = rte_memzone_lookup(MZ_QUIESCE_INFO);
+        if (mz_quiesce == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot get quiescent state information\n");
+        }
+        quiesce_info = mz_quiesce->addr;
+
+        mz_service_taps = rte_memzone_lookup(MZ_SERVICE_TAPS_INFO);
+        if (mz_service_taps == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot get service taps information\n");
+        }
+        service_taps = mz_service_taps->addr;
+
+        mz_tx_doorbell = rte_memzone_lookup(MZ_TX_DOORBELL_INFO);
+        if (mz_tx_doorbell == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot get TX doorbell information\n");
+        }
+        tx_doorbells = mz_tx_doorbell->addr;
+
         mz_port = rte_memzone_lookup(MZ_PORT_INFO);
         if (mz_port == NULL)
                 rte_exit(EXIT_FAILURE, "Cannot get port info structure\n");
@@ -898,6 +1156,13 @@ onvm_nflib_lookup_shared_structs(void) {
         onvm_config = mz_onvm_config->addr;
         onvm_nflib_parse_config(onvm_config);
 
+        /* Every NF may look flows up when routing packets to the next hop */
+        if (onvm_flow_dir_nf_map() != 0)
+                rte_exit(EXIT_FAILURE, "Cannot get flow director state\n");
+
+        if (onvm_trace_nf_init(onvm_config->trace_sample) != 0)
+                rte_exit(EXIT_FAILURE, "Cannot get latency trace info structure\n");
+
         mz_scp = rte_memzone_lookup(MZ_SCP_INFO);
         if (mz_scp == NULL)
                 rte_exit(EXIT_FAILURE, "Cannot get service chain info structre\n");
@@ -917,83 +1182,387 @@ onvm_nflib_parse_config(struct onvm_configuration *config) {
         ONVM_NF_SHARE_CORES = config->flags.ONVM_NF_SHARE_CORES;
 }
 
+static inline uint16_t
+onvm_nflib_dequeue_budget(struct onvm_nf *nf, struct packet_buf *tx_buf) {
+        /* Retry what the TX thread had no room for last time before taking more */
+        if (unlikely(tx_buf->count > 0))
+                onvm_pkt_enqueue_tx_thread(tx_buf, nf);
+
+        return nf->nf_tx_mgr->burst_size - tx_buf->count;
+}
+
 static inline uint16_t
 onvm_nflib_dequeue_packets(void **pkts, struct onvm_nf_local_ctx *nf_local_ctx, nf_pkt_handler_fn  handler) {
         struct onvm_nf *nf;
         struct onvm_pkt_meta *meta;
-        uint16_t i, nb_pkts;
-        struct packet_buf tx_buf;
+        uint16_t i, nb_pkts, nb_ret, max_pkts;
+        struct packet_buf *tx_buf;
+        uint64_t start;
         int ret_act;
 
         nf = nf_local_ctx->nf;
+        tx_buf = nf->nf_tx_mgr->to_tx_buf;
+
+        /* Only take what can be handed on, leave the rest on rx_q as backpressure */
+        max_pkts = onvm_nflib_dequeue_budget(nf, tx_buf);
+        if (unlikely(max_pkts == 0)) {
+                return 0;
+        }
 
         /* Dequeue all packets in ring up to max possible. */
-        nb_pkts = rte_ring_dequeue_burst(nf->rx_q, pkts, PACKET_READ_SIZE, NULL);
+        nb_pkts = onvm_nflib_dequeue_rx(nf, pkts, max_pkts);
 
         if (unlikely(nb_pkts == 0)) {
                 return 0;
         }
 
-        tx_buf.count = 0;
+
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_dequeue((struct rte_mbuf **)pkts, nb_pkts, nf->service_id);
 
         /* Give each packet to the user proccessing function */
-        for (i = 0; i < nb_pkts; i++) {
+        start = rte_get_tsc_cycles();
+        for (i = 0, nb_ret = 0; i < nb_pkts; i++) {
                 meta = onvm_get_pkt_meta((struct rte_mbuf *)pkts[i]);
                 ret_act = (*handler)((struct rte_mbuf *)pkts[i], meta, nf_local_ctx);
                 /* NF returns 0 to return packets or 1 to buffer */
                 if (likely(ret_act == 0)) {
-                        tx_buf.buffer[tx_buf.count++] = pkts[i];
+                        pkts[nb_ret++] = pkts[i];
                 } else {
                         nf->stats.tx_buffer++;
                 }
         }
-        if (ONVM_NF_HANDLE_TX) {
-                return nb_pkts;
-        }
+        onvm_nflib_account_batch(nf, start, nb_pkts);
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_done((struct rte_mbuf **)pkts, nb_ret);
 
-        onvm_pkt_enqueue_tx_thread(&tx_buf, nf);
-        return 0;
+        return onvm_nflib_hand_on(nf, pkts, nb_ret);
 }
 
 static inline uint16_t
 onvm_nflib_dequeue_packets_bulk(void **pkts, struct onvm_nf_local_ctx *nf_local_ctx, nf_pkt_handler_bulk_fn handler) {
         struct onvm_nf *nf;
-        uint16_t i, nb_pkts;
-        struct packet_buf tx_buf;
-        int ret_act;
+        uint16_t nb_pkts, max_pkts;
+        struct packet_buf *tx_buf;
 
         nf = nf_local_ctx->nf;
+        tx_buf = nf->nf_tx_mgr->to_tx_buf;
+
+        /* Only take what can be handed on, leave the rest on rx_q as backpressure */
+        max_pkts = onvm_nflib_dequeue_budget(nf, tx_buf);
+        if (unlikely(max_pkts == 0)) {
+                return 0;
+        }
 
-        // TODO: dummy assertion
-        RTE_ASSERT(PACKET_READ_SIZE <= sizeof(int) * 8);
         /* Dequeue all packets in ring up to max possible. */
-        nb_pkts = rte_ring_dequeue_burst(nf->rx_q, pkts, PACKET_READ_SIZE, NULL);
+        nb_pkts = onvm_nflib_dequeue_rx(nf, pkts, max_pkts);
 
         if (unlikely(nb_pkts == 0)) {
                 return 0;
         }
 
-        tx_buf.count = 0;
-        /* Give packets to the user bulk proccessing function */
-        ret_act = (*handler)((struct rte_mbuf **)pkts, nb_pkts, nf_local_ctx);
+        return onvm_nflib_hand_on(nf, pkts, onvm_nflib_call_bulk_handler(pkts, nb_pkts, nf_local_ctx, handler));
+}
 
-        for (i = 0; i < nb_pkts; i++) {
-                /* NF returns 0 to return packets or 1 to buffer */
-                if (likely((ret_act & (1 << i)) == 0)) {
-                        tx_buf.buffer[tx_buf.count++] = pkts[i];
+static inline uint16_t
+onvm_nflib_dequeue_packets_burst(void **pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                                 nf_pkt_handler_burst_fn handler) {
+        struct onvm_nf *nf;
+        uint16_t nb_pkts, max_pkts;
+
+        nf = nf_local_ctx->nf;
+
+        /* Only take what can be handed on, leave the rest on rx_q as backpressure */
+        max_pkts = onvm_nflib_dequeue_budget(nf, nf->nf_tx_mgr->to_tx_buf);
+        if (unlikely(max_pkts == 0)) {
+                return 0;
+        }
+
+        nb_pkts = onvm_nflib_dequeue_rx(nf, pkts, max_pkts);
+        if (unlikely(nb_pkts == 0)) {
+                return 0;
+        }
+
+        return onvm_nflib_hand_on(nf, pkts, onvm_nflib_call_burst_handler(pkts, nb_pkts, nf_local_ctx, handler));
+}
+
+static inline uint16_t
+onvm_nflib_call_bulk_handler(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                             nf_pkt_handler_bulk_fn handler) {
+        uint16_t i, start, chunk, nb_ret;
+        uint64_t start_tsc;
+        int ret_act;
+
+        // TODO: dummy assertion
+        RTE_ASSERT(ONVM_BULK_HANDLER_MAX_PKTS <= sizeof(int) * 8);
+        /* Give packets to the user bulk proccessing function, its int bitmap
+         * only covers ONVM_BULK_HANDLER_MAX_PKTS packets per call */
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_dequeue((struct rte_mbuf **)pkts, nb_pkts, nf_local_ctx->nf->service_id);
+        start_tsc = rte_get_tsc_cycles();
+        for (start = 0, nb_ret = 0; start < nb_pkts; start += ONVM_BULK_HANDLER_MAX_PKTS) {
+                chunk = RTE_MIN(nb_pkts - start, ONVM_BULK_HANDLER_MAX_PKTS);
+                ret_act = (*handler)((struct rte_mbuf **)&pkts[start], chunk, nf_local_ctx);
+
+                for (i = 0; i < chunk; i++) {
+                        /* NF returns 0 to return packets or 1 to buffer */
+                        if (likely((ret_act & (1 << i)) == 0)) {
+                                pkts[nb_ret++] = pkts[start + i];
+                        } else {
+                                nf_local_ctx->nf->stats.tx_buffer++;
+                        }
+                }
+        }
+        onvm_nflib_account_batch(nf_local_ctx->nf, start_tsc, nb_pkts);
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_done((struct rte_mbuf **)pkts, nb_ret);
+
+        return nb_ret;
+}
+
+static inline uint16_t
+onvm_nflib_call_burst_handler(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx,
+                              nf_pkt_handler_burst_fn handler) {
+        uint16_t i, nb_ret;
+        uint64_t buffered[ONVM_BURST_BITMAP_WORDS];
+        uint64_t start;
+
+        /* Give the whole burst to the user burst proccessing function */
+        memset(buffered, 0, sizeof(uint64_t) * ((nb_pkts + 63) / 64));
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_dequeue((struct rte_mbuf **)pkts, nb_pkts, nf_local_ctx->nf->service_id);
+        start = rte_get_tsc_cycles();
+        (*handler)((struct rte_mbuf **)pkts, nb_pkts, buffered, nf_local_ctx);
+        onvm_nflib_account_batch(nf_local_ctx->nf, start, nb_pkts);
+
+        for (i = 0, nb_ret = 0; i < nb_pkts; i++) {
+                if (likely(!onvm_burst_bitmap_test(buffered, i))) {
+                        pkts[nb_ret++] = pkts[i];
                 } else {
-                        nf->stats.tx_buffer++;
+                        nf_local_ctx->nf->stats.tx_buffer++;
                 }
         }
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_hop_done((struct rte_mbuf **)pkts, nb_ret);
+
+        return nb_ret;
+}
+
+static inline uint16_t
+onvm_nflib_handle_pkts(void **pkts, uint16_t nb_pkts, struct onvm_nf_local_ctx *nf_local_ctx) {
+        struct onvm_nf_function_table *function_table;
+
+        function_table = nf_local_ctx->nf->function_table;
+        if (function_table->pkt_burst_handler != NULL)
+                return onvm_nflib_call_burst_handler(pkts, nb_pkts, nf_local_ctx, function_table->pkt_burst_handler);
+        return onvm_nflib_call_bulk_handler(pkts, nb_pkts, nf_local_ctx, function_table->pkt_bulk_handler);
+}
 
+static void
+onvm_nflib_fused_run_stage(struct onvm_nf_local_ctx *nf_local_ctx, uint16_t stage, struct rte_mbuf **pkts) {
+        struct onvm_nf_local_ctx *stage_ctx;
+        struct onvm_nf *nf;
+        uint16_t nb_pkts, max_pkts;
+
+        stage_ctx = stage == 0 ? nf_local_ctx : nf_local_ctx->fused[stage - 1];
+        nf = stage_ctx->nf;
+
+        /* Only take what can be handed on, leave the rest on rx_q as backpressure */
+        max_pkts = onvm_nflib_dequeue_budget(nf, nf->nf_tx_mgr->to_tx_buf);
+        if (unlikely(max_pkts == 0))
+                return;
+
+        nb_pkts = onvm_nflib_dequeue_rx(nf, (void **)pkts, max_pkts);
+        if (nb_pkts == 0)
+                return;
+
+        nb_pkts = onvm_nflib_handle_pkts((void **)pkts, nb_pkts, stage_ctx);
+        onvm_nflib_fused_hand_on(nf_local_ctx, stage, pkts, nb_pkts);
+}
+
+static void
+onvm_nflib_fused_hand_on(struct onvm_nf_local_ctx *nf_local_ctx, uint16_t stage, struct rte_mbuf **pkts,
+                         uint16_t nb_pkts) {
+        struct rte_mbuf *next_buf[ONVM_MAX_BURST_SIZE];
+        struct rte_mbuf **next_pkts, **tmp;
+        struct onvm_nf_local_ctx *cur_ctx, *next_ctx;
+        struct onvm_nf *cur, *next;
+        struct onvm_pkt_meta *meta;
+        uint16_t i, nb_next, nb_rest;
+
+        cur_ctx = stage == 0 ? nf_local_ctx : nf_local_ctx->fused[stage - 1];
+        next_pkts = next_buf;
+
+        for (; nb_pkts > 0 && stage < nf_local_ctx->num_fused; stage++) {
+                next_ctx = nf_local_ctx->fused[stage];
+                cur = cur_ctx->nf;
+                next = next_ctx->nf;
+
+                /* Chain hops to the next stage's service are direct handoffs too */
+                onvm_pkt_resolve_next(pkts, nb_pkts);
+
+                /* Split off what goes to the next stage's service */
+                for (i = 0, nb_next = 0, nb_rest = 0; i < nb_pkts; i++) {
+                        meta = onvm_get_pkt_meta(pkts[i]);
+                        /* Branch clones go back through the merge */
+                        if (meta->action == ONVM_NF_ACTION_TONF && meta->destination == next->service_id &&
+                            !ONVM_CHECK_BIT(meta->flags, ONVM_PKT_BRANCH_BIT)) {
+                                meta->src = cur->instance_id;
+                                next_pkts[nb_next++] = pkts[i];
+                        } else {
+                                pkts[nb_rest++] = pkts[i];
+                        }
+                }
+                if (nb_rest > 0)
+                        onvm_pkt_process_tx_batch(cur->nf_tx_mgr, pkts, nb_rest, cur);
+                if (nb_next == 0)
+                        return;
+
+                /* Same accounting as a pass through the rings */
+                cur->stats.act_tonf += nb_next;
+                cur->stats.tx += nb_next;
+                next->stats.rx += nb_next;
+
+                nb_pkts = onvm_nflib_handle_pkts((void **)next_pkts, nb_next, next_ctx);
+                tmp = pkts;
+                pkts = next_pkts;
+                next_pkts = tmp;
+                cur_ctx = next_ctx;
+        }
+
+        if (nb_pkts > 0)
+                onvm_pkt_process_tx_batch(cur_ctx->nf->nf_tx_mgr, pkts, nb_pkts, cur_ctx->nf);
+}
+
+static void
+onvm_nflib_fused_poll(struct onvm_nf_local_ctx *nf_local_ctx, struct rte_mbuf **pkts) {
+        struct onvm_nf_local_ctx *fused_ctx;
+        struct onvm_nf *nf;
+        uint16_t i;
+
+        for (i = 0; i < nf_local_ctx->num_fused; i++) {
+                fused_ctx = nf_local_ctx->fused[i];
+                nf = fused_ctx->nf;
+
+                /* Packets other NFs sent it through its rings */
+                onvm_nflib_fused_run_stage(nf_local_ctx, i + 1, pkts);
+
+                /* Flush the packet buffers */
+                onvm_pkt_enqueue_tx_thread(nf->nf_tx_mgr->to_tx_buf, nf);
+                onvm_pkt_flush_all_nfs(nf->nf_tx_mgr, nf);
+                onvm_pkt_flush_all_ports(nf->nf_tx_mgr);
+
+                onvm_nflib_dequeue_messages(fused_ctx);
+                if (nf->function_table->user_actions != ONVM_NO_CALLBACK &&
+                    (*nf->function_table->user_actions)(fused_ctx))
+                        rte_atomic16_set(&fused_ctx->keep_running, 0);
+
+                /* The thread is shared, so one fused NF stopping stops them all */
+                if (unlikely(!rte_atomic16_read(&fused_ctx->keep_running)))
+                        rte_atomic16_set(&nf_local_ctx->keep_running, 0);
+        }
+}
+
+static inline uint16_t
+onvm_nflib_hand_on(struct onvm_nf *nf, void **pkts, uint16_t nb_pkts) {
+        struct packet_buf *tx_buf;
+        uint16_t i;
+
+        /* Taps only look, their packets are clones that go nowhere */
+        if (unlikely(nf->flags.tap_service != 0)) {
+                for (i = 0; i < nb_pkts; i++)
+                        onvm_pkt_discard(pkts[i]);
+                return 0;
+        }
+
+        /* The caller routes them itself */
         if (ONVM_NF_HANDLE_TX) {
                 return nb_pkts;
         }
 
-        onvm_pkt_enqueue_tx_thread(&tx_buf, nf);
+        tx_buf = nf->nf_tx_mgr->to_tx_buf;
+        for (i = 0; i < nb_pkts; i++)
+                tx_buf->buffer[tx_buf->count++] = pkts[i];
+        onvm_pkt_enqueue_tx_thread(tx_buf, nf);
         return 0;
 }
 
+static inline uint16_t
+onvm_nflib_dequeue_rx(struct onvm_nf *nf, void **pkts, uint16_t max_pkts) {
+        uint16_t i, hi_max, nb_hi, nb_lo;
+        uint64_t now, delay;
+
+        hi_max = max_pkts;
+        if (nf->flags.rx_hi_weight)
+                hi_max = RTE_MAX((uint32_t)max_pkts * nf->flags.rx_hi_weight / (nf->flags.rx_hi_weight + 1), 1U);
+
+        nb_hi = rte_ring_dequeue_burst(nf->rx_q_hi, pkts, hi_max, NULL);
+        nb_lo = rte_ring_dequeue_burst(nf->rx_q, pkts + nb_hi, max_pkts - nb_hi, NULL);
+        if (unlikely(nb_hi == hi_max && nb_hi + nb_lo < max_pkts)) {
+                /* rx_q ran dry, keep the high priority packets in front */
+                memmove(pkts + max_pkts - nb_lo, pkts + nb_hi, nb_lo * sizeof(void *));
+                nb_hi += rte_ring_dequeue_burst(nf->rx_q_hi, pkts + nb_hi, max_pkts - nb_hi - nb_lo, NULL);
+                memmove(pkts + nb_hi, pkts + max_pkts - nb_lo, nb_lo * sizeof(void *));
+        }
+        if (nb_hi + nb_lo == 0)
+                return 0;
+
+        nf->stats.rx_prio[ONVM_RX_PRIO_HIGH].dequeued += nb_hi;
+        nf->stats.rx_prio[ONVM_RX_PRIO_LOW].dequeued += nb_lo;
+        /* Packets are only stamped when the manager shows the delay */
+        if (likely(!onvm_config->flags.ONVM_RX_DELAY_STATS))
+                return nb_hi + nb_lo;
+
+        now = rte_get_tsc_cycles();
+        if (unlikely(nb_hi > 0)) {
+                for (delay = 0, i = 0; i < nb_hi; i++)
+                        delay += now - ((struct rte_mbuf *)pkts[i])->timestamp;
+                nf->stats.rx_prio[ONVM_RX_PRIO_HIGH].delay_cycles += delay;
+        }
+        for (delay = 0, i = nb_hi; i < nb_hi + nb_lo; i++)
+                delay += now - ((struct rte_mbuf *)pkts[i])->timestamp;
+        nf->stats.rx_prio[ONVM_RX_PRIO_LOW].delay_cycles += delay;
+
+        return nb_hi + nb_lo;
+}
+
+static inline void
+onvm_nflib_account_batch(struct onvm_nf *nf, uint64_t start, uint16_t nb_pkts) {
+        uint64_t cycles;
+
+        cycles = rte_get_tsc_cycles() - start;
+        nf->stats.cycles.handler += cycles;
+        nf->stats.cycles.pkts += nb_pkts;
+        nf->stats.cycles.batches++;
+        nf->stats.cycles.batch_hist[onvm_cycle_hist_bucket(cycles)]++;
+}
+
+static inline void
+onvm_nflib_loop_cycles(struct onvm_nf_local_ctx *nf_local_ctx, uint64_t *handler, uint64_t *batches) {
+        uint16_t i;
+
+        *handler = nf_local_ctx->nf->stats.cycles.handler;
+        *batches = nf_local_ctx->nf->stats.cycles.batches;
+        for (i = 0; i < nf_local_ctx->num_fused; i++) {
+                *handler += nf_local_ctx->fused[i]->nf->stats.cycles.handler;
+                *batches += nf_local_ctx->fused[i]->nf->stats.cycles.batches;
+        }
+}
+
+static inline void
+onvm_nflib_account_loop(struct onvm_nf_local_ctx *nf_local_ctx, uint64_t start, uint64_t handler,
+                        uint64_t batches) {
+        uint64_t cycles, handler_now, batches_now;
+
+        cycles = rte_get_tsc_cycles() - start;
+        onvm_nflib_loop_cycles(nf_local_ctx, &handler_now, &batches_now);
+        /* Fused NFs have no loop of their own, the leader gets it all */
+        if (batches_now != batches)
+                nf_local_ctx->nf->stats.cycles.tx += cycles - (handler_now - handler);
+        else
+                nf_local_ctx->nf->stats.cycles.idle += cycles;
+}
+
 static inline void
 onvm_nflib_dequeue_messages(struct onvm_nf_local_ctx *nf_local_ctx) {
         struct onvm_nf_msg *msg;
@@ -1087,7 +1656,9 @@ onvm_nflib_handle_signal(int sig) {
 static int
 onvm_nflib_is_scale_info_valid(struct onvm_nf_scale_info *scale_info) {
         return scale_info->nf_init_cfg->service_id != 0 && scale_info->function_table != NULL &&
-               scale_info->function_table->pkt_handler != NULL;
+               (scale_info->function_table->pkt_handler != NULL ||
+                scale_info->function_table->pkt_bulk_handler != NULL ||
+                scale_info->function_table->pkt_burst_handler != NULL);
 }
 
 
@@ -1098,6 +1669,16 @@ onvm_nflib_nf_tx_mgr_init(struct onvm_nf *nf) {
         nf->nf_tx_mgr->to_tx_buf = calloc(1, sizeof(struct packet_buf));
         nf->nf_tx_mgr->id = nf->instance_id;
         nf->nf_tx_mgr->nf_rx_bufs = calloc(MAX_NFS, sizeof(struct packet_buf));
+        nf->nf_tx_mgr->flush_deadline_cycles =
+                (uint64_t)onvm_config->flush_deadline_us * rte_get_timer_hz() / US_PER_S;
+        nf->nf_tx_mgr->flush_stats = &nf->stats.flush;
+        nf->nf_tx_mgr->burst_size = nf->flags.burst_size;
+        /* Packets sent out a port skip the TX threads if the manager gave us a NIC TX queue */
+        if (nf->nic_tx_queue != 0) {
+                nf->nf_tx_mgr->nic_tx_bufs = calloc(RTE_MAX_ETHPORTS, sizeof(struct packet_buf));
+                nf->nf_tx_mgr->nic_tx_queue = nf->nic_tx_queue;
+                RTE_LOG(INFO, APP, "Sending directly on NIC TX queue %u\n", nf->nic_tx_queue);
+        }
 }
 
 static void
@@ -1109,7 +1690,12 @@ onvm_nflib_usage(const char *progname) {
             "[-t <time_to_live>] "
             "[-l <pkt_limit>] "
             "[-m (manual core assignment flag)] "
-            "[-s (share core flag)]\n\n",
+            "[-s (share core flag)] "
+            "[-x (own NIC TX queue flag)] "
+            "[-p <high priority RX weight>] "
+            "[-b <burst size>] "
+            "[-a <tapped service_id>[:<1 in N sample>]] "
+            "[-c <max children the manager may scale out to>]\n\n",
             progname);
 }
 
@@ -1118,9 +1704,10 @@ onvm_nflib_parse_args(int argc, char *argv[], struct onvm_nf_init_cfg *nf_init_c
         const char *progname = argv[0];
         int c, initial_instance_id;
         int service_id = -1;
+        char *end = NULL;
 
         opterr = 0;
-        while ((c = getopt (argc, argv, "n:r:t:l:ms")) != -1)
+        while ((c = getopt (argc, argv, "n:r:t:l:msxp:b:a:c:")) != -1)
                 switch (c) {
                         case 'n':
                                 initial_instance_id = (uint16_t)strtoul(optarg, NULL, 10);
@@ -1153,6 +1740,39 @@ onvm_nflib_parse_args(int argc, char *argv[], struct onvm_nf_init_cfg *nf_init_c
                         case 's':
                                 nf_init_cfg->init_options = ONVM_SET_BIT(nf_init_cfg->init_options, SHARE_CORE_BIT);
                                 break;
+                        case 'x':
+                                nf_init_cfg->init_options = ONVM_SET_BIT(nf_init_cfg->init_options, NIC_TX_QUEUE_BIT);
+                                break;
+                        case 'p':
+                                nf_init_cfg->rx_hi_weight = (uint16_t)strtoul(optarg, NULL, 10);
+                                break;
+                        case 'b':
+                                nf_init_cfg->burst_size = (uint16_t)strtoul(optarg, NULL, 10);
+                                if (nf_init_cfg->burst_size == 0 || nf_init_cfg->burst_size > ONVM_MAX_BURST_SIZE) {
+                                        fprintf(stderr, "Burst size must be between 1 and %u\n",
+                                                ONVM_MAX_BURST_SIZE);
+                                        return -1;
+                                }
+                                break;
+                        case 'a':
+                                nf_init_cfg->tap_service = (uint16_t)strtoul(optarg, &end, 10);
+                                if (*end == ':')
+                                        nf_init_cfg->tap_sample = (uint16_t)strtoul(end + 1, &end, 10);
+                                if (*end != '\0' || nf_init_cfg->tap_service == 0 || nf_init_cfg->tap_sample == 0) {
+                                        fprintf(stderr, "Tap must be a nonzero service ID, optionally with a "
+                                                        "nonzero sample rate\n");
+                                        return -1;
+                                }
+                                break;
+                        case 'c':
+                                nf_init_cfg->autoscale_max = (uint16_t)strtoul(optarg, &end, 10);
+                                if (*end != '\0' || nf_init_cfg->autoscale_max == 0 ||
+                                    nf_init_cfg->autoscale_max >= MAX_NFS_PER_SERVICE) {
+                                        fprintf(stderr, "Autoscale children must be between 1 and %d\n",
+                                                MAX_NFS_PER_SERVICE - 1);
+                                        return -1;
+                                }
+                                break;
                         case '?':
                                 onvm_nflib_usage(progname);
                                 if (optopt == 'n')
@@ -1247,6 +1867,10 @@ onvm_nflib_cleanup(struct onvm_nf_local_ctx *nf_local_ctx) {
                         free(nf->nf_tx_mgr->nf_rx_bufs);
                         nf->nf_tx_mgr->nf_rx_bufs = NULL;
                 }
+                if (nf->nf_tx_mgr->nic_tx_bufs != NULL) {
+                        free(nf->nf_tx_mgr->nic_tx_bufs);
+                        nf->nf_tx_mgr->nic_tx_bufs = NULL;
+                }
                 free(nf->nf_tx_mgr);
                 nf->nf_tx_mgr = NULL;
         }
@@ -149,11 +149,25 @@ onvm_nflib_return_pkt(struct onvm_nf *nf, struct rte_mbuf *pkt);
  * @param count
  *    the number of packets contained within the buffer.
  * @return
- *    0 on success, or a negative value on error (-1 if bad arguments, -ENOBUFS if enqueue fails).
+ *    0 on success, or a negative value on error (-1 if bad arguments, -ENOBUFS if
+ *    tx_q had no room for some of the packets; only those are dropped).
  */
 int
 onvm_nflib_return_pkt_bulk(struct onvm_nf *nf, struct rte_mbuf **pkts, uint16_t count);
 
+/**
+ * Check if another NF is falling behind on its RX queue. Senders set this
+ * when the NF's rx_q fills up and clear it once it has drained, so NFs that
+ * generate traffic can slow down instead of having packets dropped.
+ *
+ * @param instance_id
+ *    the instance ID of the NF to check.
+ * @return
+ *    1 if the NF is congested, 0 otherwise or if no such NF is running.
+ */
+int
+onvm_nflib_nf_is_congested(uint16_t instance_id);
+
 /**
  * Inform the manager that the NF is ready to receive packets.
  * This only needs to be called when the NF is using advanced rings
@@ -175,6 +189,26 @@ onvm_nflib_nf_ready(struct onvm_nf *nf);
 int
 onvm_nflib_start_nf(struct onvm_nf_local_ctx *nf_local_ctx, struct onvm_nf_init_cfg *nf_init_cfg);
 
+/**
+ * Start another NF that runs to completion in the thread of this one. Packets
+ * this NF sends to the service of the fused NF are handed to its handler
+ * directly instead of through its RX ring. Fusing several NFs chains them in
+ * the order they were fused. Call after onvm_nflib_start_nf and before
+ * onvm_nflib_run.
+ *
+ * @param nf_local_ctx
+ *   Pointer to a context struct of the leader NF.
+ * @param nf_init_cfg
+ *   Init config of the fused NF, see onvm_nflib_init_nf_init_cfg.
+ * @param nf_function_table
+ *   Function table of the fused NF, it needs a bulk or burst packet handler.
+ * @return
+ *   0 on success, or a negative value on error.
+ */
+int
+onvm_nflib_fuse(struct onvm_nf_local_ctx *nf_local_ctx, struct onvm_nf_init_cfg *nf_init_cfg,
+                struct onvm_nf_function_table *nf_function_table);
+
 /**
  * Process an message. Does stuff.
  *
@@ -51,26 +51,31 @@
 /**********************Internal Functions Prototypes**************************/
 
 /*
- * Function to enqueue a packet on one port's queue.
+ * Function to enqueue a packet on one port's queue. TX threads and NFs with
+ * a NIC TX queue of their own buffer it per port, other NFs hand it to their
+ * TX thread.
  *
  * Inputs : a pointer to the tx queue responsible
  *          the number of the port
  *          a pointer to the packet
+ *          a pointer to the NF involved
  *
  */
 static inline void
-onvm_pkt_enqueue_port(struct queue_mgr *tx_mgr, uint16_t port, struct rte_mbuf *buf);
+onvm_pkt_enqueue_port(struct queue_mgr *tx_mgr, uint16_t port, struct rte_mbuf *buf, struct onvm_nf *nf);
 
 /*
  * Function to process a single packet.
  *
  * Inputs : a pointer to the tx queue responsible
  *          a pointer to the packet
+ *          a pointer to the packet's flow entry, or NULL to use the default chain
  *          a pointer to the NF involved
  *
  */
 static inline void
-onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_nf *nf);
+onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_flow_entry *flow_entry,
+                             struct onvm_nf *nf);
 
 /*
  * Helper function to drop a packet.
@@ -83,18 +88,110 @@ onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, str
 static int
 onvm_pkt_drop(struct rte_mbuf *pkt);
 
+/*
+ * Helper function to track whether an NF's RX ring is congested. Uses some
+ * hysteresis so the shared flag only changes on real transitions.
+ *
+ * Input : the destination NF, the number of packets that did not fit and
+ *         the free space left in its rx_q
+ *
+ */
+static inline void
+onvm_pkt_update_rx_congestion(struct onvm_nf *nf, uint16_t unsent, unsigned int free_space);
+
+/*
+ * Helper function to hand a high priority packet straight to an NF's
+ * rx_q_hi. These are few and latency critical, so they skip the buffers.
+ *
+ */
+static inline void
+onvm_pkt_enqueue_nf_hi(struct onvm_nf *nf, struct rte_mbuf *pkt, struct onvm_nf *source_nf);
+
+/*
+ * Helper function to give the taps of a service a clone of a packet sent to
+ * it. Taps never hold the packet up: a tap whose ring is full, or that is
+ * not due for a sample, is skipped.
+ *
+ */
+static void
+onvm_pkt_tap(struct queue_mgr *tx_mgr, uint16_t service_id, struct rte_mbuf *pkt);
+
+/*
+ * Helper function giving the buffer a queue manager collects packets for a
+ * port in, or NULL if it hands them to a TX thread instead.
+ *
+ */
+static inline struct packet_buf *
+onvm_pkt_port_buf(struct queue_mgr *tx_mgr, uint16_t port);
+
+/*
+ * Helper function to add a packet to a buffer, noting when the buffer's
+ * oldest packet came in if a flush deadline is set.
+ *
+ */
+static inline void
+onvm_pkt_buf_add(struct queue_mgr *tx_mgr, struct packet_buf *buf, struct rte_mbuf *pkt);
+
+/*
+ * Helper function checking if a buffer should be sent at the end of a poll
+ * loop: always without a flush deadline, else once its oldest packet is due.
+ *
+ */
+static inline int
+onvm_pkt_buf_due(struct queue_mgr *tx_mgr, struct packet_buf *buf, uint64_t now);
+
+/*
+ * Helper function to count a flush and the packets it sent.
+ *
+ */
+static inline void
+onvm_pkt_count_flush(struct queue_mgr *tx_mgr, enum onvm_flush_reason reason, uint16_t pkts);
+
+/*
+ * Helper functions sending the NF or port buffers that are due, or all of
+ * them if force is set.
+ *
+ */
+static void
+onvm_pkt_flush_nfs(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf, int force);
+
+static void
+onvm_pkt_flush_ports(struct queue_mgr *tx_mgr, int force);
+
 /**********************************Interfaces*********************************/
 
 void
 onvm_pkt_process_tx_batch(struct queue_mgr *tx_mgr, struct rte_mbuf *pkts[], uint16_t tx_count, struct onvm_nf *nf) {
-        uint16_t i;
+        uint16_t i, next_count, next_index;
         struct onvm_pkt_meta *meta;
-        struct packet_buf *out_buf;
+        struct rte_mbuf *next_pkts[ONVM_MAX_BURST_SIZE];
+        struct onvm_flow_entry *flow_entries[ONVM_MAX_BURST_SIZE];
 
         if (tx_mgr == NULL || pkts == NULL || nf == NULL)
                 return;
 
+        /* Resolve all ONVM_NF_ACTION_NEXT packets with a single bulk flow lookup.
+         * Returned branch clones are merged first, only the last one of a
+         * packet brings it back */
+        next_count = 0;
         for (i = 0; i < tx_count; i++) {
+                meta = onvm_get_pkt_meta(pkts[i]);
+                if (unlikely(ONVM_CHECK_BIT(meta->flags, ONVM_PKT_BRANCH_BIT))) {
+                        pkts[i] = onvm_pkt_join_branch(pkts[i], nf);
+                        if (pkts[i] == NULL)
+                                continue;
+                        meta = onvm_get_pkt_meta(pkts[i]);
+                }
+                if (meta->action == ONVM_NF_ACTION_NEXT)
+                        next_pkts[next_count++] = pkts[i];
+        }
+        if (next_count > 0)
+                onvm_flow_dir_get_pkt_bulk(next_pkts, next_count, flow_entries);
+
+        next_index = 0;
+        for (i = 0; i < tx_count; i++) {
+                if (pkts[i] == NULL)
+                        continue;
                 meta = (struct onvm_pkt_meta *)&(((struct rte_mbuf *)pkts[i])->udata64);
                 meta->src = nf->instance_id;
                 if (meta->action == ONVM_NF_ACTION_DROP) {
@@ -106,21 +203,13 @@ onvm_pkt_process_tx_batch(struct queue_mgr *tx_mgr, struct rte_mbuf *pkts[], uin
                         /* TODO: Here we drop the packet : there will be a flow table
                         in the future to know what to do with the packet next */
                         nf->stats.act_next++;
-                        onvm_pkt_process_next_action(tx_mgr, pkts[i], nf);
+                        onvm_pkt_process_next_action(tx_mgr, pkts[i], flow_entries[next_index++], nf);
                 } else if (meta->action == ONVM_NF_ACTION_TONF) {
                         nf->stats.act_tonf++;
                         onvm_pkt_enqueue_nf(tx_mgr, meta->destination, pkts[i], nf);
                 } else if (meta->action == ONVM_NF_ACTION_OUT) {
                         nf->stats.act_out++;
-                        if (tx_mgr->mgr_type_t == MGR) {
-                                onvm_pkt_enqueue_port(tx_mgr, meta->destination, pkts[i]);
-                        } else {
-                                out_buf = tx_mgr->to_tx_buf;
-                                out_buf->buffer[out_buf->count++] = pkts[i];
-                                if (out_buf->count == PACKET_READ_SIZE) {
-                                        onvm_pkt_enqueue_tx_thread(out_buf, nf);
-                                }
-                        }
+                        onvm_pkt_enqueue_port(tx_mgr, meta->destination, pkts[i], nf);
                 } else {
                         printf("ERROR invalid action : this shouldn't happen.\n");
                         onvm_pkt_drop(pkts[i]);
@@ -129,22 +218,65 @@ onvm_pkt_process_tx_batch(struct queue_mgr *tx_mgr, struct rte_mbuf *pkts[], uin
         }
 }
 
+void
+onvm_pkt_resolve_next(struct rte_mbuf *pkts[], uint16_t count) {
+        uint16_t i, next_count;
+        uint8_t action;
+        struct onvm_pkt_meta *meta;
+        struct onvm_service_chain *sc;
+        struct rte_mbuf *next_pkts[ONVM_MAX_BURST_SIZE];
+        struct onvm_flow_entry *flow_entries[ONVM_MAX_BURST_SIZE];
+
+        next_count = 0;
+        for (i = 0; i < count; i++) {
+                meta = onvm_get_pkt_meta(pkts[i]);
+                if (meta->action == ONVM_NF_ACTION_NEXT && !ONVM_CHECK_BIT(meta->flags, ONVM_PKT_BRANCH_BIT))
+                        next_pkts[next_count++] = pkts[i];
+        }
+        if (next_count == 0)
+                return;
+        onvm_flow_dir_get_pkt_bulk(next_pkts, next_count, flow_entries);
+
+        for (i = 0; i < next_count; i++) {
+                sc = flow_entries[i] != NULL && flow_entries[i]->sc != NULL ? flow_entries[i]->sc : default_chain;
+                action = onvm_sc_next_action(sc, next_pkts[i]);
+                /* Forking needs the chain, which only the lookup gives */
+                if (action == ONVM_NF_ACTION_PARALLEL)
+                        continue;
+
+                meta = onvm_get_pkt_meta(next_pkts[i]);
+                if (flow_entries[i] != NULL)
+                        onvm_set_pkt_prio(next_pkts[i], sc->rx_prio);
+                meta->action = action;
+                meta->destination = onvm_sc_next_destination(sc, next_pkts[i]);
+                (meta->chain_index)++;
+        }
+}
+
 void
 onvm_pkt_flush_all_nfs(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf) {
-        uint16_t i;
+        onvm_pkt_flush_nfs(tx_mgr, source_nf, 0);
+}
 
-        if (tx_mgr == NULL)
-                return;
+void
+onvm_pkt_flush_all_ports(struct queue_mgr *tx_mgr) {
+        onvm_pkt_flush_ports(tx_mgr, 0);
+}
 
-        for (i = 0; i < MAX_NFS; i++)
-                onvm_pkt_flush_nf_queue(tx_mgr, i, source_nf);
+void
+onvm_pkt_flush_all_idle(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf) {
+        onvm_pkt_flush_ports(tx_mgr, 1);
+        onvm_pkt_flush_nfs(tx_mgr, source_nf, 1);
 }
 
 void
-onvm_pkt_flush_nf_queue(struct queue_mgr *tx_mgr, uint16_t nf_id, struct onvm_nf *source_nf) {
-        uint16_t i;
+onvm_pkt_flush_nf_queue(struct queue_mgr *tx_mgr, uint16_t nf_id, struct onvm_nf *source_nf,
+                        enum onvm_flush_reason reason) {
+        uint16_t i, sent;
+        unsigned int free_space;
         struct onvm_nf *nf;
         struct packet_buf *nf_buf;
+        uint64_t now;
 
         if (tx_mgr == NULL)
                 return;
@@ -159,19 +291,25 @@ onvm_pkt_flush_nf_queue(struct queue_mgr *tx_mgr, uint16_t nf_id, struct onvm_nf
         if (!onvm_nf_is_valid(nf))
                 return;
 
-        if (rte_ring_enqueue_bulk(nf->rx_q, (void **)nf_buf->buffer, nf_buf->count, NULL) == 0) {
-                for (i = 0; i < nf_buf->count; i++) {
-                        onvm_pkt_drop(nf_buf->buffer[i]);
-                }
-                nf->stats.rx_drop += nf_buf->count;
-                if (source_nf != NULL)
-                        source_nf->stats.tx_drop += nf_buf->count;
-        } else {
-                nf->stats.rx += nf_buf->count;
-                if (source_nf != NULL)
-                        source_nf->stats.tx += nf_buf->count;
+        /* Stamped so the NF can tell how long they sat in its ring */
+        if (unlikely(onvm_config->flags.ONVM_RX_DELAY_STATS)) {
+                now = rte_get_tsc_cycles();
+                for (i = 0; i < nf_buf->count; i++)
+                        nf_buf->buffer[i]->timestamp = now;
         }
-        nf_buf->count = 0;
+
+        sent = rte_ring_enqueue_burst(nf->rx_q, (void **)nf_buf->buffer, nf_buf->count, &free_space);
+        onvm_pkt_count_flush(tx_mgr, reason, sent);
+        nf->stats.rx += sent;
+        nf->stats.rx_prio[ONVM_RX_PRIO_LOW].rx += sent;
+        if (source_nf != NULL)
+                source_nf->stats.tx += sent;
+        onvm_pkt_update_rx_congestion(nf, nf_buf->count - sent, free_space);
+
+        /* Whatever did not fit stays buffered for the next flush */
+        if (unlikely(sent < nf_buf->count))
+                memmove(nf_buf->buffer, &nf_buf->buffer[sent], (nf_buf->count - sent) * sizeof(struct rte_mbuf *));
+        nf_buf->count -= sent;
 }
 
 void
@@ -184,8 +322,14 @@ onvm_pkt_enqueue_nf(struct queue_mgr *tx_mgr, uint16_t dst_service_id, struct rt
         if (tx_mgr == NULL || pkt == NULL)
                 return;
 
+        if (unlikely(dst_service_id < MAX_SERVICES && service_taps[dst_service_id].count > 0))
+                onvm_pkt_tap(tx_mgr, dst_service_id, pkt);
+
         // map service to instance and check one exists
-        dst_instance_id = onvm_sc_service_to_nf_map(dst_service_id, pkt);
+        if (onvm_config->flags.ONVM_LOAD_AWARE_DISPATCH)
+                dst_instance_id = onvm_sc_service_to_nf_map_load_aware(dst_service_id, pkt, tx_mgr->flow_affinity);
+        else
+                dst_instance_id = onvm_sc_service_to_nf_map(dst_service_id, pkt);
         if (dst_instance_id == 0) {
                 onvm_pkt_drop(pkt);
                 if (source_nf != NULL)
@@ -202,28 +346,56 @@ onvm_pkt_enqueue_nf(struct queue_mgr *tx_mgr, uint16_t dst_service_id, struct rt
                 return;
         }
 
+        if (unlikely(onvm_get_pkt_prio(pkt) == ONVM_RX_PRIO_HIGH)) {
+                onvm_pkt_enqueue_nf_hi(nf, pkt, source_nf);
+                return;
+        }
+
         nf_buf = &tx_mgr->nf_rx_bufs[dst_instance_id];
-        nf_buf->buffer[nf_buf->count++] = pkt;
-        if (nf_buf->count == PACKET_READ_SIZE) {
-                onvm_pkt_flush_nf_queue(tx_mgr, dst_instance_id, source_nf);
+        if (unlikely(nf_buf->count == tx_mgr->burst_size)) {
+                /* Still full of packets the NF had no room for. A congested NF
+                 * is retried on the next flush, so don't touch its ring again */
+                if (!nf->rx_congested)
+                        onvm_pkt_flush_nf_queue(tx_mgr, dst_instance_id, source_nf, ONVM_FLUSH_FULL);
+                if (nf_buf->count == tx_mgr->burst_size) {
+                        onvm_pkt_drop(pkt);
+                        nf->stats.rx_drop++;
+                        nf->stats.rx_prio[ONVM_RX_PRIO_LOW].rx_drop++;
+                        if (source_nf != NULL)
+                                source_nf->stats.tx_drop++;
+                        return;
+                }
+        }
+        if (!nf_buf->dirty) {
+                nf_buf->dirty = 1;
+                tx_mgr->nf_rx_dirty[tx_mgr->nf_rx_dirty_count++] = dst_instance_id;
+        }
+        onvm_pkt_buf_add(tx_mgr, nf_buf, pkt);
+        if (nf_buf->count == tx_mgr->burst_size) {
+                onvm_pkt_flush_nf_queue(tx_mgr, dst_instance_id, source_nf, ONVM_FLUSH_FULL);
         }
 }
 
 void
-onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port) {
-        uint16_t i, sent;
+onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port, enum onvm_flush_reason reason) {
+        uint16_t i, sent, queue_id;
         volatile struct tx_stats *tx_stats;
         struct packet_buf *port_buf;
 
-        if (tx_mgr == NULL || tx_mgr->mgr_type_t != MGR)
+        if (tx_mgr == NULL)
                 return;
 
-        port_buf = &tx_mgr->tx_thread_info->port_tx_bufs[port];
-        if (port_buf->count == 0)
+        port_buf = onvm_pkt_port_buf(tx_mgr, port);
+        if (port_buf == NULL || port_buf->count == 0)
                 return;
 
         tx_stats = &(ports->tx_stats);
-        sent = rte_eth_tx_burst(port, tx_mgr->id, port_buf->buffer, port_buf->count);
+        queue_id = tx_mgr->mgr_type_t == MGR ? tx_mgr->id : tx_mgr->nic_tx_queue;
+        /* The NIC owns the packets once sent, so traces end just before */
+        if (unlikely(trace_stats != NULL))
+                onvm_trace_egress(port_buf->buffer, port_buf->count);
+        sent = rte_eth_tx_burst(port, queue_id, port_buf->buffer, port_buf->count);
+        onvm_pkt_count_flush(tx_mgr, reason, sent);
         if (unlikely(sent < port_buf->count)) {
                 for (i = sent; i < port_buf->count; i++) {
                         onvm_pkt_drop(port_buf->buffer[i]);
@@ -231,64 +403,215 @@ onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port) {
                 tx_stats->tx_drop[port] += (port_buf->count - sent);
         }
         tx_stats->tx[port] += sent;
+        if (tx_mgr->mgr_type_t == NF) {
+                /* The NF did the TX thread's job, account it there too */
+                nfs[tx_mgr->id].stats.tx += sent;
+                nfs[tx_mgr->id].stats.tx_drop += port_buf->count - sent;
+        }
 
         port_buf->count = 0;
 }
 
 void
 onvm_pkt_enqueue_tx_thread(struct packet_buf *pkt_buf, struct onvm_nf *nf) {
-        uint16_t i;
+        uint16_t sent;
 
         if (pkt_buf->count == 0)
                 return;
 
-        if (unlikely(pkt_buf->count > 0 &&
-                     rte_ring_enqueue_bulk(nf->tx_q, (void **)pkt_buf->buffer, pkt_buf->count, NULL) == 0)) {
-                nf->stats.tx_drop += pkt_buf->count;
-                for (i = 0; i < pkt_buf->count; i++) {
-                        rte_pktmbuf_free(pkt_buf->buffer[i]);
+        sent = rte_ring_enqueue_burst(nf->tx_q, (void **)pkt_buf->buffer, pkt_buf->count, NULL);
+        if (likely(sent > 0)) {
+                nf->stats.tx += sent;
+                onvm_pkt_ring_tx_doorbell(nf);
+        }
+
+        /* The TX thread is behind, keep the rest for the next call */
+        if (unlikely(sent < pkt_buf->count))
+                memmove(pkt_buf->buffer, &pkt_buf->buffer[sent], (pkt_buf->count - sent) * sizeof(struct rte_mbuf *));
+        pkt_buf->count -= sent;
+}
+
+void
+onvm_pkt_ring_tx_doorbell(struct onvm_nf *nf) {
+        /* Opened on first use, one per TX thread this process rings */
+        static sem_t *tx_thread_sems[RTE_MAX_LCORE];
+        uint16_t tx_thread;
+
+        if (!onvm_config->flags.ONVM_ADAPTIVE_POLL || tx_doorbells == NULL)
+                return;
+
+        tx_thread = tx_doorbells->tx_thread[nf->instance_id];
+        /* The tx_q enqueue must be visible before we look at the sleep flag */
+        rte_smp_mb();
+        if (likely(rte_atomic16_read(&tx_doorbells->sleeping[tx_thread]) == 0))
+                return;
+        /* Only one NF gets to post for a given sleep */
+        if (!rte_atomic16_cmpset((volatile uint16_t *)&tx_doorbells->sleeping[tx_thread].cnt, 1, 0))
+                return;
+
+        if (tx_thread_sems[tx_thread] == NULL) {
+                tx_thread_sems[tx_thread] = sem_open(get_tx_thread_sem_name(tx_thread), 0, 0666, 0);
+                if (tx_thread_sems[tx_thread] == SEM_FAILED) {
+                        /* The TX thread wakes up on its own after ADAPTIVE_POLL_MAX_SLEEP_MS */
+                        tx_thread_sems[tx_thread] = NULL;
+                        return;
                 }
-        } else {
-                nf->stats.tx += pkt_buf->count;
         }
-        pkt_buf->count = 0;
+        tx_doorbells->ring_tsc[tx_thread] = rte_get_tsc_cycles();
+        sem_post(tx_thread_sems[tx_thread]);
+}
+
+void
+onvm_pkt_fork(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_service_chain *sc,
+              struct onvm_nf *source_nf) {
+        struct rte_mbuf *clones[ONVM_MAX_BRANCHES];
+        struct onvm_pkt_meta *meta, *clone_meta;
+        struct onvm_pkt_join *join;
+        uint8_t step, count, i;
+
+        if (tx_mgr == NULL || pkt == NULL || sc == NULL)
+                return;
+
+        meta = onvm_get_pkt_meta(pkt);
+        step = meta->chain_index;
+        count = RTE_MIN(sc->sc[step].destination, ONVM_MAX_BRANCHES);
+        for (i = 0; i < count; i++) {
+                clones[i] = rte_pktmbuf_clone(pkt, pkt->pool);
+                if (unlikely(clones[i] == NULL))
+                        break;
+                clone_meta = onvm_get_pkt_meta(clones[i]);
+                *clone_meta = *meta;
+                clone_meta->action = ONVM_NF_ACTION_TONF;
+                clone_meta->destination = sc->branches[step][i];
+                clone_meta->flags = ONVM_SET_BIT(meta->flags, ONVM_PKT_BRANCH_BIT);
+        }
+        if (unlikely(count == 0 || i < count)) {
+                /* Out of mbufs, a packet that can't visit all its branches is dropped */
+                while (i > 0)
+                        rte_pktmbuf_free(clones[--i]);
+                onvm_pkt_drop(pkt);
+                if (source_nf != NULL)
+                        source_nf->stats.tx_drop++;
+                return;
+        }
+
+        /* The packet holds its own reference while it waits, so freeing the
+         * clones never frees it. Its meta is not needed until the merge, the
+         * clones carry a copy */
+        join = (struct onvm_pkt_join *)&pkt->udata64;
+        rte_atomic16_init(&join->pending);
+        rte_atomic16_set(&join->pending, count);
+        rte_atomic16_init(&join->drop);
+
+        for (i = 0; i < count; i++)
+                onvm_pkt_enqueue_nf(tx_mgr, sc->branches[step][i], clones[i], source_nf);
+}
+
+struct rte_mbuf *
+onvm_pkt_join_branch(struct rte_mbuf *clone, struct onvm_nf *nf) {
+        struct onvm_pkt_meta verdict;
+        struct onvm_pkt_meta *meta;
+        struct onvm_pkt_join *join;
+        struct rte_mbuf *pkt;
+
+        verdict = *onvm_get_pkt_meta(clone);
+        pkt = rte_mbuf_from_indirect(clone);
+        join = (struct onvm_pkt_join *)&pkt->udata64;
+
+        if (verdict.action == ONVM_NF_ACTION_DROP) {
+                rte_atomic16_set(&join->drop, 1);
+                if (nf != NULL)
+                        nf->stats.act_drop++;
+        } else if (nf != NULL) {
+                nf->stats.act_next++;
+        }
+
+        /* Mbufs are recycled with their meta, don't leave the bit behind */
+        onvm_get_pkt_meta(clone)->flags = 0;
+        rte_pktmbuf_free(clone);
+        /* Atomic, so the drop set above is seen by whoever comes last */
+        if (!rte_atomic16_dec_and_test(&join->pending))
+                return NULL;
+
+        if (rte_atomic16_read(&join->drop)) {
+                rte_pktmbuf_free(pkt);
+                return NULL;
+        }
+
+        meta = onvm_get_pkt_meta(pkt);
+        meta->action = ONVM_NF_ACTION_NEXT;
+        meta->destination = 0;
+        meta->src = verdict.src;
+        meta->chain_index = verdict.chain_index;
+        meta->flags = verdict.flags & ~(1 << ONVM_PKT_BRANCH_BIT);
+        return pkt;
+}
+
+void
+onvm_pkt_discard(struct rte_mbuf *pkt) {
+        if (pkt == NULL)
+                return;
+
+        if (unlikely(ONVM_CHECK_BIT(onvm_get_pkt_meta(pkt)->flags, ONVM_PKT_BRANCH_BIT))) {
+                onvm_get_pkt_meta(pkt)->action = ONVM_NF_ACTION_DROP;
+                onvm_pkt_join_branch(pkt, NULL);
+                return;
+        }
+        rte_pktmbuf_free(pkt);
 }
 
 /****************************Internal functions*******************************/
 
 inline static void
-onvm_pkt_enqueue_port(struct queue_mgr *tx_mgr, uint16_t port, struct rte_mbuf *buf) {
+onvm_pkt_enqueue_port(struct queue_mgr *tx_mgr, uint16_t port, struct rte_mbuf *buf, struct onvm_nf *nf) {
         struct packet_buf *port_buf;
 
         if (tx_mgr == NULL || buf == NULL)
                 return;
 
-        port_buf = &tx_mgr->tx_thread_info->port_tx_bufs[port];
-        port_buf->buffer[port_buf->count++] = buf;
-        if (port_buf->count == PACKET_READ_SIZE) {
-                onvm_pkt_flush_port_queue(tx_mgr, port);
+        port_buf = onvm_pkt_port_buf(tx_mgr, port);
+        if (port_buf == NULL) {
+                /* No NIC TX queue of its own, a manager TX thread sends it out */
+                port_buf = tx_mgr->to_tx_buf;
+                if (unlikely(port_buf->count == tx_mgr->burst_size)) {
+                        onvm_pkt_enqueue_tx_thread(port_buf, nf);
+                        if (port_buf->count == tx_mgr->burst_size) {
+                                nf->stats.tx_drop++;
+                                onvm_pkt_drop(buf);
+                                return;
+                        }
+                }
+                port_buf->buffer[port_buf->count++] = buf;
+                if (port_buf->count == tx_mgr->burst_size)
+                        onvm_pkt_enqueue_tx_thread(port_buf, nf);
+                return;
+        }
+
+        onvm_pkt_buf_add(tx_mgr, port_buf, buf);
+        if (port_buf->count == tx_mgr->burst_size) {
+                onvm_pkt_flush_port_queue(tx_mgr, port, ONVM_FLUSH_FULL);
         }
 }
 
 inline static void
-onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_nf *nf) {
+onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_flow_entry *flow_entry,
+                             struct onvm_nf *nf) {
         if (tx_mgr == NULL || pkt == NULL || nf == NULL)
                 return;
 
-        struct onvm_flow_entry *flow_entry;
         struct onvm_service_chain *sc;
         struct onvm_pkt_meta *meta = onvm_get_pkt_meta(pkt);
-        int ret;
 
-        ret = onvm_flow_dir_get_pkt(pkt, &flow_entry);
-        if (ret >= 0) {
+        if (flow_entry != NULL && flow_entry->sc != NULL) {
                 sc = flow_entry->sc;
-                meta->action = onvm_sc_next_action(sc, pkt);
-                meta->destination = onvm_sc_next_destination(sc, pkt);
+                onvm_set_pkt_prio(pkt, sc->rx_prio);
         } else {
-                meta->action = onvm_sc_next_action(default_chain, pkt);
-                meta->destination = onvm_sc_next_destination(default_chain, pkt);
+                sc = default_chain;
         }
+        meta->action = onvm_sc_next_action(sc, pkt);
+        meta->destination = onvm_sc_next_destination(sc, pkt);
+        /* Advance before the packet is handed on, it may be gone after */
+        (meta->chain_index)++;
 
         switch (meta->action) {
                 case ONVM_NF_ACTION_DROP:
@@ -302,21 +625,187 @@ onvm_pkt_process_next_action(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, str
                         break;
                 case ONVM_NF_ACTION_OUT:
                         nf->stats.act_out++;
-                        onvm_pkt_enqueue_port(tx_mgr, meta->destination, pkt);
+                        onvm_pkt_enqueue_port(tx_mgr, meta->destination, pkt, nf);
+                        break;
+                case ONVM_NF_ACTION_PARALLEL:
+                        nf->stats.act_tonf++;
+                        onvm_pkt_fork(tx_mgr, pkt, sc, nf);
                         break;
                 default:
                         break;
         }
-        (meta->chain_index)++;
 }
 
 /*******************************Helper function*******************************/
 
+static inline void
+onvm_pkt_update_rx_congestion(struct onvm_nf *nf, uint16_t unsent, unsigned int free_space) {
+        unsigned int threshold = rte_ring_get_capacity(nf->rx_q) / NF_RX_CONGESTION_FRACTION;
+
+        if (unsent > 0 || free_space < threshold) {
+                if (unlikely(!nf->rx_congested))
+                        nf->rx_congested = 1;
+        } else if (unlikely(nf->rx_congested) && free_space >= 2 * threshold) {
+                nf->rx_congested = 0;
+        }
+}
+
 static int
 onvm_pkt_drop(struct rte_mbuf *pkt) {
-        rte_pktmbuf_free(pkt);
+        onvm_pkt_discard(pkt);
         if (pkt != NULL) {
                 return 1;
         }
         return 0;
 }
+
+static inline void
+onvm_pkt_enqueue_nf_hi(struct onvm_nf *nf, struct rte_mbuf *pkt, struct onvm_nf *source_nf) {
+        if (unlikely(onvm_config->flags.ONVM_RX_DELAY_STATS))
+                pkt->timestamp = rte_get_tsc_cycles();
+        if (unlikely(rte_ring_enqueue(nf->rx_q_hi, pkt) != 0)) {
+                onvm_pkt_drop(pkt);
+                nf->stats.rx_drop++;
+                nf->stats.rx_prio[ONVM_RX_PRIO_HIGH].rx_drop++;
+                if (source_nf != NULL)
+                        source_nf->stats.tx_drop++;
+                return;
+        }
+        nf->stats.rx++;
+        nf->stats.rx_prio[ONVM_RX_PRIO_HIGH].rx++;
+        if (source_nf != NULL)
+                source_nf->stats.tx++;
+}
+
+static void
+onvm_pkt_tap(struct queue_mgr *tx_mgr, uint16_t service_id, struct rte_mbuf *pkt) {
+        struct onvm_service_taps *taps;
+        struct onvm_pkt_meta *meta;
+        struct rte_mbuf *clone;
+        struct onvm_nf *nf;
+        uint16_t i, count;
+        uint32_t seq;
+
+        taps = &service_taps[service_id];
+        count = RTE_MIN(taps->count, MAX_TAPS_PER_SERVICE);
+        seq = tx_mgr->tap_seq++;
+        for (i = 0; i < count; i++) {
+                if (seq % taps->taps[i].sample != 0)
+                        continue;
+                nf = &nfs[taps->taps[i].instance_id];
+                if (!onvm_nf_is_valid(nf))
+                        continue;
+                /* Check first, a clone that can't be queued is wasted work */
+                if (unlikely(rte_ring_free_count(nf->rx_q) == 0)) {
+                        nf->stats.rx_drop++;
+                        continue;
+                }
+
+                /* Shares the packet data, but has its own meta for the tap to scribble on */
+                clone = rte_pktmbuf_clone(pkt, pkt->pool);
+                if (unlikely(clone == NULL)) {
+                        nf->stats.rx_drop++;
+                        continue;
+                }
+                meta = onvm_get_pkt_meta(clone);
+                *meta = *onvm_get_pkt_meta(pkt);
+                meta->flags &= ~(1 << ONVM_PKT_BRANCH_BIT);
+                meta->action = ONVM_NF_ACTION_DROP;
+                if (unlikely(onvm_config->flags.ONVM_RX_DELAY_STATS))
+                        clone->timestamp = rte_get_tsc_cycles();
+
+                if (unlikely(rte_ring_enqueue(nf->rx_q, clone) != 0)) {
+                        rte_pktmbuf_free(clone);
+                        nf->stats.rx_drop++;
+                        continue;
+                }
+                nf->stats.rx++;
+        }
+}
+
+static inline struct packet_buf *
+onvm_pkt_port_buf(struct queue_mgr *tx_mgr, uint16_t port) {
+        if (tx_mgr->mgr_type_t == MGR)
+                return &tx_mgr->tx_thread_info->port_tx_bufs[port];
+        if (tx_mgr->nic_tx_bufs != NULL)
+                return &tx_mgr->nic_tx_bufs[port];
+        return NULL;
+}
+
+static inline void
+onvm_pkt_buf_add(struct queue_mgr *tx_mgr, struct packet_buf *buf, struct rte_mbuf *pkt) {
+        if (buf->count == 0 && tx_mgr->flush_deadline_cycles)
+                buf->first_tsc = rte_get_tsc_cycles();
+        buf->buffer[buf->count++] = pkt;
+}
+
+static inline int
+onvm_pkt_buf_due(struct queue_mgr *tx_mgr, struct packet_buf *buf, uint64_t now) {
+        return tx_mgr->flush_deadline_cycles == 0 || now - buf->first_tsc >= tx_mgr->flush_deadline_cycles;
+}
+
+static inline void
+onvm_pkt_count_flush(struct queue_mgr *tx_mgr, enum onvm_flush_reason reason, uint16_t pkts) {
+        if (tx_mgr->flush_stats == NULL)
+                return;
+        tx_mgr->flush_stats->flushes[reason]++;
+        tx_mgr->flush_stats->pkts[reason] += pkts;
+}
+
+static void
+onvm_pkt_flush_nfs(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf, int force) {
+        enum onvm_flush_reason reason;
+        struct packet_buf *nf_buf;
+        uint16_t i, nf_id, kept;
+        uint64_t now;
+
+        if (tx_mgr == NULL || tx_mgr->nf_rx_dirty_count == 0)
+                return;
+
+        if (force)
+                reason = ONVM_FLUSH_IDLE;
+        else
+                reason = tx_mgr->flush_deadline_cycles ? ONVM_FLUSH_DEADLINE : ONVM_FLUSH_LOOP;
+        now = tx_mgr->flush_deadline_cycles ? rte_get_tsc_cycles() : 0;
+
+        /* Only walk destinations that were enqueued to since the last flush.
+         * Buffers that are not due yet, or could not be fully flushed (NF not
+         * ready or its ring full), stay on the list. */
+        kept = 0;
+        for (i = 0; i < tx_mgr->nf_rx_dirty_count; i++) {
+                nf_id = tx_mgr->nf_rx_dirty[i];
+                nf_buf = &tx_mgr->nf_rx_bufs[nf_id];
+                if (force || onvm_pkt_buf_due(tx_mgr, nf_buf, now))
+                        onvm_pkt_flush_nf_queue(tx_mgr, nf_id, source_nf, reason);
+                if (nf_buf->count != 0)
+                        tx_mgr->nf_rx_dirty[kept++] = nf_id;
+                else
+                        nf_buf->dirty = 0;
+        }
+        tx_mgr->nf_rx_dirty_count = kept;
+}
+
+static void
+onvm_pkt_flush_ports(struct queue_mgr *tx_mgr, int force) {
+        enum onvm_flush_reason reason;
+        struct packet_buf *port_buf;
+        uint64_t now;
+        uint16_t i;
+
+        /* RX threads and NFs without a NIC TX queue own no port buffers */
+        if (tx_mgr == NULL || (tx_mgr->mgr_type_t == NF && tx_mgr->nic_tx_bufs == NULL) ||
+            (tx_mgr->mgr_type_t == MGR && tx_mgr->tx_thread_info == NULL))
+                return;
+
+        if (force)
+                reason = ONVM_FLUSH_IDLE;
+        else
+                reason = tx_mgr->flush_deadline_cycles ? ONVM_FLUSH_DEADLINE : ONVM_FLUSH_LOOP;
+        now = tx_mgr->flush_deadline_cycles ? rte_get_tsc_cycles() : 0;
+
+        for (i = 0; i < ports->num_ports; i++) {
+                port_buf = onvm_pkt_port_buf(tx_mgr, ports->id[i]);
+                if (port_buf->count != 0 && (force || onvm_pkt_buf_due(tx_mgr, port_buf, now)))
+                        onvm_pkt_flush_port_queue(tx_mgr, ports->id[i], reason);
+        }
+}
@@ -56,9 +56,13 @@
 #include "onvm_includes.h"
 #include "onvm_sc_common.h"
 #include "onvm_sc_mgr.h"
+#include "onvm_trace.h"
 
 extern struct port_info *ports;
 extern struct onvm_service_chain *default_chain;
+extern struct onvm_configuration *onvm_config;
+extern struct tx_doorbell_info *tx_doorbells;
+extern struct onvm_service_taps *service_taps;
 
 /*********************************Interfaces**********************************/
 
@@ -75,7 +79,23 @@ void
 onvm_pkt_process_tx_batch(struct queue_mgr *tx_mgr, struct rte_mbuf *pkts[], uint16_t tx_count, struct onvm_nf *nf);
 
 /*
- * Interface to send packets to all NFs after processing them.
+ * Interface to look up the next hop of the ONVM_NF_ACTION_NEXT packets in a
+ * burst and set their action and destination to it, as if the NF had sent
+ * them there. Branch clones and packets whose next hop is a parallel fork
+ * are left to onvm_pkt_process_tx_batch. Nothing is counted here, the
+ * packets are counted under their new action where they are sent.
+ *
+ * Inputs : an array of packets
+ *          the size of the array
+ *
+ */
+void
+onvm_pkt_resolve_next(struct rte_mbuf *pkts[], uint16_t count);
+
+/*
+ * Interface to send packets to all NFs after processing them, called at the
+ * end of every poll loop. With a flush deadline set, buffers whose oldest
+ * packet is not due yet are kept to grow the burst.
  *
  * Input : a pointer to the tx queue
  *         a pointer to the NF possessing the TX queue.
@@ -84,15 +104,38 @@ onvm_pkt_process_tx_batch(struct queue_mgr *tx_mgr, struct rte_mbuf *pkts[], uin
 void
 onvm_pkt_flush_all_nfs(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf);
 
+/*
+ * Interface to send packets to all ports after processing them, with the
+ * same deadline policy. Does nothing for NFs without a NIC TX queue.
+ *
+ * Input : a pointer to the tx queue
+ *
+ */
+void
+onvm_pkt_flush_all_ports(struct queue_mgr *tx_mgr);
+
+/*
+ * Interface to send every buffered packet right away, regardless of the
+ * flush deadline. Must be called before the thread goes to sleep.
+ *
+ * Input : a pointer to the tx queue
+ *         a pointer to the NF possessing the TX queue.
+ *
+ */
+void
+onvm_pkt_flush_all_idle(struct queue_mgr *tx_mgr, struct onvm_nf *source_nf);
+
 /*
  * Function to send packets to one NF after processing them.
  *
  * Input : a pointer to the tx queue
  *         a pointer to the NF possessing the TX queue.
+ *         why the buffer is sent, for the flush stats
  *
  */
 void
-onvm_pkt_flush_nf_queue(struct queue_mgr *tx_mgr, uint16_t nf_id, struct onvm_nf *source_nf);
+onvm_pkt_flush_nf_queue(struct queue_mgr *tx_mgr, uint16_t nf_id, struct onvm_nf *source_nf,
+                        enum onvm_flush_reason reason);
 
 /*
  * Function to enqueue a packet on one NF's queue.
@@ -107,14 +150,16 @@ void
 onvm_pkt_enqueue_nf(struct queue_mgr *tx_mgr, uint16_t dst_service_id, struct rte_mbuf *pkt, struct onvm_nf *source_nf);
 
 /*
- * Function to send packets to one port after processing them.
+ * Function to send packets to one port after processing them. Used by the
+ * TX threads, and by NFs that were given a NIC TX queue of their own.
  *
  * Input : a pointer to the tx queue
  *         the number of the port
+ *         why the buffer is sent, for the flush stats
  *
  */
 void
-onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port);
+onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port, enum onvm_flush_reason reason);
 
 /*
  * Give packets to TX thread so it can do useful work.
@@ -126,4 +171,53 @@ onvm_pkt_flush_port_queue(struct queue_mgr *tx_mgr, uint16_t port);
 void
 onvm_pkt_enqueue_tx_thread(struct packet_buf *pkt_buf, struct onvm_nf *nf);
 
+/*
+ * Function to wake the manager TX thread draining an NF's tx_q, if it went
+ * to sleep in adaptive polling mode. Called after packets were put on tx_q.
+ *
+ * Input : a pointer to the NF
+ *
+ */
+void
+onvm_pkt_ring_tx_doorbell(struct onvm_nf *nf);
+
+/*
+ * Function to send a packet to every branch service of the parallel chain
+ * step it reached. Each branch gets a clone sharing the packet data, and the
+ * packet itself waits for them, see onvm_pkt_join_branch.
+ *
+ * Inputs : a pointer to the tx queue
+ *          a pointer to the packet, its chain_index set to the parallel step
+ *          the packet's service chain
+ *          a pointer to the NF involved, NULL for the RX threads
+ *
+ */
+void
+onvm_pkt_fork(struct queue_mgr *tx_mgr, struct rte_mbuf *pkt, struct onvm_service_chain *sc,
+              struct onvm_nf *source_nf);
+
+/*
+ * Function to take back a branch clone. ONVM_NF_ACTION_DROP from any branch
+ * drops the packet, any other action lets it pass.
+ *
+ * Inputs : a pointer to the clone
+ *          a pointer to the branch NF, or NULL
+ *
+ * Output : the original packet set to ONVM_NF_ACTION_NEXT once the last
+ *          branch passed it, else NULL
+ *
+ */
+struct rte_mbuf *
+onvm_pkt_join_branch(struct rte_mbuf *clone, struct onvm_nf *nf);
+
+/*
+ * Function to free a packet that won't be processed further. A branch clone
+ * counts as dropped by its branch, so the packet it came from is not leaked.
+ *
+ * Input : a pointer to the packet
+ *
+ */
+void
+onvm_pkt_discard(struct rte_mbuf *pkt);
+
 #endif  // _ONVM_PKT_COMMON_H_
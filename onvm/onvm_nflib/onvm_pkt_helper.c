@@ -56,6 +56,25 @@
 #include <rte_memcpy.h>
 #include <rte_mempool.h>
 
+#ifdef RTE_MACHINE_CPUFLAG_SSE2
+#include <rte_vect.h>
+#endif
+
+#include "onvm_flow_table.h"
+
+/* Packets whose tuples onvm_pkt_parse_burst transposes at once */
+#define ONVM_PKT_PARSE_GROUP 4
+
+static void
+onvm_pkt_fill_hdrs(struct rte_mbuf* pkt, struct onvm_pkt_hdr_cache* hdrs);
+
+static inline const struct onvm_pkt_hdr_cache*
+onvm_pkt_get_hdrs(struct rte_mbuf* pkt, struct onvm_pkt_hdr_cache* local);
+
+static inline void
+onvm_pkt_store_tuples(const struct onvm_pkt_hdr_cache** hdrs, uint16_t count, struct onvm_pkt_burst_tuples* tuples,
+                      uint16_t first);
+
 int
 onvm_pkt_set_mac_addr(struct rte_mbuf* pkt, unsigned src_port_id, unsigned dst_port_id, struct port_info* ports) {
         struct ether_hdr* eth;
@@ -143,53 +162,39 @@ onvm_pkt_ether_hdr(struct rte_mbuf* pkt) {
 
 struct tcp_hdr*
 onvm_pkt_tcp_hdr(struct rte_mbuf* pkt) {
-        struct ipv4_hdr* ipv4 = onvm_pkt_ipv4_hdr(pkt);
-
-        if (unlikely(
-                ipv4 ==
-                NULL)) {  // Since we aren't dealing with IPv6 packets for now, we can ignore anything that isn't IPv4
-                return NULL;
-        }
+        struct onvm_pkt_hdr_cache local;
+        const struct onvm_pkt_hdr_cache* hdrs = onvm_pkt_get_hdrs(pkt, &local);
 
-        if (ipv4->next_proto_id != IP_PROTOCOL_TCP) {
+        // Since we aren't dealing with IPv6 packets for now, we can ignore anything that isn't IPv4
+        if (!(hdrs->flags & ONVM_PKT_HDR_IPV4) || hdrs->proto != IP_PROTOCOL_TCP) {
                 return NULL;
         }
 
-        uint8_t* pkt_data = rte_pktmbuf_mtod(pkt, uint8_t*) + sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr);
-        return (struct tcp_hdr*)pkt_data;
+        return rte_pktmbuf_mtod_offset(pkt, struct tcp_hdr*, hdrs->l4_off);
 }
 
 struct udp_hdr*
 onvm_pkt_udp_hdr(struct rte_mbuf* pkt) {
-        struct ipv4_hdr* ipv4 = onvm_pkt_ipv4_hdr(pkt);
-
-        if (unlikely(
-                ipv4 ==
-                NULL)) {  // Since we aren't dealing with IPv6 packets for now, we can ignore anything that isn't IPv4
-                return NULL;
-        }
+        struct onvm_pkt_hdr_cache local;
+        const struct onvm_pkt_hdr_cache* hdrs = onvm_pkt_get_hdrs(pkt, &local);
 
-        if (ipv4->next_proto_id != IP_PROTOCOL_UDP) {
+        // Since we aren't dealing with IPv6 packets for now, we can ignore anything that isn't IPv4
+        if (!(hdrs->flags & ONVM_PKT_HDR_IPV4) || hdrs->proto != IP_PROTOCOL_UDP) {
                 return NULL;
         }
 
-        uint8_t* pkt_data = rte_pktmbuf_mtod(pkt, uint8_t*) + sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr);
-        return (struct udp_hdr*)pkt_data;
+        return rte_pktmbuf_mtod_offset(pkt, struct udp_hdr*, hdrs->l4_off);
 }
 
 struct ipv4_hdr*
 onvm_pkt_ipv4_hdr(struct rte_mbuf* pkt) {
-        struct ipv4_hdr* ipv4 = (struct ipv4_hdr*)(rte_pktmbuf_mtod(pkt, uint8_t*) + sizeof(struct ether_hdr));
+        struct onvm_pkt_hdr_cache local;
+        const struct onvm_pkt_hdr_cache* hdrs = onvm_pkt_get_hdrs(pkt, &local);
 
-        /* In an IP packet, the first 4 bits determine the version.
-         * The next 4 bits are called the Internet Header Length, or IHL.
-         * DPDK's ipv4_hdr struct combines both the version and the IHL into one uint8_t.
-         */
-        uint8_t version = (ipv4->version_ihl >> 4) & 0b1111;
-        if (unlikely(version != 4)) {
+        if (unlikely(!(hdrs->flags & ONVM_PKT_HDR_IPV4))) {
                 return NULL;
         }
-        return ipv4;
+        return rte_pktmbuf_mtod_offset(pkt, struct ipv4_hdr*, hdrs->l3_off);
 }
 
 int
@@ -207,6 +212,72 @@ onvm_pkt_is_ipv4(struct rte_mbuf* pkt) {
         return onvm_pkt_ipv4_hdr(pkt) != NULL;
 }
 
+int
+onvm_pkt_parse_hdrs(struct rte_mbuf* pkt) {
+        struct onvm_pkt_hdr_cache* cache = onvm_pkt_hdr_cache_area(pkt);
+        struct onvm_ft_ipv4_5tuple key;
+
+        if (unlikely(cache == NULL)) {
+                return -1;
+        }
+
+        onvm_pkt_fill_hdrs(pkt, cache);
+        if (pkt->ol_flags & PKT_RX_RSS_HASH) {
+                cache->hash = pkt->hash.rss;
+                cache->flags |= ONVM_PKT_HDR_HASH;
+        } else if (cache->flags & ONVM_PKT_HDR_IPV4) {
+                memset(&key, 0, sizeof(struct onvm_ft_ipv4_5tuple));
+                key.src_addr = cache->src_addr;
+                key.dst_addr = cache->dst_addr;
+                key.src_port = cache->src_port;
+                key.dst_port = cache->dst_port;
+                key.proto = cache->proto;
+                cache->hash = onvm_softrss(&key);
+                cache->flags |= ONVM_PKT_HDR_HASH;
+        }
+
+        pkt->l2_len = cache->l3_off;
+        pkt->l3_len = cache->l4_off - cache->l3_off;
+        pkt->l4_len = cache->payload_off - cache->l4_off;
+        return 0;
+}
+
+void
+onvm_pkt_invalidate_hdrs(struct rte_mbuf* pkt) {
+        struct onvm_pkt_hdr_cache* cache = onvm_pkt_hdr_cache_area(pkt);
+
+        if (cache != NULL) {
+                cache->flags = 0;
+        }
+}
+
+int
+onvm_pkt_parse_burst(struct rte_mbuf** pkts, uint16_t count, struct onvm_pkt_burst_tuples* tuples) {
+        struct onvm_pkt_hdr_cache local[ONVM_PKT_PARSE_GROUP];
+        const struct onvm_pkt_hdr_cache* hdrs[ONVM_PKT_PARSE_GROUP];
+        uint16_t i, j, n;
+        int num_ipv4 = 0;
+
+        count = RTE_MIN(count, ONVM_MAX_BURST_SIZE);
+        memset(tuples->ipv4, 0, sizeof(tuples->ipv4));
+
+        for (i = 0; i < count; i += n) {
+                n = RTE_MIN(count - i, ONVM_PKT_PARSE_GROUP);
+                for (j = 0; j < n; j++) {
+                        hdrs[j] = onvm_pkt_get_hdrs(pkts[i + j], &local[j]);
+                        tuples->proto[i + j] = hdrs[j]->proto;
+                        tuples->l4_off[i + j] = hdrs[j]->l4_off;
+                        if (hdrs[j]->flags & ONVM_PKT_HDR_IPV4) {
+                                tuples->ipv4[(i + j) / 64] |= 1ULL << ((i + j) % 64);
+                                num_ipv4++;
+                        }
+                }
+                onvm_pkt_store_tuples(hdrs, n, tuples, i);
+        }
+
+        return num_ipv4;
+}
+
 void
 onvm_pkt_print(struct rte_mbuf* pkt) {
         struct ipv4_hdr* ipv4 = onvm_pkt_ipv4_hdr(pkt);
@@ -512,6 +583,9 @@ onvm_pkt_set_checksums(struct rte_mbuf* pkt) {
                         ip->hdr_checksum = calculate_ip_cksum(ip, pkt->l3_len);
                 }
         }
+
+        /* Headers are rewritten before their checksums are set */
+        onvm_pkt_invalidate_hdrs(pkt);
 }
 
 int
@@ -571,6 +645,7 @@ onvm_pkt_generate_tcp(struct rte_mempool* pktmbuf_pool, struct tcp_hdr* tcp_hdr,
                 return NULL;
         }
 
+        onvm_pkt_invalidate_hdrs(pkt);
         pkt->ol_flags = PKT_TX_IP_CKSUM | PKT_TX_IPV4 | PKT_TX_TCP_CKSUM;
         pkt->l2_len = sizeof(struct ether_hdr);
         pkt->l3_len = sizeof(struct ipv4_hdr);
@@ -710,6 +785,7 @@ onvm_pkt_generate_udp(struct rte_mempool* pktmbuf_pool, struct udp_hdr* udp_hdr,
                 return NULL;
         }
 
+        onvm_pkt_invalidate_hdrs(pkt);
         pkt->ol_flags = PKT_TX_IP_CKSUM | PKT_TX_IPV4 | PKT_TX_UDP_CKSUM;
         pkt->l2_len = sizeof(struct ether_hdr);
         pkt->l3_len = sizeof(struct ipv4_hdr);
@@ -754,3 +830,103 @@ onvm_pkt_generate_udp(struct rte_mempool* pktmbuf_pool, struct udp_hdr* udp_hdr,
 
         return pkt;
 }
+
+/* Parse the headers of pkt into hdrs, all but the hash */
+static void
+onvm_pkt_fill_hdrs(struct rte_mbuf* pkt, struct onvm_pkt_hdr_cache* hdrs) {
+        struct ipv4_hdr* ipv4;
+        struct tcp_hdr* tcp;
+        struct udp_hdr* udp;
+
+        memset(hdrs, 0, sizeof(struct onvm_pkt_hdr_cache));
+        hdrs->flags = ONVM_PKT_HDR_VALID;
+        hdrs->l3_off = sizeof(struct ether_hdr);
+        hdrs->l4_off = hdrs->l3_off;
+        hdrs->payload_off = hdrs->l3_off;
+
+        /* In an IP packet, the first 4 bits determine the version.
+         * The next 4 bits are called the Internet Header Length, or IHL.
+         * DPDK's ipv4_hdr struct combines both the version and the IHL into one uint8_t.
+         */
+        ipv4 = rte_pktmbuf_mtod_offset(pkt, struct ipv4_hdr*, hdrs->l3_off);
+        if (unlikely(((ipv4->version_ihl >> 4) & 0b1111) != 4)) {
+                return;
+        }
+
+        hdrs->flags |= ONVM_PKT_HDR_IPV4;
+        hdrs->proto = ipv4->next_proto_id;
+        hdrs->src_addr = ipv4->src_addr;
+        hdrs->dst_addr = ipv4->dst_addr;
+        hdrs->l4_off = hdrs->l3_off + (ipv4->version_ihl & 0b1111) * 4;
+        hdrs->payload_off = hdrs->l4_off;
+
+        if (hdrs->proto == IP_PROTOCOL_TCP) {
+                tcp = rte_pktmbuf_mtod_offset(pkt, struct tcp_hdr*, hdrs->l4_off);
+                hdrs->src_port = tcp->src_port;
+                hdrs->dst_port = tcp->dst_port;
+                hdrs->payload_off += ((tcp->data_off >> 4) & 0b1111) * 4;
+        } else if (hdrs->proto == IP_PROTOCOL_UDP) {
+                udp = rte_pktmbuf_mtod_offset(pkt, struct udp_hdr*, hdrs->l4_off);
+                hdrs->src_port = udp->src_port;
+                hdrs->dst_port = udp->dst_port;
+                hdrs->payload_off += sizeof(struct udp_hdr);
+        }
+}
+
+/* The cached headers of pkt, or its headers parsed into local if it has none */
+static inline const struct onvm_pkt_hdr_cache*
+onvm_pkt_get_hdrs(struct rte_mbuf* pkt, struct onvm_pkt_hdr_cache* local) {
+        const struct onvm_pkt_hdr_cache* cache = onvm_pkt_hdr_cache(pkt);
+
+        if (likely(cache != NULL)) {
+                return cache;
+        }
+        onvm_pkt_fill_hdrs(pkt, local);
+        return local;
+}
+
+/*
+ * Copy the addresses and ports of count parsed packets into the arrays of
+ * tuples, starting at entry first. The cache keeps src_addr, dst_addr and the
+ * two ports in 12 consecutive bytes, so with SSE2 a group of 4 packets is
+ * loaded as 4 rows and transposed into one vector per field.
+ */
+static inline void
+onvm_pkt_store_tuples(const struct onvm_pkt_hdr_cache** hdrs, uint16_t count, struct onvm_pkt_burst_tuples* tuples,
+                      uint16_t first) {
+        uint16_t j;
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE2
+        if (likely(count == ONVM_PKT_PARSE_GROUP)) {
+                __m128i r0, r1, r2, r3, t0, t1, t2, t3, ports;
+
+                /* Each row is src_addr, dst_addr, src_port | dst_port << 16 and the hash */
+                r0 = _mm_loadu_si128((const __m128i*)&hdrs[0]->src_addr);
+                r1 = _mm_loadu_si128((const __m128i*)&hdrs[1]->src_addr);
+                r2 = _mm_loadu_si128((const __m128i*)&hdrs[2]->src_addr);
+                r3 = _mm_loadu_si128((const __m128i*)&hdrs[3]->src_addr);
+                t0 = _mm_unpacklo_epi32(r0, r1);
+                t1 = _mm_unpacklo_epi32(r2, r3);
+                t2 = _mm_unpackhi_epi32(r0, r1);
+                t3 = _mm_unpackhi_epi32(r2, r3);
+                _mm_storeu_si128((__m128i*)&tuples->src_addr[first], _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128((__m128i*)&tuples->dst_addr[first], _mm_unpackhi_epi64(t0, t1));
+
+                /* Gather the four source ports in the low half and the destination ports in the high half */
+                ports = _mm_unpacklo_epi64(t2, t3);
+                ports = _mm_shufflelo_epi16(ports, _MM_SHUFFLE(3, 1, 2, 0));
+                ports = _mm_shufflehi_epi16(ports, _MM_SHUFFLE(3, 1, 2, 0));
+                ports = _mm_shuffle_epi32(ports, _MM_SHUFFLE(3, 1, 2, 0));
+                _mm_storel_epi64((__m128i*)&tuples->src_port[first], ports);
+                _mm_storel_epi64((__m128i*)&tuples->dst_port[first], _mm_unpackhi_epi64(ports, ports));
+                return;
+        }
+#endif
+
+        for (j = 0; j < count; j++) {
+                tuples->src_addr[first + j] = hdrs[j]->src_addr;
+                tuples->dst_addr[first + j] = hdrs[j]->dst_addr;
+                tuples->src_port[first + j] = hdrs[j]->src_port;
+                tuples->dst_port[first + j] = hdrs[j]->dst_port;
+        }
+}
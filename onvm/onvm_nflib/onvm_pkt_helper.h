@@ -44,6 +44,7 @@
 #include <inttypes.h>
 #include <rte_ether.h>
 #include <rte_mempool.h>
+#include "onvm_common.h"
 
 struct port_info;
 struct rte_mbuf;
@@ -54,6 +55,22 @@ struct ipv4_hdr;
 #define IP_PROTOCOL_TCP 6
 #define IP_PROTOCOL_UDP 17
 
+/**
+ * 5-tuples of a burst of packets, one array per field, as filled by
+ * onvm_pkt_parse_burst. Addresses and ports are in network order. Fields of
+ * packets that are not IPv4 are 0, and ports are 0 unless the packet is TCP or
+ * UDP. Bit i of ipv4 is set if pkts[i] is IPv4.
+ */
+struct onvm_pkt_burst_tuples {
+        uint32_t src_addr[ONVM_MAX_BURST_SIZE];
+        uint32_t dst_addr[ONVM_MAX_BURST_SIZE];
+        uint16_t src_port[ONVM_MAX_BURST_SIZE];
+        uint16_t dst_port[ONVM_MAX_BURST_SIZE];
+        uint16_t l4_off[ONVM_MAX_BURST_SIZE];
+        uint8_t proto[ONVM_MAX_BURST_SIZE];
+        uint64_t ipv4[ONVM_BURST_BITMAP_WORDS];
+};
+
 #define SUPPORTS_IPV4_CHECKSUM_OFFLOAD (1 << 0)
 #define SUPPORTS_TCP_CHECKSUM_OFFLOAD (1 << 1)
 #define SUPPORTS_UDP_CHECKSUM_OFFLOAD (1 << 2)
@@ -126,6 +143,30 @@ onvm_pkt_is_udp(struct rte_mbuf* pkt);
 int
 onvm_pkt_is_ipv4(struct rte_mbuf* pkt);
 
+/**
+ * Parse the headers of a packet into its header cache (struct onvm_pkt_hdr_cache),
+ * which the functions above and onvm_ft_fill_key then read instead of the headers.
+ * The manager RX threads do this for every packet they receive.
+ * Returns 0 on success, -1 if the packet's pool has no room for the cache.
+ */
+int
+onvm_pkt_parse_hdrs(struct rte_mbuf* pkt);
+
+/**
+ * Drop the parsed headers of a packet. NFs must call this after changing its
+ * addresses, ports, protocol or header lengths. onvm_pkt_set_checksums does it.
+ */
+void
+onvm_pkt_invalidate_hdrs(struct rte_mbuf* pkt);
+
+/**
+ * Fill tuples with the 5-tuples and L4 offsets of up to ONVM_MAX_BURST_SIZE packets,
+ * read from their header caches or parsed for packets without one.
+ * Returns the number of IPv4 packets.
+ */
+int
+onvm_pkt_parse_burst(struct rte_mbuf** pkts, uint16_t count, struct onvm_pkt_burst_tuples* tuples);
+
 /**
  * Print out a packet or header.  Check to be sure DPDK doesn't already do any of these
  */
@@ -41,33 +41,118 @@
 #include "onvm_sc_common.h"
 #include <errno.h>
 #include <inttypes.h>
+#include <rte_cycles.h>
+#include <rte_jhash.h>
+#include <rte_memzone.h>
 #include "onvm_common.h"
 
+#define NO_FLAGS 0
+
+struct onvm_sc_intern_table *sc_intern;
+
+/***********************Internal Functions Prototypes*************************/
+
+static uint32_t
+onvm_sc_hash(const struct onvm_service_chain *chain);
+
+static int
+onvm_sc_equal(const struct onvm_service_chain *a, const struct onvm_service_chain *b);
+
 /*********************************Interfaces**********************************/
 
 uint16_t
 onvm_sc_service_to_nf_map(uint16_t service_id, struct rte_mbuf *pkt) {
-        if (!nf_per_service_count || !services) {
+        struct service_dispatch *dispatch;
+        struct service_dispatch_table *table;
+
+        if (!service_dispatch) {
                 rte_exit(EXIT_FAILURE, "Failed to retrieve service information\n");
         }
-        uint16_t num_nfs_available = nf_per_service_count[service_id];
 
-        if (num_nfs_available == 0)
+        if (pkt == NULL || service_id >= MAX_SERVICES)
                 return 0;
 
-        if (pkt == NULL)
+        dispatch = &service_dispatch[service_id];
+        table = &dispatch->tables[dispatch->active];
+        if (table->num_nfs == 0)
                 return 0;
 
-        uint16_t instance_index = pkt->hash.rss % num_nfs_available;
-        uint16_t instance_id = services[service_id][instance_index];
-        return instance_id;
+        return table->entries[pkt->hash.rss % SERVICE_DISPATCH_SIZE];
+}
+
+uint16_t
+onvm_sc_service_to_nf_map_load_aware(uint16_t service_id, struct rte_mbuf *pkt, struct flow_affinity_bucket *cache) {
+        struct service_dispatch *dispatch;
+        struct service_dispatch_table *table;
+        struct flow_affinity_bucket *bucket;
+        struct flow_affinity_entry *entry, *free_entry;
+        uint64_t now, idle;
+        uint16_t first, second, i;
+        uint32_t rss;
+
+        if (!service_dispatch) {
+                rte_exit(EXIT_FAILURE, "Failed to retrieve service information\n");
+        }
+
+        if (pkt == NULL || service_id >= MAX_SERVICES)
+                return 0;
+
+        dispatch = &service_dispatch[service_id];
+        table = &dispatch->tables[dispatch->active];
+        if (table->num_nfs == 0)
+                return 0;
+
+        rss = pkt->hash.rss;
+        now = rte_get_tsc_cycles();
+        idle = FLOW_AFFINITY_IDLE_MS * rte_get_timer_hz() / 1000;
+        bucket = &cache[(rss ^ (service_id * 0x9e3779b1)) & (FLOW_AFFINITY_BUCKETS - 1)];
+        free_entry = NULL;
+        for (i = 0; i < FLOW_AFFINITY_WAYS; i++) {
+                entry = &bucket->entries[i];
+                if (entry->instance_id != 0 && entry->rss == rss && entry->service_id == service_id) {
+                        if (onvm_nf_is_valid(&nfs[entry->instance_id]) &&
+                            nfs[entry->instance_id].service_id == service_id && !nfs[entry->instance_id].draining) {
+                                entry->last_seen = now;
+                                return entry->instance_id;
+                        }
+                        /* Its instance went away, the flow has to move */
+                        free_entry = entry;
+                        break;
+                }
+                if (free_entry == NULL && (entry->instance_id == 0 || now - entry->last_seen > idle))
+                        free_entry = entry;
+        }
+
+        first = table->entries[rss % SERVICE_DISPATCH_SIZE];
+        if (free_entry == NULL) {
+                bucket->overflow_tsc = now;
+                return first;
+        }
+
+        /* New flow: the second choice comes from the same table with the hash
+         * halves swapped. Flows turned away by a full bucket went to their
+         * consistent hash instance, and may only be pinned now, so they keep it
+         * until the bucket was not full for a whole idle period */
+        if (now - bucket->overflow_tsc > idle) {
+                second = table->entries[((rss >> 16) | (rss << 16)) % SERVICE_DISPATCH_SIZE];
+                if (second != first && onvm_nf_is_valid(&nfs[second]) &&
+                    (!onvm_nf_is_valid(&nfs[first]) ||
+                     rte_ring_count(nfs[second].rx_q) < rte_ring_count(nfs[first].rx_q)))
+                        first = second;
+        }
+
+        free_entry->rss = rss;
+        free_entry->service_id = service_id;
+        free_entry->instance_id = first;
+        free_entry->last_seen = now;
+        return first;
 }
 
 int
 onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint16_t destination) {
         int chain_length = chain->chain_length;
 
-        if (unlikely(chain_length > ONVM_MAX_CHAIN_LENGTH)) {
+        if (unlikely(chain_length >= ONVM_MAX_CHAIN_LENGTH - 1)) {
                 return ENOSPC;
         }
         /*the first entry is reserved*/
@@ -79,6 +164,23 @@ onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint16_t
         return 0;
 }
 
+int
+onvm_sc_append_parallel(struct onvm_service_chain *chain, const uint16_t *services, uint8_t count) {
+        uint8_t i;
+
+        if (unlikely(count == 0 || count > ONVM_MAX_BRANCHES)) {
+                return EINVAL;
+        }
+        if (onvm_sc_append_entry(chain, ONVM_NF_ACTION_PARALLEL, count) != 0) {
+                return ENOSPC;
+        }
+        for (i = 0; i < count; i++) {
+                chain->branches[chain->chain_length][i] = services[i];
+        }
+
+        return 0;
+}
+
 int
 onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, uint16_t destination) {
         if (unlikely(entry > chain->chain_length)) {
@@ -93,9 +195,147 @@ onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, u
 void
 onvm_sc_print(struct onvm_service_chain *chain) {
         int i;
+        uint16_t j;
         for (i = 1; i <= chain->chain_length; i++) {
                 printf("cur_index:%d, action:%" PRIu8 ", destination:%" PRIu16 "\n", i, chain->sc[i].action,
                        chain->sc[i].destination);
+                if (chain->sc[i].action != ONVM_NF_ACTION_PARALLEL)
+                        continue;
+                for (j = 0; j < chain->sc[i].destination; j++)
+                        printf("        branch:%" PRIu16 ", service:%" PRIu16 "\n", j, chain->branches[i][j]);
         }
         printf("\n");
 }
+
+int
+onvm_sc_intern_init(void) {
+        const struct rte_memzone *mz_sc_intern;
+
+        mz_sc_intern =
+            rte_memzone_reserve(MZ_SC_INTERN_INFO, sizeof(struct onvm_sc_intern_table), rte_socket_id(), NO_FLAGS);
+        if (mz_sc_intern == NULL)
+                return -1;
+        memset(mz_sc_intern->addr, 0, sizeof(struct onvm_sc_intern_table));
+        sc_intern = mz_sc_intern->addr;
+        rte_spinlock_init(&sc_intern->lock);
+
+        return 0;
+}
+
+int
+onvm_sc_intern_nf_init(void) {
+        const struct rte_memzone *mz_sc_intern;
+
+        mz_sc_intern = rte_memzone_lookup(MZ_SC_INTERN_INFO);
+        if (mz_sc_intern == NULL)
+                return -1;
+        sc_intern = mz_sc_intern->addr;
+
+        return 0;
+}
+
+struct onvm_service_chain *
+onvm_sc_intern(const struct onvm_service_chain *chain) {
+        struct onvm_service_chain *shared = NULL;
+        uint16_t *bucket;
+        uint16_t index;
+
+        if (unlikely(sc_intern == NULL || chain == NULL))
+                return NULL;
+
+        bucket = &sc_intern->buckets[onvm_sc_hash(chain) & (ONVM_SC_INTERN_BUCKETS - 1)];
+        rte_spinlock_lock(&sc_intern->lock);
+        for (index = *bucket; index != 0; index = sc_intern->next[index - 1]) {
+                if (onvm_sc_equal(&sc_intern->chains[index - 1], chain)) {
+                        shared = &sc_intern->chains[index - 1];
+                        break;
+                }
+        }
+
+        if (shared == NULL) {
+                if (sc_intern->free_list != 0) {
+                        index = sc_intern->free_list;
+                        sc_intern->free_list = sc_intern->next[index - 1];
+                } else if (sc_intern->used < ONVM_SC_INTERN_MAX) {
+                        index = ++sc_intern->used;
+                } else {
+                        rte_spinlock_unlock(&sc_intern->lock);
+                        return NULL;
+                }
+                shared = &sc_intern->chains[index - 1];
+                *shared = *chain;
+                shared->ref_cnt = 0;
+                sc_intern->next[index - 1] = *bucket;
+                *bucket = index;
+                sc_intern->count++;
+        }
+        shared->ref_cnt++;
+        rte_spinlock_unlock(&sc_intern->lock);
+
+        return shared;
+}
+
+void
+onvm_sc_release(struct onvm_service_chain *chain) {
+        uint16_t *link;
+        uint16_t index;
+
+        if (!onvm_sc_is_interned(chain))
+                return;
+
+        index = chain - sc_intern->chains + 1;
+        link = &sc_intern->buckets[onvm_sc_hash(chain) & (ONVM_SC_INTERN_BUCKETS - 1)];
+        rte_spinlock_lock(&sc_intern->lock);
+        if (--chain->ref_cnt <= 0) {
+                while (*link != 0 && *link != index)
+                        link = &sc_intern->next[*link - 1];
+                if (*link == index)
+                        *link = sc_intern->next[index - 1];
+                sc_intern->next[index - 1] = sc_intern->free_list;
+                sc_intern->free_list = index;
+                sc_intern->count--;
+        }
+        rte_spinlock_unlock(&sc_intern->lock);
+}
+
+/*****************************Internal functions******************************/
+
+/* Only the steps in use are hashed and compared, entry 0 is reserved */
+static uint32_t
+onvm_sc_hash(const struct onvm_service_chain *chain) {
+        uint32_t hash;
+        uint16_t j;
+        int i;
+
+        hash = rte_jhash_2words(chain->chain_length, chain->rx_prio, 0);
+        for (i = 1; i <= chain->chain_length; i++) {
+                hash = rte_jhash_2words(chain->sc[i].action, chain->sc[i].destination, hash);
+                if (chain->sc[i].action != ONVM_NF_ACTION_PARALLEL)
+                        continue;
+                for (j = 0; j < chain->sc[i].destination; j++)
+                        hash = rte_jhash_1word(chain->branches[i][j], hash);
+        }
+
+        return hash;
+}
+
+static int
+onvm_sc_equal(const struct onvm_service_chain *a, const struct onvm_service_chain *b) {
+        uint16_t j;
+        int i;
+
+        if (a->chain_length != b->chain_length || a->rx_prio != b->rx_prio)
+                return 0;
+        for (i = 1; i <= a->chain_length; i++) {
+                if (a->sc[i].action != b->sc[i].action || a->sc[i].destination != b->sc[i].destination)
+                        return 0;
+                if (a->sc[i].action != ONVM_NF_ACTION_PARALLEL)
+                        continue;
+                for (j = 0; j < a->sc[i].destination; j++) {
+                        if (a->branches[i][j] != b->branches[i][j])
+                                return 0;
+                }
+        }
+
+        return 1;
+}
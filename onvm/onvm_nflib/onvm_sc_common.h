@@ -42,6 +42,7 @@
 #define _ONVM_SC_COMMON_H_
 
 #include <inttypes.h>
+#include <rte_lcore.h>
 #include "onvm_common.h"
 
 /********************************Global variables*****************************/
@@ -49,6 +50,9 @@
 extern struct onvm_nf *nfs;
 extern uint16_t **services;
 extern uint16_t *nf_per_service_count;
+extern struct service_dispatch *service_dispatch;
+extern struct onvm_sc_intern_table *sc_intern;
+extern struct onvm_quiesce_info *quiesce_info;
 
 /********************************Interfaces***********************************/
 
@@ -56,10 +60,21 @@ uint16_t
 onvm_sc_service_to_nf_map(uint16_t service_id,
                           struct rte_mbuf *pkt); /*, uint16_t *nf_per_service_count, uint16_t **services);*/
 
+/* Like onvm_sc_service_to_nf_map, but a flow not yet in cache is sent to the
+ * less loaded of two instances picked from the dispatch table, and pinned to it
+ * so its later packets stay in order. cache has FLOW_AFFINITY_BUCKETS buckets. */
+uint16_t
+onvm_sc_service_to_nf_map_load_aware(uint16_t service_id, struct rte_mbuf *pkt, struct flow_affinity_bucket *cache);
+
 /* append a entry to serivce chain, 0 means appending successful, 1 means failed*/
 int
 onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint16_t destination);
 
+/* append a parallel step sending the packet to each of count services, which
+ * must leave it unmodified. 0 means appending successful */
+int
+onvm_sc_append_parallel(struct onvm_service_chain *chain, const uint16_t *services, uint8_t count);
+
 /*set entry to a new action and destination, 0 means setting successful, 1 means failed */
 int
 onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, uint16_t destination);
@@ -67,4 +82,55 @@ onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, u
 void
 onvm_sc_print(struct onvm_service_chain *chain);
 
+/* Set up the shared table of interned chains, in the manager */
+int
+onvm_sc_intern_init(void);
+
+/* Map the table of interned chains set up by the manager, in NFs */
+int
+onvm_sc_intern_nf_init(void);
+
+/* Return the shared copy of a chain with the same steps, made on first use,
+ * and take a reference on it. Returns NULL if ONVM_SC_INTERN_MAX distinct
+ * chains are in use. Chains are compared by length, RX priority and steps. */
+struct onvm_service_chain *
+onvm_sc_intern(const struct onvm_service_chain *chain);
+
+/* Drop a reference taken with onvm_sc_intern, the last one frees the chain.
+ * Chains that were not interned are left alone. */
+void
+onvm_sc_release(struct onvm_service_chain *chain);
+
+static inline int
+onvm_sc_is_interned(const struct onvm_service_chain *chain) {
+        return sc_intern != NULL && chain >= sc_intern->chains && chain < sc_intern->chains + ONVM_SC_INTERN_MAX;
+}
+
+/* Readers call these between bursts, when they hold no pointers into tables
+ * the manager replaces. NFs are called by onvm_nflib, manager threads register
+ * first. Each is published before the reader's next access. */
+static inline void
+onvm_quiesce_nf(uint16_t instance_id) {
+        quiesce_info->nf_gen[instance_id] = quiesce_info->gen;
+        rte_smp_mb();
+}
+
+static inline void
+onvm_quiesce_nf_offline(uint16_t instance_id) {
+        quiesce_info->nf_gen[instance_id] = ONVM_QUIESCE_OFFLINE;
+}
+
+static inline void
+onvm_quiesce_mgr_register(void) {
+        quiesce_info->mgr_gen[rte_lcore_id()] = quiesce_info->gen;
+        quiesce_info->mgr_reader[rte_lcore_id()] = 1;
+        rte_smp_mb();
+}
+
+static inline void
+onvm_quiesce_mgr(void) {
+        quiesce_info->mgr_gen[rte_lcore_id()] = quiesce_info->gen;
+        rte_smp_mb();
+}
+
 #endif // _ONVM_SC_COMMON_H_
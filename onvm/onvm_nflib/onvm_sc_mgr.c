@@ -40,11 +40,19 @@
 
 #include "onvm_sc_mgr.h"
 #include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
 #include <rte_debug.h>
+#include <rte_jhash.h>
 #include <rte_malloc.h>
 #include <rte_memory.h>
+#include <rte_pause.h>
 #include "onvm_sc_common.h"
 
+/* Whether readers are done with the inactive table, waiting for them briefly */
+static int
+onvm_sc_dispatch_readers_gone(const struct service_dispatch *dispatch);
+
 struct onvm_service_chain*
 onvm_sc_get(void) {
         return NULL;
@@ -61,3 +69,124 @@ onvm_sc_create(void) {
 
         return chain;
 }
+
+/*
+ * Maglev style table population: every instance walks its own permutation of
+ * the table, derived from its instance ID, and the instances take turns
+ * claiming their next free slot. Only the permutations of instances that come
+ * or go change, so most slots keep their owner.
+ *
+ * The inactive table is rebuilt and then published by flipping active. Readers
+ * may still hold the inactive table until they passed a quiescent point after
+ * the last flip. The update waits SERVICE_DISPATCH_WAIT_US for them at most,
+ * then leaves it to onvm_sc_dispatch_maintain.
+ */
+void
+onvm_sc_update_service_dispatch(uint16_t service_id) {
+        struct service_dispatch *dispatch;
+        struct service_dispatch_table *table;
+        uint32_t offset[MAX_NFS_PER_SERVICE];
+        uint32_t skip[MAX_NFS_PER_SERVICE];
+        uint32_t next[MAX_NFS_PER_SERVICE];
+        uint8_t taken[SERVICE_DISPATCH_SIZE];
+        uint16_t num_nfs, instance_id, i;
+        uint32_t slot, filled;
+
+        if (service_dispatch == NULL || service_id >= MAX_SERVICES)
+                return;
+
+        dispatch = &service_dispatch[service_id];
+        if (!onvm_sc_dispatch_readers_gone(dispatch)) {
+                dispatch->pending = 1;
+                return;
+        }
+        table = &dispatch->tables[dispatch->active ^ 1];
+        num_nfs = RTE_MIN(nf_per_service_count[service_id], MAX_NFS_PER_SERVICE);
+
+        for (i = 0; i < num_nfs; i++) {
+                instance_id = services[service_id][i];
+                offset[i] = rte_jhash_1word(instance_id, 0) % SERVICE_DISPATCH_SIZE;
+                skip[i] = rte_jhash_1word(instance_id, 1) % (SERVICE_DISPATCH_SIZE - 1) + 1;
+                next[i] = 0;
+        }
+
+        memset(taken, 0, sizeof(taken));
+        filled = 0;
+        while (num_nfs > 0 && filled < SERVICE_DISPATCH_SIZE) {
+                for (i = 0; i < num_nfs && filled < SERVICE_DISPATCH_SIZE; i++) {
+                        do {
+                                slot = (offset[i] + next[i] * skip[i]) % SERVICE_DISPATCH_SIZE;
+                                next[i]++;
+                        } while (taken[slot]);
+                        taken[slot] = 1;
+                        table->entries[slot] = services[service_id][i];
+                        filled++;
+                }
+        }
+        table->num_nfs = num_nfs;
+
+        rte_smp_wmb();
+        dispatch->active ^= 1;
+        dispatch->flip_gen = onvm_quiesce_advance();
+        dispatch->pending = 0;
+}
+
+void
+onvm_sc_dispatch_maintain(void) {
+        uint16_t i;
+
+        if (service_dispatch == NULL)
+                return;
+
+        for (i = 0; i < MAX_SERVICES; i++) {
+                if (unlikely(service_dispatch[i].pending))
+                        onvm_sc_update_service_dispatch(i);
+        }
+}
+
+uint32_t
+onvm_quiesce_advance(void) {
+        uint32_t gen;
+
+        /* Only the master thread replaces shared data */
+        gen = quiesce_info->gen + 1;
+        quiesce_info->gen = gen;
+        rte_smp_mb();
+        return gen;
+}
+
+int
+onvm_quiesce_passed(uint32_t gen) {
+        uint32_t seen;
+        unsigned i;
+
+        /* Fused NFs read in their leader's thread */
+        for (i = 0; i < MAX_NFS; i++) {
+                if (!onvm_nf_is_valid(&nfs[i]) || ONVM_CHECK_BIT(nfs[i].flags.init_options, FUSED_NF_BIT))
+                        continue;
+                seen = quiesce_info->nf_gen[i];
+                if (seen != ONVM_QUIESCE_OFFLINE && seen < gen)
+                        return 0;
+        }
+        for (i = 0; i < RTE_MAX_LCORE; i++) {
+                if (quiesce_info->mgr_reader[i] && quiesce_info->mgr_gen[i] < gen)
+                        return 0;
+        }
+
+        return 1;
+}
+
+/*******************************Helper functions*******************************/
+
+static int
+onvm_sc_dispatch_readers_gone(const struct service_dispatch *dispatch) {
+        uint64_t deadline;
+
+        deadline = rte_get_tsc_cycles() + SERVICE_DISPATCH_WAIT_US * rte_get_timer_hz() / 1000000;
+        while (!onvm_quiesce_passed(dispatch->flip_gen)) {
+                if (rte_get_tsc_cycles() > deadline)
+                        return 0;
+                rte_pause();
+        }
+        return 1;
+}
@@ -76,4 +76,16 @@ onvm_sc_get(void);
 /*create service chain*/
 struct onvm_service_chain*
 onvm_sc_create(void);
+/*rebuild the dispatch table of a service from services[] and publish it*/
+void
+onvm_sc_update_service_dispatch(uint16_t service_id);
+/*retry dispatch table updates that had to wait for readers, from the master thread*/
+void
+onvm_sc_dispatch_maintain(void);
+/*bump the quiescence generation after replacing shared data, and return it*/
+uint32_t
+onvm_quiesce_advance(void);
+/*whether every running NF and manager thread passed a quiescent point in gen or later, or is offline*/
+int
+onvm_quiesce_passed(uint32_t gen);
 #endif  // _ONVM_SC_MGR_H_
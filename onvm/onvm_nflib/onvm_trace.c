@@ -0,0 +1,129 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * onvm_trace.c - per packet latency tracing along service chains
+ ********************************************************************/
+
+#include <rte_memzone.h>
+#include <string.h>
+#include "onvm_trace.h"
+
+#define NO_FLAGS 0
+
+struct onvm_trace_stats *trace_stats = NULL;
+
+/*********************************Interfaces**********************************/
+
+int
+onvm_trace_init(uint32_t sample) {
+        const struct rte_memzone *mz_trace;
+
+        if (sample == 0)
+                return 0;
+
+        mz_trace = rte_memzone_reserve(MZ_TRACE_INFO, sizeof(struct onvm_trace_stats), rte_socket_id(), NO_FLAGS);
+        if (mz_trace == NULL)
+                return -1;
+        memset(mz_trace->addr, 0, sizeof(struct onvm_trace_stats));
+        trace_stats = mz_trace->addr;
+
+        return 0;
+}
+
+int
+onvm_trace_nf_init(uint32_t sample) {
+        const struct rte_memzone *mz_trace;
+
+        if (sample == 0)
+                return 0;
+
+        mz_trace = rte_memzone_lookup(MZ_TRACE_INFO);
+        if (mz_trace == NULL)
+                return -1;
+        trace_stats = mz_trace->addr;
+
+        return 0;
+}
+
+void
+onvm_trace_egress(struct rte_mbuf **pkts, uint16_t count) {
+        struct onvm_pkt_trace *trace;
+        uint32_t prev, wait, held, now_off;
+        uint64_t now = 0;
+        uint16_t i, hop, service;
+
+        for (i = 0; i < count; i++) {
+                trace = onvm_pkt_trace(pkts[i]);
+                if (trace == NULL)
+                        continue;
+                if (now == 0)
+                        now = rte_get_tsc_cycles();
+                now_off = onvm_trace_offset(trace, now);
+
+                rte_atomic64_inc(&trace_stats->samples);
+                rte_atomic64_inc(&trace_stats->total.buckets[onvm_trace_hist_bucket(now_off)]);
+                if (unlikely(trace->hops > ONVM_TRACE_MAX_HOPS)) {
+                        rte_atomic64_inc(&trace_stats->truncated);
+                        continue;
+                }
+
+                for (hop = 0, prev = 0; hop < trace->hops; hop++) {
+                        service = trace->service[hop];
+                        if (unlikely(service >= MAX_SERVICES))
+                                break;
+                        /* The TSCs of different cores may be a few cycles apart */
+                        wait = trace->dequeue[hop] > prev ? trace->dequeue[hop] - prev : 0;
+                        rte_atomic64_inc(&trace_stats->wait[hop][service].buckets[onvm_trace_hist_bucket(wait)]);
+                        held = trace->done[hop] - trace->dequeue[hop];
+                        rte_atomic64_inc(&trace_stats->nf[hop][service].buckets[onvm_trace_hist_bucket(held)]);
+                        prev = trace->done[hop];
+                }
+                wait = now_off > prev ? now_off - prev : 0;
+                rte_atomic64_inc(&trace_stats->egress.buckets[onvm_trace_hist_bucket(wait)]);
+        }
+}
+
+uint64_t
+onvm_trace_hist_value(unsigned bucket) {
+        unsigned shift;
+
+        if (bucket < (1 << ONVM_TRACE_HIST_SUB_BITS))
+                return bucket;
+        shift = (bucket >> ONVM_TRACE_HIST_SUB_BITS) - 1;
+        return (uint64_t)((1 << ONVM_TRACE_HIST_SUB_BITS) + (bucket & ((1 << ONVM_TRACE_HIST_SUB_BITS) - 1))) << shift;
+}
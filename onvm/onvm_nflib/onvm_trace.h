@@ -0,0 +1,199 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2019 George Washington University
+ *            2015-2019 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * The name of the author may not be used to endorse or promote
+ *       products derived from this software without specific prior
+ *       written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * onvm_trace.h - per packet latency tracing along service chains
+ ********************************************************************/
+
+#ifndef _ONVM_TRACE_H_
+#define _ONVM_TRACE_H_
+
+#include <rte_atomic.h>
+#include <rte_mbuf.h>
+#include "onvm_common.h"
+
+#define MZ_TRACE_INFO "MProc_trace_info"
+
+#define ONVM_TRACE_MAX_HOPS ONVM_MAX_CHAIN_LENGTH  // NF hops a traced packet records, later ones only count in the total
+#define ONVM_TRACE_HIST_SUB_BITS 3                  // each power of 2 of the histograms is split in 2^3 buckets
+#define ONVM_TRACE_HIST_BUCKETS ((33 - ONVM_TRACE_HIST_SUB_BITS) << ONVM_TRACE_HIST_SUB_BITS)
+
+/*
+ * Timestamps of a traced packet, kept in its mbuf private area after the
+ * header cache. The manager RX thread sets rx_tsc, every NF hop then records
+ * its service and the cycles after rx_tsc it dequeued and returned the packet.
+ */
+struct onvm_pkt_trace {
+        uint64_t rx_tsc;
+        uint8_t hops;
+        uint16_t service[ONVM_TRACE_MAX_HOPS];
+        uint32_t dequeue[ONVM_TRACE_MAX_HOPS];
+        uint32_t done[ONVM_TRACE_MAX_HOPS];
+};
+
+/* Private area of mbufs when tracing, the trace follows the 8 byte aligned header cache */
+#define ONVM_MBUF_PRIV_TRACE_SIZE \
+        RTE_ALIGN(sizeof(struct onvm_pkt_hdr_cache) + sizeof(struct onvm_pkt_trace), RTE_MBUF_PRIV_ALIGN)
+
+/* Log linear latency histogram in cycles, see onvm_trace_hist_bucket */
+struct onvm_trace_hist {
+        rte_atomic64_t buckets[ONVM_TRACE_HIST_BUCKETS];
+};
+
+/*
+ * Latencies of the traced packets that reached a port, shared by the manager
+ * and NFs, per chain stage: the hop number and the service at that hop.
+ * wait is the time since the previous hop returned the packet (or since RX
+ * for hop 0), nf the time from dequeue until the hop returned it.
+ */
+struct onvm_trace_stats {
+        rte_atomic64_t samples;
+        rte_atomic64_t truncated;  // packets with more than ONVM_TRACE_MAX_HOPS hops
+        struct onvm_trace_hist wait[ONVM_TRACE_MAX_HOPS][MAX_SERVICES];
+        struct onvm_trace_hist nf[ONVM_TRACE_MAX_HOPS][MAX_SERVICES];
+        struct onvm_trace_hist egress;  // from the last hop until handed to the NIC
+        struct onvm_trace_hist total;   // from RX until handed to the NIC
+};
+
+/* NULL unless the manager was started with a trace sample rate */
+extern struct onvm_trace_stats *trace_stats;
+
+/* Manager side: reserve the shared histograms if sample is not 0 */
+int
+onvm_trace_init(uint32_t sample);
+
+/* NF side: find the histograms if the manager traces packets */
+int
+onvm_trace_nf_init(uint32_t sample);
+
+/* Record the latencies of the traced packets among pkts, which are about to be
+ * handed to the NIC */
+void
+onvm_trace_egress(struct rte_mbuf **pkts, uint16_t count);
+
+/* Lower bound in cycles of a histogram bucket */
+uint64_t
+onvm_trace_hist_value(unsigned bucket);
+
+/* Bucket of a latency: values under 2^ONVM_TRACE_HIST_SUB_BITS get one each,
+ * larger ones one of 2^ONVM_TRACE_HIST_SUB_BITS per power of 2 */
+static inline unsigned
+onvm_trace_hist_bucket(uint32_t cycles) {
+        unsigned exp;
+
+        if (cycles < (1 << ONVM_TRACE_HIST_SUB_BITS))
+                return cycles;
+        exp = 31 - __builtin_clz(cycles);
+        return ((exp - ONVM_TRACE_HIST_SUB_BITS + 1) << ONVM_TRACE_HIST_SUB_BITS) +
+               ((cycles >> (exp - ONVM_TRACE_HIST_SUB_BITS)) & ((1 << ONVM_TRACE_HIST_SUB_BITS) - 1));
+}
+
+/* The trace of a packet, or NULL if it is not traced. A fresh mbuf has no
+ * parsed headers (l2_len 0), so stale meta flags never make it look traced.
+ * Clones share their data, not the trace, and are never traced. */
+static inline struct onvm_pkt_trace *
+onvm_pkt_trace(struct rte_mbuf *pkt) {
+        if (likely(!ONVM_CHECK_BIT(onvm_get_pkt_meta(pkt)->flags, ONVM_PKT_TRACE_BIT)) || pkt->l2_len == 0 ||
+            RTE_MBUF_INDIRECT(pkt) || pkt->priv_size < ONVM_MBUF_PRIV_TRACE_SIZE)
+                return NULL;
+        return (struct onvm_pkt_trace *)RTE_PTR_ADD(pkt, sizeof(struct rte_mbuf) + sizeof(struct onvm_pkt_hdr_cache));
+}
+
+/* Manager RX: start tracing a packet, or make sure it is not traced */
+static inline void
+onvm_trace_rx(struct rte_mbuf *pkt, int sampled, uint64_t now) {
+        struct onvm_pkt_meta *meta = onvm_get_pkt_meta(pkt);
+        struct onvm_pkt_trace *trace;
+
+        meta->flags &= ~(1 << ONVM_PKT_TRACE_BIT);
+        if (!sampled)
+                return;
+        meta->flags = ONVM_SET_BIT(meta->flags, ONVM_PKT_TRACE_BIT);
+        trace = onvm_pkt_trace(pkt);
+        if (trace == NULL) {
+                meta->flags &= ~(1 << ONVM_PKT_TRACE_BIT);
+                return;
+        }
+        trace->rx_tsc = now;
+        trace->hops = 0;
+}
+
+static inline uint32_t
+onvm_trace_offset(struct onvm_pkt_trace *trace, uint64_t now) {
+        return now - trace->rx_tsc > UINT32_MAX ? UINT32_MAX : (uint32_t)(now - trace->rx_tsc);
+}
+
+/* NF side: the hop of service_id got the packets among pkts that are traced */
+static inline void
+onvm_trace_hop_dequeue(struct rte_mbuf **pkts, uint16_t count, uint16_t service_id) {
+        struct onvm_pkt_trace *trace;
+        uint64_t now = 0;
+        uint16_t i;
+
+        for (i = 0; i < count; i++) {
+                trace = onvm_pkt_trace(pkts[i]);
+                if (trace == NULL)
+                        continue;
+                if (now == 0)
+                        now = rte_get_tsc_cycles();
+                if (trace->hops < ONVM_TRACE_MAX_HOPS) {
+                        trace->service[trace->hops] = service_id;
+                        trace->dequeue[trace->hops] = trace->done[trace->hops] = onvm_trace_offset(trace, now);
+                }
+                if (trace->hops <= ONVM_TRACE_MAX_HOPS)
+                        trace->hops++;
+        }
+}
+
+/* NF side: the current hop returned the packets among pkts that are traced */
+static inline void
+onvm_trace_hop_done(struct rte_mbuf **pkts, uint16_t count) {
+        struct onvm_pkt_trace *trace;
+        uint64_t now = 0;
+        uint16_t i;
+
+        for (i = 0; i < count; i++) {
+                trace = onvm_pkt_trace(pkts[i]);
+                if (trace == NULL || trace->hops == 0 || trace->hops > ONVM_TRACE_MAX_HOPS)
+                        continue;
+                if (now == 0)
+                        now = rte_get_tsc_cycles();
+                trace->done[trace->hops - 1] = onvm_trace_offset(trace, now);
+        }
+}
+
+#endif  // _ONVM_TRACE_H_